@@ -0,0 +1,147 @@
+// Measures the size of the telemetry archive and the throughput of its scans.
+// A bath is simulated at 1 Hz with a few milliseconds of jitter: fill and drain cycles of the volume,
+// and water quality readings every 10 s. The scans are checked against the appended values.
+// Usage: archive [directory] [days]
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <dirent.h>
+#include <fcntl.h>
+#include <iostream>
+#include <random>
+#include <unistd.h>
+#include <vector>
+#include "../src/Journal.cpp"
+#include "../src/Archive.cpp"
+using namespace std;
+
+typedef chrono::steady_clock Clock;
+
+double elapsedMs(Clock::time_point start) {
+    return chrono::duration<double, milli>(Clock::now() - start).count();
+}
+
+// Drops the segments from the page cache, to measure a cold scan
+void evictDirectory(const string& directory) {
+    DIR* listing = ::opendir(directory.c_str());
+    while(struct dirent* entry = ::readdir(listing)) {
+        string path = directory + "/" + entry->d_name;
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if(fd >= 0) {
+            ::posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+            ::close(fd);
+        }
+    }
+    ::closedir(listing);
+}
+
+void removeDirectory(const string& directory) {
+    DIR* listing = ::opendir(directory.c_str());
+    while(struct dirent* entry = ::readdir(listing)) {
+        if(entry->d_name[0] != '.') {
+            ::unlink((directory + "/" + entry->d_name).c_str());
+        }
+    }
+    ::closedir(listing);
+    ::rmdir(directory.c_str());
+}
+
+int main(int argc, char** argv) {
+    string directory = string(argc > 1 ? argv[1] : ".") + "/bench-archive";
+    int days = argc > 2 ? stoi(argv[2]) : 30;
+    size_t rowCount = (size_t)days * 86400;
+    const int columns = (int)ArchiveColumn::Count;
+
+    mt19937_64 random(42);
+    vector<int64_t> times(rowCount);
+    vector<double> values[columns];
+    for(auto& column : values) {
+        column.resize(rowCount);
+    }
+    int64_t start = 1700000000000;
+    double volume = 0, debit = 0;
+    double quality[] = { 7.2, 310, 0.18, 140, 22 };
+    for(size_t i = 0; i < rowCount; i++) {
+        times[i] = start + (int64_t)i * 1000 + (int64_t)(random() % 7) - 3;
+        // A 20 minute cycle: filling with the debit of the bath pipe, then draining
+        size_t phase = i % 1200;
+        if(phase == 0) debit = 0.2 + (random() % 5) * 0.1;
+        if(phase < 300) volume = min(volume + debit, 300.0);
+        else if(phase >= 900) volume = max(volume - 1.0, 0.0);
+        values[0][i] = volume;
+        if(i % 10 == 0) {
+            // Readings with 2 decimals, drifting around their nominal value
+            for(int q = 0; q < 5; q++) {
+                quality[q] = round(quality[q] * (1 + ((int)(random() % 21) - 10) * 0.0005) * 100) / 100;
+            }
+        }
+        for(int q = 0; q < 5; q++) {
+            values[q + 1][i] = quality[q];
+        }
+    }
+
+    size_t bytes;
+    {
+        ArchiveWriter writer;
+        auto begin = Clock::now();
+        {
+            Archive archive(&writer, directory);
+            double row[columns];
+            for(size_t i = 0; i < rowCount; i++) {
+                for(int c = 0; c < columns; c++) {
+                    row[c] = values[c][i];
+                }
+                archive.append(times[i], row);
+            }
+            double appendTime = elapsedMs(begin) * 1e6 / rowCount;
+            cout << rowCount << " rows of " << columns << " values, append " << appendTime << " ns/row\n";
+        }
+        ArchiveStats stats = writer.getStats();
+        bytes = stats.bytes;
+        size_t samples = rowCount * columns;
+        cout << stats.segments << " segments, " << bytes / 1048576.0 << " MiB: " << (double)bytes / samples
+             << " bytes/sample, " << (double)bytes / rowCount << " bytes/row (raw: 16 bytes/sample, "
+             << 8 + 8 * columns << " bytes/row)" << (stats.failed ? ", FAILED writes" : "") << "\n";
+    }
+
+    int failures = 0;
+    ArchiveWriter writer;
+    Archive archive(&writer, directory);
+    struct Scan {
+        const char* name;
+        ArchiveColumn column;
+        int64_t from, to;
+        bool cold;
+    };
+    int64_t end = times.back() + 1;
+    Scan scans[] = {
+        { "volume, all, cold", ArchiveColumn::Volume, 0, end, true },
+        { "volume, all, warm", ArchiveColumn::Volume, 0, end, false },
+        { "pH, all, warm    ", ArchiveColumn::PH, 0, end, false },
+        { "pH, 1 hour, cold ", ArchiveColumn::PH, end - 3600 * 1000 * 24, end - 3600 * 1000 * 23, true },
+    };
+    for(auto& scan : scans) {
+        if(scan.cold) {
+            evictDirectory(directory);
+        }
+        size_t index = lower_bound(times.begin(), times.end(), scan.from) - times.begin();
+        size_t rows = 0;
+        bool same = true;
+        auto begin = Clock::now();
+        archive.scan(scan.column, scan.from, scan.to, [&](int64_t time, double value) {
+            same = same && index < rowCount && times[index] == time
+                && memcmp(&values[(int)scan.column][index], &value, sizeof(value)) == 0;
+            index++;
+            rows++;
+            return true;
+        });
+        double scanTime = elapsedMs(begin);
+        size_t expected = lower_bound(times.begin(), times.end(), scan.to) - lower_bound(times.begin(), times.end(), scan.from);
+        same = same && rows == expected;
+        failures += !same;
+        cout << scan.name << " " << rows << " rows in " << scanTime << " ms: " << rows / scanTime / 1000
+             << " M rows/s" << (same ? "" : " MISMATCH") << "\n";
+    }
+    removeDirectory(directory);
+    return failures == 0 ? 0 : 1;
+}
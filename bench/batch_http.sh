@@ -0,0 +1,49 @@
+#!/bin/sh
+# Compares the commands per second of POST /batch with the same commands sent as individual requests.
+# Both sides reuse one keep-alive connection, so the difference is the per-request cost
+# (parsing, routing, bathLock and response).
+# The commands bring the bath back to its initial state, so every round succeeds.
+# Needs a running server (make run).
+# Usage: bench/batch_http.sh [base url] [rounds]
+URL=${1:-http://127.0.0.1:9080}
+ROUNDS=${2:-200}
+COMMANDS="stopper/on bath/on/0.2/38 salt/off bath/off stopper/off"
+COUNT=$(echo $COMMANDS | wc -w)
+
+CONFIG=$(mktemp)
+trap 'rm -f "$CONFIG"' EXIT
+
+now() {
+    date +%s.%N
+}
+
+# Individual requests
+: > "$CONFIG"
+i=0
+while [ $i -lt "$ROUNDS" ]; do
+    for command in $COMMANDS; do
+        echo "url = \"$URL/$command\"" >> "$CONFIG"
+    done
+    i=$((i + 1))
+done
+start=$(now)
+curl -s -X POST -K "$CONFIG" > /dev/null
+end=$(now)
+individual=$(echo "$start $end" | awk -v n=$((ROUNDS * COUNT)) '{ printf "%.0f", n / ($2 - $1) }')
+
+# One batch per round
+BODY="[$(echo $COMMANDS | sed 's/\([^ ]*\)/"\1"/g; s/ /, /g')]"
+: > "$CONFIG"
+i=0
+while [ $i -lt "$ROUNDS" ]; do
+    echo "url = \"$URL/batch\"" >> "$CONFIG"
+    i=$((i + 1))
+done
+start=$(now)
+curl -s -X POST -d "$BODY" -K "$CONFIG" > /dev/null
+end=$(now)
+batch=$(echo "$start $end" | awk -v n=$((ROUNDS * COUNT)) '{ printf "%.0f", n / ($2 - $1) }')
+
+echo "$((ROUNDS * COUNT)) commands, $COUNT per batch"
+echo "individual requests: $individual commands/s"
+echo "POST /batch: $batch commands/s"
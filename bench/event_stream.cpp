@@ -0,0 +1,84 @@
+// Measures how long publishing an event takes under the lock of the bath, and how long delivering it takes once
+// the lock is released, when thousands of long-poll clients are waiting on a bath, each client polling again as soon
+// as it is answered. Checks the eviction of the clients that fall behind.
+// Usage: event_stream [subscribers]
+#include <chrono>
+#include <iostream>
+#include "../src/EventStream.cpp"
+#include "../src/JsonWriter.cpp"
+using namespace std;
+
+struct Subscriber {
+    uint64_t cursor;
+    uint64_t responses;
+    uint64_t events;
+};
+
+EventStream* stream;
+vector<Subscriber> subscribers;
+
+// Parses the "version" of a response, as a client would do to get its next cursor
+uint64_t responseVersion(const string& body) {
+    size_t pos = body.find("\"version\": ");
+    return pos == string::npos ? 0 : stoull(body.substr(pos + 11));
+}
+
+void subscribe(size_t id) {
+    stream->poll(subscribers[id].cursor, chrono::seconds(30), [id](int status, const string& body) {
+        auto& subscriber = subscribers[id];
+        subscriber.responses++;
+        if(status == 200) {
+            uint64_t version = responseVersion(body);
+            if(subscriber.cursor != EventStream::CURRENT_VERSION) {
+                subscriber.events += version - subscriber.cursor;
+            }
+            subscriber.cursor = version;
+            subscribe(id);
+        }
+    });
+}
+
+int main(int argc, char* argv[]) {
+    size_t count = argc > 1 ? stoul(argv[1]) : 10000;
+    const int events = 200;
+    EventStream events_stream;
+    stream = &events_stream;
+    subscribers.assign(count, { .cursor = EventStream::CURRENT_VERSION, .responses = 0, .events = 0 });
+    for(size_t i = 0; i < count; i++) {
+        // The first poll returns the current version at once, the second one waits
+        subscribe(i);
+    }
+    cout << stream->getStats().waiters << " subscribers waiting\n";
+
+    double publishMicros = 0, micros = 0;
+    for(int i = 0; i < events; i++) {
+        auto start = chrono::steady_clock::now();
+        stream->publish("volume", "{\"currentVolume\": " + to_string(i) + "}");
+        auto published = chrono::steady_clock::now();
+        stream->deliver();
+        publishMicros += chrono::duration<double, micro>(published - start).count();
+        micros += chrono::duration<double, micro>(chrono::steady_clock::now() - start).count();
+    }
+
+    uint64_t received = 0;
+    for(auto& subscriber : subscribers) {
+        received += subscriber.events;
+    }
+    auto stats = stream->getStats();
+    cout << events << " events published in " << micros / 1000 << " ms: " << publishMicros / events
+         << " us per event under the lock, " << micros / events << " us per event with the deliveries, "
+         << micros * 1000 / ((double)events * count) << " ns per delivery\n";
+    cout << received << " / " << (uint64_t)events * count << " events received, " << stats.waiters << " subscribers waiting\n";
+
+    // A client that stopped polling for longer than the ring is evicted
+    EventStream small(16);
+    for(int i = 0; i < 20; i++) {
+        small.publish("volume", "{}");
+    }
+    int status = 0;
+    small.poll(2, chrono::seconds(1), [&](int s, const string&) { status = s; });
+    cout << "cursor behind the ring: " << status << "\n";
+
+    bool ok = received == (uint64_t)events * count && stats.waiters == count && status == 410;
+    return ok ? 0 : 1;
+}
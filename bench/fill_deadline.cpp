@@ -0,0 +1,73 @@
+// Compares the water that goes past the fill target in the two fill modes.
+// Polling: the interval check adds a second of flow per run, and shuts the pipes off on the first run past the target.
+// Deadline: a timer of the scheduler runs at the predicted crossing time, the overshoot is the flow during its lateness.
+// The timers are real: fills crossing their target within the next 3 seconds are scheduled together.
+// Usage: fill_deadline [fills]
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <iostream>
+#include <random>
+#include <vector>
+#include "../src/TickScheduler.cpp"
+using namespace std;
+
+typedef chrono::steady_clock Clock;
+
+typedef struct Fill {
+    double volume;
+    double target;
+    // Liters per second: the bath pipe, or the bath and the shower
+    double rate;
+} Fill;
+
+void report(const char* name, vector<double>& overshoots) {
+    sort(overshoots.begin(), overshoots.end());
+    double total = 0;
+    for(double overshoot : overshoots) {
+        total += overshoot;
+    }
+    cout << name << " overshoot: avg " << total / overshoots.size() * 1000 << " mL, p99 "
+         << overshoots[overshoots.size() * 99 / 100] * 1000 << " mL, max " << overshoots.back() * 1000 << " mL\n";
+}
+
+int main(int argc, char** argv) {
+    size_t count = argc > 1 ? stoul(argv[1]) : 2000;
+    mt19937_64 random(42);
+    uniform_real_distribution<double> start(0, 50), target(60, 290);
+    vector<Fill> fills(count);
+    for(auto& fill : fills) {
+        fill = { start(random), target(random), random() % 2 ? 0.25 : 0.45 };
+    }
+
+    vector<double> polling;
+    for(auto& fill : fills) {
+        double volume = fill.volume;
+        while(volume < fill.target) {
+            volume += fill.rate;
+        }
+        polling.push_back(volume - fill.target);
+    }
+    report("polling ", polling);
+
+    // The fills are shifted in time so that they cross their target within 3 seconds, on the same scheduler as the baths
+    TickScheduler scheduler(2);
+    vector<double> deadline(count);
+    atomic<size_t> done { 0 };
+    auto now = Clock::now();
+    uniform_real_distribution<double> crossing(0.1, 3);
+    for(size_t i = 0; i < count; i++) {
+        auto when = now + chrono::duration_cast<Clock::duration>(chrono::duration<double>(crossing(random)));
+        double rate = fills[i].rate;
+        scheduler.scheduleAt([&deadline, &done, i, when, rate] {
+            deadline[i] = chrono::duration<double>(Clock::now() - when).count() * rate;
+            done++;
+        }, when);
+    }
+    while(done < count) {
+        this_thread::sleep_for(chrono::milliseconds(100));
+    }
+    report("deadline", deadline);
+    return 0;
+}
@@ -0,0 +1,113 @@
+// Compares the per-object interval check with the struct-of-arrays fleet pass, at the default physics step.
+// Prints how many baths are advanced per microsecond by each implementation.
+#include <chrono>
+#include <cmath>
+#include <iostream>
+#include <random>
+#include "../src/FleetTick.cpp"
+using namespace std;
+
+#define DRAIN_SPEED .2
+
+// The fields of SmartBath used by intervalCheck in polling mode
+typedef struct BathObject {
+    BathPhysics physics;
+    WaterState water;
+    double capacity;
+    bool isFillTargetSet;
+    double fillTarget;
+    bool isSaltPumpOn;
+    bool targetReached;
+} BathObject;
+
+// Same steps as SmartBath::intervalCheck in polling mode, one object at a time
+void advanceObjects(vector<BathObject>& baths) {
+    for(auto& bath : baths) {
+        double limit = bath.isFillTargetSet ? min(bath.fillTarget, bath.capacity) : bath.capacity;
+        double remaining = 1;
+        if(bath.physics.advance(bath.water, remaining, limit)) {
+            WaterFlow flow = bath.physics.getFlow();
+            flow.inflow = 0;
+            if(bath.water.volume >= bath.capacity) {
+                // Turning the pipes off cancels the fill target
+                bath.water.volume = bath.capacity;
+                bath.isFillTargetSet = false;
+            }
+            if(bath.isFillTargetSet && bath.fillTarget <= bath.water.volume) {
+                bath.isFillTargetSet = false;
+                bath.targetReached = true;
+            }
+            bath.physics.setFlow(flow);
+            bath.physics.advance(bath.water, remaining, INFINITY);
+        }
+        if(bath.water.volume / bath.capacity <= 0.25) {
+            bath.isSaltPumpOn = false;
+        }
+    }
+}
+
+template<typename F>
+double bathsPerMicrosecond(size_t bathCount, int passes, F pass) {
+    auto start = chrono::steady_clock::now();
+    for(int i = 0; i < passes; i++) {
+        pass();
+    }
+    double micros = chrono::duration<double, micro>(chrono::steady_clock::now() - start).count();
+    return bathCount * (double)passes / micros;
+}
+
+int main() {
+    mt19937 random(42);
+    uniform_real_distribution<double> debits(0, 0.45);
+    uniform_real_distribution<double> temperatures(30, 45);
+    uniform_real_distribution<double> volumes(0, 300);
+
+    for(size_t bathCount : { 1000, 10000, 100000, 1000000 }) {
+        vector<BathObject> objects;
+        FleetState fleet;
+        for(size_t i = 0; i < bathCount; i++) {
+            WaterFlow flow = { debits(random), temperatures(random), random() % 2 ? 0 : DRAIN_SPEED };
+            bool target = random() % 4 == 0;
+            double fillTarget = volumes(random);
+            objects.push_back({ .physics = BathPhysics(), .water = { 0, PHYSICS_ROOM_TEMPERATURE }, .capacity = 300,
+                .isFillTargetSet = target, .fillTarget = fillTarget, .isSaltPumpOn = true, .targetReached = false });
+            objects.back().physics.setFlow(flow);
+            addFleetBath(fleet, 300);
+            setFleetFlow(fleet, i, flow);
+            if(target) {
+                fleet.fillTarget[i] = fillTarget;
+            }
+        }
+        FleetState scalarFleet = fleet;
+        FleetTickResult result, scalarResult;
+
+        // The implementations must agree before they are compared
+        for(int i = 0; i < 100; i++) {
+            advanceObjects(objects);
+            advanceFleet(fleet, result);
+            advanceFleetScalar(scalarFleet, scalarResult);
+            if(fleet.volume != scalarFleet.volume || fleet.temperature != scalarFleet.temperature
+                || result.shutOff != scalarResult.shutOff || result.saltLow != scalarResult.saltLow) {
+                cerr << "Vectorized and scalar passes differ\n";
+                return 1;
+            }
+        }
+        for(size_t i = 0; i < bathCount; i++) {
+            if(fabs(objects[i].water.volume - fleet.volume[i]) > 1e-6
+                || fabs(objects[i].water.temperature - fleet.temperature[i]) > 1e-6) {
+                cerr << "Object and fleet passes differ for bath " << i << "\n";
+                return 1;
+            }
+        }
+
+        int passes = max(10000000 / (int)bathCount, 1);
+        double objectRate = bathsPerMicrosecond(bathCount, passes, [&] { advanceObjects(objects); });
+        double scalarRate = bathsPerMicrosecond(bathCount, passes, [&] { advanceFleetScalar(scalarFleet, scalarResult); });
+        double fleetRate = bathsPerMicrosecond(bathCount, passes, [&] { advanceFleet(fleet, result); });
+        cout << bathCount << " baths: "
+             << objectRate << " baths/us per object, "
+             << scalarRate << " baths/us scalar arrays, "
+             << fleetRate << " baths/us " << (__builtin_cpu_supports("avx2") ? "AVX2" : "scalar") << " arrays\n";
+    }
+    return 0;
+}
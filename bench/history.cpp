@@ -0,0 +1,100 @@
+// Measures the cost of adding a sample to the rollups of a metric and of answering history queries,
+// against keeping the raw samples and scanning them. Samples arrive at 1 Hz for 7 days.
+// The answers of the rollups are checked against the scan.
+// Usage: history
+#include <chrono>
+#include <cmath>
+#include <iostream>
+#include <vector>
+#include "../src/History.cpp"
+using namespace std;
+
+typedef chrono::steady_clock Clock;
+
+struct Sample {
+    int64_t time;
+    double value;
+};
+
+// Same points as MetricHistory::query, from the raw samples
+void scan(const vector<Sample>& samples, int64_t from, int64_t to, int64_t step, vector<HistoryPoint>& points) {
+    points.clear();
+    for(auto& sample : samples) {
+        if(sample.time < from || sample.time >= to) {
+            continue;
+        }
+        int64_t pointTime = sample.time - sample.time % step;
+        if(points.empty() || points.back().time != pointTime) {
+            points.push_back({ .time = pointTime, .min = sample.value, .max = sample.value, .avg = 0, .count = 0 });
+        }
+        HistoryPoint& point = points.back();
+        point.min = min(point.min, sample.value);
+        point.max = max(point.max, sample.value);
+        point.avg += sample.value;
+        point.count++;
+    }
+    for(auto& point : points) {
+        point.avg /= point.count;
+    }
+}
+
+int main() {
+    // A multiple of all the steps, so that both sides read the same samples
+    const int64_t start = 1699999200;
+    const int64_t duration = 7 * 24 * 3600;
+    MetricHistory history;
+    vector<Sample> samples;
+    samples.reserve(duration);
+    for(int64_t t = 0; t < duration; t++) {
+        samples.push_back({ start + t, 150 + 100 * sin(t / 5000.0) + (t % 7) * 0.1 });
+    }
+
+    auto begin = Clock::now();
+    for(auto& sample : samples) {
+        history.add(sample.time, sample.value);
+    }
+    double addTime = chrono::duration<double, nano>(Clock::now() - begin).count() / samples.size();
+    cout << "add " << addTime << " ns/sample, " << history.memoryUsage() / 1024.0 << " KiB per metric (raw samples: "
+         << samples.size() * sizeof(Sample) / 1024.0 << " KiB)\n";
+
+    struct Query {
+        const char* name;
+        int64_t from, to, step;
+    };
+    int64_t end = start + duration;
+    Query queries[] = {
+        { "last 5 min, 1 s ", end - 300, end, 1 },
+        { "last hour, 1 min", end - 3600, end, 60 },
+        { "last day, 5 min ", end - 86400, end, 300 },
+        { "last week, 1 h  ", start + 3600, end, 3600 },
+    };
+    int failures = 0;
+    for(auto& query : queries) {
+        HistoryQuery result;
+        const int iterations = 1000;
+        begin = Clock::now();
+        for(int i = 0; i < iterations; i++) {
+            history.query(query.from, query.to, query.step, result);
+        }
+        double rollupTime = chrono::duration<double, micro>(Clock::now() - begin).count() / iterations;
+        vector<HistoryPoint> expected;
+        begin = Clock::now();
+        for(int i = 0; i < 10; i++) {
+            scan(samples, query.from, query.to, query.step, expected);
+        }
+        double scanTime = chrono::duration<double, micro>(Clock::now() - begin).count() / 10;
+
+        // The min/max of the rollups are floats
+        bool same = result.points.size() == expected.size();
+        for(size_t i = 0; same && i < expected.size(); i++) {
+            same = result.points[i].time == expected[i].time && result.points[i].count == expected[i].count
+                && fabs(result.points[i].avg - expected[i].avg) < 1e-9
+                && fabs(result.points[i].min - expected[i].min) < 1e-4
+                && fabs(result.points[i].max - expected[i].max) < 1e-4;
+        }
+        failures += !same;
+        cout << query.name << " " << result.points.size() << " points from the " << result.resolution << " s rollup: "
+             << rollupTime << " us, raw scan " << scanTime << " us" << (same ? "" : " MISMATCH") << "\n";
+    }
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,198 @@
+// Microbenchmarks of the hot paths of the parsers, the JSON helpers, a bath and the HTTP server, on Google Benchmark.
+// Write the results with --benchmark_out and diff them between releases with its tools/compare.py.
+// The baths talk through the loopback broker and write their journals in a temporary directory.
+// The HTTP server listens on 127.0.0.1:BENCH_HTTP_PORT.
+// Usage: hot_paths [--benchmark_filter=<regex>] [--benchmark_repetitions=<n>] [--benchmark_out=<path>]
+#include <filesystem>
+#include <iostream>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <benchmark/benchmark.h>
+#include "../src/BathEndpoint.cpp"
+using namespace std;
+
+#ifndef BENCH_HTTP_PORT
+#define BENCH_HTTP_PORT 9181
+#endif
+// Profiles looked up by the getProfile benchmark
+#define LOOKUP_PROFILES 1000
+
+// Connects to the bench server, retrying while it starts. Returns -1 on failure.
+int connectHttp() {
+    for(int attempt = 0; attempt < 100; attempt++) {
+        int fd = socket(AF_INET, SOCK_STREAM, 0);
+        sockaddr_in address = {};
+        address.sin_family = AF_INET;
+        address.sin_port = htons(BENCH_HTTP_PORT);
+        address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        if(::connect(fd, (sockaddr*)&address, sizeof(address)) == 0) {
+            int noDelay = 1;
+            setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &noDelay, sizeof(noDelay));
+            return fd;
+        }
+        close(fd);
+        this_thread::sleep_for(chrono::milliseconds(10));
+    }
+    return -1;
+}
+
+// Sends the request on the keep-alive connection and reads the whole response, using its Content-Length
+bool roundTrip(int fd, const string& request, string& response) {
+    if(send(fd, request.data(), request.size(), 0) != (ssize_t)request.size()) {
+        return false;
+    }
+    response.clear();
+    size_t headerEnd = string::npos, length = 0;
+    char buffer[4096];
+    while(headerEnd == string::npos || response.size() < headerEnd + 4 + length) {
+        ssize_t received = recv(fd, buffer, sizeof(buffer), 0);
+        if(received <= 0) {
+            return false;
+        }
+        response.append(buffer, received);
+        if(headerEnd == string::npos && (headerEnd = response.find("\r\n\r\n")) != string::npos) {
+            size_t field = response.find("Content-Length:");
+            length = field < headerEnd ? stoul(response.substr(field + 15)) : 0;
+        }
+    }
+    return true;
+}
+
+void addParserBenchmarks() {
+    static string delimiter = ",";
+    static const string payload = "7.2,310,0.18,140,22";
+    benchmark::RegisterBenchmark("util/splitString", [](benchmark::State& state) {
+        for(auto _ : state) {
+            benchmark::DoNotOptimize(splitString(payload, delimiter));
+        }
+    });
+    benchmark::RegisterBenchmark("util/convertStringVector", [](benchmark::State& state) {
+        vector<string> tokens = splitString(payload, delimiter);
+        for(auto _ : state) {
+            benchmark::DoNotOptimize(convertStringVector(tokens));
+        }
+    });
+    benchmark::RegisterBenchmark("util/parseWaterQuality", [](benchmark::State& state) {
+        WaterQuality waterQuality;
+        for(auto _ : state) {
+            benchmark::DoNotOptimize(parseWaterQuality(payload, waterQuality));
+        }
+    });
+}
+
+void addJsonBenchmarks() {
+    benchmark::RegisterBenchmark("json/pipeStateToJson", [](benchmark::State& state) {
+        PipeState pipe = { .isOn = true, .temperature = 38.5, .debit = 0.2 };
+        string buffer;
+        for(auto _ : state) {
+            JsonWriter json(buffer);
+            pipeStateToJson(json, pipe);
+            benchmark::DoNotOptimize(buffer.data());
+        }
+    });
+    benchmark::RegisterBenchmark("json/profileToJson", [](benchmark::State& state) {
+        UserProfile profile = { .weight = 72.5, .preferredBathTemperature = 38, .preferredShowerTemperature = 36.5 };
+        string buffer;
+        for(auto _ : state) {
+            JsonWriter json(buffer);
+            profileToJson(json, profile);
+            benchmark::DoNotOptimize(buffer.data());
+        }
+    });
+}
+
+// The bath is owned by the registry, which must outlive the benchmarks
+void addBathBenchmarks(SmartBath* bath) {
+    benchmark::RegisterBenchmark("bath/handleWaterQuality", [bath](benchmark::State& state) {
+        for(auto _ : state) {
+            benchmark::DoNotOptimize(bath->handleWaterQuality("7.2,310,0.18,140,22"));
+        }
+    });
+    benchmark::RegisterBenchmark("bath/intervalCheck", [bath](benchmark::State& state) {
+        for(auto _ : state) {
+            bath->intervalCheck();
+        }
+    });
+    // Each profile is written to the journal, the call returns once it is durable
+    benchmark::RegisterBenchmark("bath/addProfile", [bath](benchmark::State& state) {
+        static uint64_t added = 0;
+        UserProfile profile = { .weight = 72.5, .preferredBathTemperature = 38, .preferredShowerTemperature = 36.5 };
+        for(auto _ : state) {
+            bath->addProfile("user" + to_string(added++), profile);
+        }
+    });
+    static vector<string> names;
+    UserProfile profile = { .weight = 72.5, .preferredBathTemperature = 38, .preferredShowerTemperature = 36.5 };
+    for(int i = 0; i < LOOKUP_PROFILES; i++) {
+        names.push_back("lookup" + to_string(i));
+        bath->addProfile(names.back(), profile);
+    }
+    benchmark::RegisterBenchmark("bath/getProfile", [bath](benchmark::State& state) {
+        uint64_t i = 0;
+        for(auto _ : state) {
+            benchmark::DoNotOptimize(bath->getProfile(names[i++ % LOOKUP_PROFILES]));
+        }
+    });
+}
+
+// Round trips through the parser, the router and a handler of BathEndpoint, on one keep-alive connection
+void addHttpBenchmarks(int fd) {
+    for(const char* path : { "/volume", "/bath/state", "/profiles/get/nobody" }) {
+        string request = string("GET ") + path + " HTTP/1.1\r\nHost: 127.0.0.1\r\n\r\n";
+        benchmark::RegisterBenchmark((string("http/GET ") + path).c_str(), [fd, request](benchmark::State& state) {
+            string response;
+            for(auto _ : state) {
+                if(!roundTrip(fd, request, response)) {
+                    state.SkipWithError("HTTP_ROUND_TRIP_FAILED");
+                    break;
+                }
+            }
+        });
+    }
+}
+
+int main(int argc, char** argv) {
+    benchmark::Initialize(&argc, argv);
+    if(benchmark::ReportUnrecognizedArguments(argc, argv)) {
+        return 1;
+    }
+    // The registry prints every message it receives
+    cout.setstate(ios::failbit);
+    char directory[] = "/tmp/hot_paths-XXXXXX";
+    if(!mkdtemp(directory) || chdir(directory) != 0) {
+        perror("temporary directory");
+        return 1;
+    }
+
+    {
+        // The bath has a broker of its own, so that the server registry does not receive its messages
+        LoopbackBroker broker;
+        BathRegistry registry(make_unique<LoopbackTransport>(broker, "hot-paths"),
+            make_unique<LoopbackTransport>(broker, "hot-paths-publisher"));
+        BathEndpoint endpoint(Address(Ipv4::loopback(), Port(BENCH_HTTP_PORT)),
+            makeTransport(LOOPBACK_ADDRESS, "hot-paths-http", false),
+            makeTransport(LOOPBACK_ADDRESS, "hot-paths-http-publisher", false));
+        endpoint.init(1);
+        endpoint.start();
+        int fd = connectHttp();
+        if(fd < 0) {
+            perror("connect");
+            return 1;
+        }
+
+        addParserBenchmarks();
+        addJsonBenchmarks();
+        addBathBenchmarks(registry.addBath("bench").get());
+        addHttpBenchmarks(fd);
+        benchmark::RunSpecifiedBenchmarks();
+        benchmark::Shutdown();
+
+        close(fd);
+        endpoint.stop();
+    }
+    filesystem::remove_all(directory);
+    return 0;
+}
@@ -0,0 +1,131 @@
+// Counts the heap allocations and measures the time needed to build the HTTP responses and the display
+// messages, with the previous string concatenation and with the JsonWriter.
+// Usage: json_responses
+#include <chrono>
+#include <iostream>
+#include <new>
+#include "../src/BathRegistry.hpp"
+#include "../src/util.cpp"
+using namespace std;
+
+static size_t allocations = 0;
+
+void* operator new(size_t size) {
+    allocations++;
+    void* ptr = malloc(size);
+    if(!ptr) {
+        throw bad_alloc();
+    }
+    return ptr;
+}
+
+void operator delete(void* ptr) noexcept {
+    free(ptr);
+}
+
+void operator delete(void* ptr, size_t) noexcept {
+    free(ptr);
+}
+
+// Previous helpers of util.cpp and server.cpp
+
+string referencePipeState(PipeState state) {
+    string stateResponse = "{\"isOn\": " + to_string(state.isOn);
+    if(state.isOn) {
+        stateResponse += ", \"temperature\": " + to_string(state.temperature);
+        stateResponse += ", \"debit\": " + to_string(state.debit);
+    }
+    stateResponse += "} ";
+    return stateResponse;
+}
+
+string referenceProfile(UserProfile profile) {
+    string stateResponse = "{\"weight\": " + to_string(profile.weight);
+    stateResponse += ", \"preferredBathTemperature\": " + to_string(profile.preferredBathTemperature);
+    stateResponse += ", \"preferredShowerTemperature\": " + to_string(profile.preferredShowerTemperature);
+    stateResponse += "} ";
+    return stateResponse;
+}
+
+string referenceError(const runtime_error& err) {
+    auto errWhat = string(err.what());
+    return "{\"error\": \"" + errWhat + "\"}";
+}
+
+string referenceDisplay(PipeState state) {
+    string msg = "pipe/bath/";
+    msg += "on/" + to_string(state.debit) + "/" + to_string(state.temperature);
+    return msg;
+}
+
+string& responseBuffer() {
+    static thread_local string buffer;
+    return buffer;
+}
+
+struct Result {
+    double nanos;
+    double allocations;
+    size_t bytes;
+};
+
+// The response is built once before measuring, so that the reusable buffers are warm as in a running server
+template<typename F>
+Result measure(int rounds, F build) {
+    Result result;
+    result.bytes = build();
+    size_t before = allocations;
+    auto start = chrono::steady_clock::now();
+    for(int i = 0; i < rounds; i++) {
+        build();
+    }
+    result.nanos = chrono::duration<double, nano>(chrono::steady_clock::now() - start).count() / rounds;
+    result.allocations = (double)(allocations - before) / rounds;
+    return result;
+}
+
+void print(const string& name, const Result& before, const Result& after) {
+    cout << name << ": to_string " << before.allocations << " allocations, " << before.nanos << " ns, " << before.bytes << " bytes"
+         << " | JsonWriter " << after.allocations << " allocations, " << after.nanos << " ns, " << after.bytes << " bytes\n";
+}
+
+int main() {
+    const int rounds = 200000;
+    PipeState state = { .isOn = true, .temperature = 37.5, .debit = 0.2 };
+    UserProfile profile = { .weight = 72.4, .preferredBathTemperature = 38, .preferredShowerTemperature = 36.5 };
+    runtime_error error("MAXIMUM_DEBIT_EXCEEDED");
+
+    print("pipe state", measure(rounds, [&] { return referencePipeState(state).size(); }),
+        measure(rounds, [&] {
+            JsonWriter json(responseBuffer());
+            pipeStateToJson(json, state);
+            return json.size();
+        }));
+    print("profile   ", measure(rounds, [&] { return referenceProfile(profile).size(); }),
+        measure(rounds, [&] {
+            JsonWriter json(responseBuffer());
+            profileToJson(json, profile);
+            return json.size();
+        }));
+    print("error     ", measure(rounds, [&] { return referenceError(error).size(); }),
+        measure(rounds, [&] {
+            JsonWriter json(responseBuffer());
+            json.beginObject().field("error", error.what()).endObject();
+            return json.size();
+        }));
+    // The message is then copied once into the publisher queue, in both cases
+    print("display   ", measure(rounds, [&] { return referenceDisplay(state).size(); }),
+        measure(rounds, [&] {
+            string& msg = threadBuffer();
+            msg += "pipe/bath/on/";
+            appendNumber(msg, state.debit);
+            msg += '/';
+            appendNumber(msg, state.temperature);
+            return msg.size();
+        }));
+
+    JsonWriter json(responseBuffer());
+    pipeStateToJson(json, state);
+    cout << "\n" << referencePipeState(state) << "\n" << string(json.data(), json.size()) << "\n";
+    return 0;
+}
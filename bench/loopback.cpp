@@ -0,0 +1,119 @@
+// Measures the MQTT paths of the baths through the in-process broker, without network or broker noise.
+// Ingest: sensor threads publish to a consumer that dispatches the messages like listenForDevices.
+// Publish: messages queued on a MqttPublisher, received by a display subscriber.
+// Usage: loopback [messages] [sensors]
+#include <chrono>
+#include <iostream>
+#include <thread>
+#include <vector>
+#include "../src/LoopbackBroker.cpp"
+#include "../src/MqttPublisher.cpp"
+#include "../src/TopicDispatcher.cpp"
+using namespace std;
+
+typedef chrono::steady_clock Clock;
+
+// Messages per second received by the consumer, from the first publish to the last dispatch
+double ingest(size_t messages, size_t sensors, int qos, uint64_t& dispatched) {
+    LoopbackBroker broker;
+    TopicDispatcher dispatcher;
+    atomic<uint64_t> handled { 0 };
+    for(const char* topic : { "+/temperature", "+/waterQuality", "+/salt", "+/display" }) {
+        dispatcher.addHandler(topic, qos, [&handled](string_view, string_view) {
+            handled.fetch_add(1, memory_order_relaxed);
+            return true;
+        });
+    }
+    LoopbackTransport receiver(broker, "receiver");
+    receiver.connect();
+    receiver.subscribe(dispatcher.getTopics(), dispatcher.getQos());
+    std::thread consumer([&] {
+        string topic, payload;
+        while(receiver.consume(topic, payload)) {
+            if(topic == "done") {
+                break;
+            }
+            dispatcher.dispatch(topic, payload);
+        }
+    });
+
+    auto begin = Clock::now();
+    vector<std::thread> threads;
+    for(size_t s = 0; s < sensors; s++) {
+        threads.emplace_back([&broker, s, messages, sensors, qos] {
+            LoopbackTransport sensor(broker, "sensor-" + to_string(s));
+            sensor.connect();
+            string device = "bath" + to_string(s);
+            string temperature = device + "/temperature", waterQuality = device + "/waterQuality";
+            for(size_t i = s; i < messages; i += sensors) {
+                if(i % 4 == 0) {
+                    sensor.publish(waterQuality, "7.2,310,0.18,140,22", qos);
+                } else {
+                    sensor.publish(temperature, "36.5", qos);
+                }
+            }
+            sensor.flush(chrono::seconds(10));
+        });
+    }
+    for(auto& thread : threads) {
+        thread.join();
+    }
+    LoopbackTransport control(broker, "control");
+    control.connect();
+    receiver.subscribe({ "done" }, { 1 });
+    control.publish("done", "", 1);
+    consumer.join();
+    double seconds = chrono::duration<double>(Clock::now() - begin).count();
+    dispatched = handled;
+    return dispatched / seconds;
+}
+
+int main(int argc, char** argv) {
+    size_t messages = argc > 1 ? stoul(argv[1]) : 1000000;
+    size_t sensors = argc > 2 ? stoul(argv[2]) : 4;
+    // The publisher prints every message it sends when built with MQTT_LOG_SENT
+    cout.setstate(ios::failbit);
+
+    for(int qos : { 0, 1 }) {
+        uint64_t dispatched;
+        double rate = ingest(messages, sensors, qos, dispatched);
+        cerr << "ingest, " << sensors << " sensors, QoS " << qos << ": " << rate / 1e6 << " M messages/s, "
+             << dispatched << "/" << messages << " dispatched\n";
+    }
+
+    // Publish: the baths queue display messages, the publisher thread sends them in batches
+    LoopbackBroker broker;
+    LoopbackTransport display(broker, "display");
+    display.connect();
+    display.subscribe({ "+/display" }, { 0 });
+    atomic<uint64_t> received { 0 };
+    std::thread subscriber([&] {
+        string topic, payload;
+        while(display.consume(topic, payload)) {
+            received++;
+        }
+    });
+    auto begin = Clock::now();
+    uint64_t dropped = 0;
+    {
+        MqttPublisher publisher(make_unique<LoopbackTransport>(broker, "publisher"));
+        for(size_t i = 0; i < messages; i++) {
+            while(!publisher.publish("bath" + to_string(i % 64) + "/display", "currentVolume/123.4")) {
+                dropped++;
+                this_thread::yield();
+            }
+        }
+        publisher.stop();
+    }
+    double seconds = chrono::duration<double>(Clock::now() - begin).count();
+    // Lets the subscriber drain its inbox
+    while(received < broker.getStats().delivered) {
+        this_thread::sleep_for(chrono::milliseconds(1));
+    }
+    display.disconnect();
+    subscriber.join();
+    auto stats = broker.getStats();
+    cerr << "publish: " << messages / seconds / 1e6 << " M messages/s, " << received << " received, "
+         << stats.dropped << " dropped by the broker, " << dropped << " retries on a full queue\n";
+    return 0;
+}
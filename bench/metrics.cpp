@@ -0,0 +1,80 @@
+// Cost of recording the metrics of GET /metrics: the clock, a counter, a histogram and a metered mutex,
+// against steady_clock, a shared atomic and std::mutex. The threaded runs record from 4 threads at once.
+// Usage: metrics [--benchmark_filter=<regex>] [--benchmark_repetitions=<n>] [--benchmark_out=<path>] (Google Benchmark)
+#include <mutex>
+#include <benchmark/benchmark.h>
+#include "../src/Metrics.cpp"
+using namespace std;
+
+#define THREADS 4
+
+int main(int argc, char** argv) {
+    static Counter counter;
+    static Histogram histogram;
+    static atomic<uint64_t> shared { 0 };
+    static MeteredMutex meteredMutex("bench");
+    static mutex plainMutex;
+
+    benchmark::RegisterBenchmark("clock/metricsNow", [](benchmark::State& state) {
+        for(auto _ : state) {
+            benchmark::DoNotOptimize(metricsNow());
+        }
+    });
+    benchmark::RegisterBenchmark("clock/steady_clock", [](benchmark::State& state) {
+        for(auto _ : state) {
+            benchmark::DoNotOptimize(chrono::steady_clock::now());
+        }
+    });
+    benchmark::RegisterBenchmark("counter/add", [](benchmark::State& state) {
+        for(auto _ : state) {
+            counter.add();
+        }
+    });
+    benchmark::RegisterBenchmark("histogram/record", [](benchmark::State& state) {
+        uint64_t i = 0;
+        for(auto _ : state) {
+            histogram.record(i++);
+        }
+    });
+    benchmark::RegisterBenchmark("histogram/timer", [](benchmark::State& state) {
+        for(auto _ : state) {
+            ScopedTimer timer(histogram);
+        }
+    });
+    benchmark::RegisterBenchmark("mutex/std::mutex", [](benchmark::State& state) {
+        for(auto _ : state) {
+            plainMutex.lock();
+            plainMutex.unlock();
+        }
+    });
+    benchmark::RegisterBenchmark("mutex/MeteredMutex", [](benchmark::State& state) {
+        for(auto _ : state) {
+            meteredMutex.lock();
+            meteredMutex.unlock();
+        }
+    });
+    benchmark::RegisterBenchmark("threads/shared atomic", [](benchmark::State& state) {
+        for(auto _ : state) {
+            shared.fetch_add(1, memory_order_relaxed);
+        }
+    })->Threads(THREADS);
+    benchmark::RegisterBenchmark("threads/counter/add", [](benchmark::State& state) {
+        for(auto _ : state) {
+            counter.add();
+        }
+    })->Threads(THREADS);
+    benchmark::RegisterBenchmark("threads/histogram/record", [](benchmark::State& state) {
+        uint64_t i = 0;
+        for(auto _ : state) {
+            histogram.record(i++);
+        }
+    })->Threads(THREADS);
+
+    benchmark::Initialize(&argc, argv);
+    if(benchmark::ReportUnrecognizedArguments(argc, argv)) {
+        return 1;
+    }
+    benchmark::RunSpecifiedBenchmarks();
+    benchmark::Shutdown();
+    return 0;
+}
@@ -0,0 +1,61 @@
+// Measures the CPU cost of the physics per simulated bath-second at each step length, one bath at a time
+// (BathPhysics::advance, as the interval check does). make fleet_tick_bench measures the fleet pass.
+// Also reports how much the volume goes past the capacity when the pipes are turned off after the step that crossed it.
+// Usage: physics [baths] [seconds]
+#include <chrono>
+#include <cmath>
+#include <iostream>
+#include <random>
+#include <vector>
+#include "../src/BathPhysics.cpp"
+using namespace std;
+
+typedef chrono::steady_clock Clock;
+
+int main(int argc, char** argv) {
+    size_t bathCount = argc > 1 ? stoul(argv[1]) : 10000;
+    int seconds = argc > 2 ? stoi(argv[2]) : 60;
+    mt19937_64 random(42);
+    uniform_real_distribution<double> debit(0, 0.45), temperature(20, 45), volume(0, 250);
+    vector<WaterFlow> flows(bathCount);
+    vector<WaterState> initial(bathCount);
+    for(size_t i = 0; i < bathCount; i++) {
+        flows[i] = { debit(random), temperature(random), random() % 4 == 0 ? 0.2 : 0 };
+        initial[i] = { volume(random), temperature(random) };
+    }
+
+    for(int64_t stepMs : { 1000, 100, 50, 20, 10 }) {
+        // One bath at a time, the limit never reached
+        vector<WaterState> states = initial;
+        vector<BathPhysics> physics(bathCount, BathPhysics(stepMs));
+        for(size_t i = 0; i < bathCount; i++) {
+            physics[i].setFlow(flows[i]);
+        }
+        auto begin = Clock::now();
+        for(int s = 0; s < seconds; s++) {
+            for(size_t i = 0; i < bathCount; i++) {
+                double second = 1;
+                physics[i].advance(states[i], second, INFINITY);
+            }
+        }
+        double scalarTime = chrono::duration<double, nano>(Clock::now() - begin).count() / (bathCount * seconds);
+
+        // Filling a 300 L tub at 0.45 L/s from a random volume, the pipes turned off after the crossing step
+        double maxOvershoot = 0, totalOvershoot = 0;
+        BathPhysics filling(stepMs);
+        filling.setFlow({ 0.45, 38, 0 });
+        for(int n = 0; n < 1000; n++) {
+            WaterState state = { volume(random), 38 };
+            double second = 1;
+            while(!filling.advance(state, second, 300)) {
+                second = 1;
+            }
+            maxOvershoot = max(maxOvershoot, state.volume - 300);
+            totalOvershoot += state.volume - 300;
+        }
+
+        cout << "step " << stepMs << " ms: " << scalarTime << " ns/bath-second; fill overshoot avg "
+             << totalOvershoot / 1000 * 1000 << " mL, max " << maxOvershoot * 1000 << " mL\n";
+    }
+    return 0;
+}
@@ -0,0 +1,161 @@
+// Measures the commit latency and the write amplification of the profile journal, with 1 to N clients
+// editing profiles concurrently, against rewriting the whole profiles file on each change.
+// The files are written in the given directory, which should be on the disk the server uses (not a tmpfs).
+// Usage: profile_journal [directory] [profiles] [changes]
+#include <algorithm>
+#include <chrono>
+#include <fcntl.h>
+#include <iomanip>
+#include <iostream>
+#include <numeric>
+#include <thread>
+#include <unistd.h>
+#include <unordered_map>
+#include <vector>
+#include "../src/Journal.cpp"
+#include "../src/JsonWriter.cpp"
+using namespace std;
+
+typedef chrono::steady_clock Clock;
+
+string profileRecord(size_t user, double weight) {
+    string record = "put,user" + to_string(user) + ",";
+    appendNumber(record, weight);
+    record += ",38,36";
+    return record;
+}
+
+string renderSnapshot(const unordered_map<size_t, double>& profiles) {
+    string snapshot;
+    for(auto& profile : profiles) {
+        snapshot += profileRecord(profile.first, profile.second).substr(4);
+        snapshot += '\n';
+    }
+    return snapshot;
+}
+
+// Snapshots are written as CSV, the bath writes a profile store instead
+void compact(Journal& journal, const unordered_map<size_t, double>& profiles) {
+    auto snapshot = make_shared<string>(renderSnapshot(profiles));
+    journal.compact([snapshot](int fd) { return writeAll(fd, snapshot->data(), snapshot->size()); }, nullptr);
+}
+
+double percentile(vector<double>& values, double p) {
+    sort(values.begin(), values.end());
+    return values[min(values.size() - 1, (size_t)(p * values.size()))];
+}
+
+// The previous approach made crash-safe: every change writes the whole file to a temporary file, syncs it and renames it
+void benchRewrite(const string& directory, size_t profileCount, size_t changes) {
+    unordered_map<size_t, double> profiles;
+    for(size_t i = 0; i < profileCount; i++) {
+        profiles[i] = 70;
+    }
+    string path = directory + "/rewrite.csv";
+    string temporaryPath = path + ".tmp";
+    vector<double> latencies;
+    uint64_t bytes = 0, recordBytes = 0;
+    for(size_t i = 0; i < changes; i++) {
+        auto start = Clock::now();
+        profiles[i % profileCount] = 60 + i % 40;
+        recordBytes += profileRecord(i % profileCount, 60 + i % 40).size();
+        string content = renderSnapshot(profiles);
+        int fd = ::open(temporaryPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        writeAll(fd, content.data(), content.size());
+        ::fsync(fd);
+        ::close(fd);
+        ::rename(temporaryPath.c_str(), path.c_str());
+        syncDirectory(path);
+        bytes += content.size();
+        latencies.push_back(chrono::duration<double, micro>(Clock::now() - start).count());
+    }
+    ::unlink(path.c_str());
+    cout << "rewrite      1 client   p50 " << percentile(latencies, .5) << " us, p99 " << percentile(latencies, .99)
+         << " us, " << changes * 1e6 / accumulate(latencies.begin(), latencies.end(), 0.0) << " changes/s, "
+         << "write amplification " << (double)bytes / recordBytes << "\n";
+}
+
+void benchJournal(const string& directory, size_t profileCount, size_t clients, size_t changesPerClient) {
+    string snapshotPath = directory + "/journal.csv";
+    string logPath = directory + "/journal.log";
+    ::unlink(snapshotPath.c_str());
+    ::unlink(logPath.c_str());
+
+    vector<vector<double>> latencies(clients);
+    Clock::time_point start, end;
+    JournalStats stats;
+    {
+        JournalWriter writer;
+        Journal journal(&writer, snapshotPath, logPath, [](string_view) { });
+        // Stands for the profiles map and blockingMutex of the bath
+        unordered_map<size_t, double> profiles;
+        mutex profilesMutex;
+        for(size_t i = 0; i < profileCount; i++) {
+            profiles[i] = 70;
+        }
+        compact(journal, profiles);
+        journal.waitDurable(journal.append(profileRecord(0, 70)));
+
+        start = Clock::now();
+        vector<thread> threads;
+        for(size_t client = 0; client < clients; client++) {
+            threads.emplace_back([&, client]() {
+                for(size_t i = 0; i < changesPerClient; i++) {
+                    size_t user = (client * changesPerClient + i) % profileCount;
+                    double weight = 60 + i % 40;
+                    auto changeStart = Clock::now();
+                    uint64_t sequence;
+                    {
+                        lock_guard<mutex> lock(profilesMutex);
+                        profiles[user] = weight;
+                        sequence = journal.append(profileRecord(user, weight));
+                        if(journal.needsCompaction()) {
+                            compact(journal, profiles);
+                        }
+                    }
+                    journal.waitDurable(sequence);
+                    latencies[client].push_back(chrono::duration<double, micro>(Clock::now() - changeStart).count());
+                }
+            });
+        }
+        for(auto& thread : threads) {
+            thread.join();
+        }
+        end = Clock::now();
+        stats = writer.getStats();
+    }
+
+    // Replaying the log left by the run
+    auto replayStart = Clock::now();
+    size_t replayed = 0;
+    {
+        JournalWriter writer;
+        Journal journal(&writer, snapshotPath, logPath, [&](string_view) { replayed++; });
+    }
+    double replayTime = chrono::duration<double, milli>(Clock::now() - replayStart).count();
+
+    vector<double> all;
+    for(auto& clientLatencies : latencies) {
+        all.insert(all.end(), clientLatencies.begin(), clientLatencies.end());
+    }
+    double seconds = chrono::duration<double>(end - start).count();
+    cout << "journal " << setw(6) << clients << " clients  p50 " << percentile(all, .5) << " us, p99 " << percentile(all, .99)
+         << " us, " << all.size() / seconds << " changes/s, "
+         << "write amplification " << (double)(stats.logBytes + stats.snapshotBytes) / stats.recordBytes
+         << ", " << (double)stats.records / stats.syncs << " records/fdatasync, "
+         << stats.compactions << " compactions, replay of " << replayed << " records in " << replayTime << " ms\n";
+    ::unlink(snapshotPath.c_str());
+    ::unlink(logPath.c_str());
+}
+
+int main(int argc, char** argv) {
+    string directory = argc > 1 ? argv[1] : ".";
+    size_t profileCount = argc > 2 ? stoul(argv[2]) : 1000;
+    size_t changes = argc > 3 ? stoul(argv[3]) : 2000;
+    cout << profileCount << " profiles\n";
+    benchRewrite(directory, profileCount, min(changes, (size_t)500));
+    for(size_t clients : { 1, 4, 16, 64 }) {
+        benchJournal(directory, profileCount, clients, max((size_t)1, changes / clients));
+    }
+    return 0;
+}
@@ -0,0 +1,159 @@
+// Measures the startup time and the lookups of the profiles with the previous CSV loader
+// (getline, splitString and stod into an unordered_map) and with the memory-mapped profile store.
+// The store is evicted from the page cache before it is opened, to measure a cold start.
+// The files are written in the directory, 10k and 100k profiles by default. Pass larger counts explicitly,
+// 10000000 writes a CSV of several hundred MB and needs about 800 MiB of memory.
+// Usage: profile_store [directory] [profile counts...]
+#include <chrono>
+#include <fcntl.h>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <unistd.h>
+#include <unordered_map>
+#include <vector>
+#include "../src/Journal.cpp"
+#include "../src/JsonWriter.cpp"
+#include "../src/ProfileStore.cpp"
+using namespace std;
+
+typedef chrono::steady_clock Clock;
+
+double elapsedMs(Clock::time_point start) {
+    return chrono::duration<double, milli>(Clock::now() - start).count();
+}
+
+// Resident memory of the process, in MiB
+double residentMemory() {
+    ifstream statm("/proc/self/statm");
+    size_t pages, resident;
+    statm >> pages >> resident;
+    return resident * (double)sysconf(_SC_PAGESIZE) / (1 << 20);
+}
+
+// Same as splitString in util.cpp
+vector<string> splitString(string s, string& delimiter) {
+    vector<string> result;
+    size_t pos = 0;
+    std::string token;
+    while ((pos = s.find(delimiter)) != string::npos) {
+        token = s.substr(0, pos);
+        result.push_back(token);
+        s.erase(0, pos + delimiter.length());
+    }
+    result.push_back(s);
+    return result;
+}
+
+// The previous SmartBath::loadProfiles
+void loadCsv(const string& path, unordered_map<string, UserProfile>& profiles) {
+    ifstream profileFile(path);
+    string line;
+    string delimiter = ",";
+    while(getline(profileFile, line)) {
+        auto splitted = splitString(line, delimiter);
+        if(splitted.size() != 4) continue;
+        UserProfile profile = {
+            .weight = stod(splitted[1]),
+            .preferredBathTemperature = stod(splitted[2]),
+            .preferredShowerTemperature = stod(splitted[3])
+        };
+        profiles.insert({ splitted[0], profile });
+    }
+}
+
+void evict(const string& path) {
+    int fd = ::open(path.c_str(), O_RDONLY);
+    ::fdatasync(fd);
+    ::posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+    ::close(fd);
+}
+
+void bench(const string& directory, size_t count) {
+    string csvPath = directory + "/bench-profiles.csv";
+    string storePath = directory + "/bench-profiles.bin";
+    {
+        ofstream csv(csvPath);
+        string line;
+        for(size_t i = 0; i < count; i++) {
+            line.clear();
+            // Written in hash order by the previous dumpProfiles, so not sorted
+            appendProfileRecord(line, "user" + to_string((i * 2654435761u) % (count * 4)), { 20 + (double)(i % 100), 38, 36 });
+            csv << line << '\n';
+        }
+    }
+    mt19937_64 random(42);
+    vector<string> lookups;
+    for(int i = 0; i < 1000; i++) {
+        size_t user = random() % count;
+        lookups.push_back("user" + to_string((user * 2654435761u) % (count * 4)));
+    }
+
+    double memoryBefore = residentMemory();
+    evict(csvPath);
+    auto start = Clock::now();
+    double csvMemory;
+    {
+        unordered_map<string, UserProfile> profiles;
+        loadCsv(csvPath, profiles);
+        double loadTime = elapsedMs(start);
+        csvMemory = residentMemory() - memoryBefore;
+        size_t found = 0;
+        start = Clock::now();
+        for(auto& name : lookups) {
+            found += profiles.count(name);
+        }
+        double lookupTime = elapsedMs(start) * 1e6 / lookups.size();
+        cout << count << " profiles\n";
+        cout << "  csv    startup " << loadTime << " ms, +" << csvMemory << " MiB resident, lookup " << lookupTime
+             << " ns (" << found << " found)\n";
+    }
+
+    start = Clock::now();
+    long long converted = -1;
+    replaceFile(storePath, [&](int fd) { converted = ProfileStore::convertCsv(csvPath, fd); return converted >= 0; });
+    cout << "  convert " << converted << " profiles in " << elapsedMs(start) << " ms\n";
+
+    evict(storePath);
+    memoryBefore = residentMemory();
+    start = Clock::now();
+    ProfileStore store;
+    bool opened = store.open(storePath);
+    double openTime = elapsedMs(start);
+    UserProfile profile;
+    size_t found = 0;
+    start = Clock::now();
+    found += store.find(lookups[0], profile);
+    double firstLookup = elapsedMs(start);
+    start = Clock::now();
+    for(size_t i = 1; i < lookups.size(); i++) {
+        found += store.find(lookups[i], profile);
+    }
+    double coldLookup = elapsedMs(start) * 1e6 / (lookups.size() - 1);
+    start = Clock::now();
+    for(auto& name : lookups) {
+        found += store.find(name, profile);
+    }
+    double warmLookup = elapsedMs(start) * 1e6 / lookups.size();
+    cout << "  store  startup " << openTime << " ms" << (opened ? "" : " (FAILED)") << ", first lookup " << firstLookup
+         << " ms, +" << residentMemory() - memoryBefore << " MiB resident after 2000 lookups, lookup " << coldLookup
+         << " ns cold, " << warmLookup << " ns warm (" << found << " found)\n";
+    store.close();
+    ::unlink(csvPath.c_str());
+    ::unlink(storePath.c_str());
+}
+
+int main(int argc, char** argv) {
+    string directory = argc > 1 ? argv[1] : ".";
+    vector<size_t> counts;
+    for(int i = 2; i < argc; i++) {
+        counts.push_back(stoul(argv[i]));
+    }
+    if(counts.empty()) {
+        counts = { 10000, 100000 };
+    }
+    for(size_t count : counts) {
+        bench(directory, count);
+    }
+    return 0;
+}
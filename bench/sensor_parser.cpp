@@ -0,0 +1,215 @@
+// Checks that the string_view/from_chars sensor parsers accept and decode the same payloads as the
+// previous splitString/stod path, on the corpus and on random mutations of it, then compares their speed.
+// Usage: sensor_parser [corpus directory]
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <new>
+#include <random>
+#include "../src/BathRegistry.hpp"
+#include "../src/util.cpp"
+using namespace std;
+
+// Counts the heap allocations, to check that the new parsers don't allocate
+static size_t allocations = 0;
+
+void* operator new(size_t size) {
+    allocations++;
+    void* ptr = malloc(size);
+    if(!ptr) {
+        throw bad_alloc();
+    }
+    return ptr;
+}
+
+void operator delete(void* ptr) noexcept {
+    free(ptr);
+}
+
+void operator delete(void* ptr, size_t) noexcept {
+    free(ptr);
+}
+
+// Previous waterQuality path of listenForDevices. Payloads with less than 5 tokens were
+// undefined behavior (out of bounds vector access), they are rejected here.
+bool referenceWaterQuality(const string& payload, WaterQuality& waterQuality) {
+    try {
+        string qualityString = payload;
+        string delimiter(",");
+        auto splitted = splitString(qualityString, delimiter);
+        auto result = convertStringVector(splitted);
+        if(result.size() < 5) {
+            return false;
+        }
+        waterQuality = { .pH = result[0], .chlorides = result[1], .iron = result[2],
+                         .calcium = result[3], .color = result[4] };
+        return true;
+    } catch(...) {
+        return false;
+    }
+}
+
+// Previous display path of listenForDevices. Missing tokens were undefined behavior and an
+// unknown on/off token called std::terminate (throw without exception), they are rejected here.
+bool referencePipeCommand(const string& payload, PipeCommand& command) {
+    try {
+        string qualityString = payload;
+        string delimiter("/");
+        auto splitted = splitString(qualityString, delimiter);
+        if(splitted[0] != string("setPipe") || splitted.size() < 3) {
+            return false;
+        }
+        command.pipe = splitted[1] == "bath" ? Pipe::Bath : splitted[1] == "shower" ? Pipe::Shower : Pipe::Unknown;
+        command.hasTemperature = false;
+        if(splitted[2] == string("on")) {
+            if(splitted.size() < 4) {
+                return false;
+            }
+            double debit = stod(splitted[3]);
+            double temperature = 0;
+            if(splitted.size() > 4) {
+                temperature = stod(splitted[4]);
+                command.hasTemperature = true;
+            }
+            command.state = { .isOn = true, .temperature = temperature, .debit = debit };
+        } else if(splitted[2] == string("off")) {
+            command.state = { .isOn = false, .temperature = 0, .debit = 0 };
+        } else {
+            return false;
+        }
+        return true;
+    } catch(...) {
+        return false;
+    }
+}
+
+bool sameDouble(double a, double b) {
+    return (isnan(a) && isnan(b)) || memcmp(&a, &b, sizeof(double)) == 0;
+}
+
+bool sameWaterQuality(const WaterQuality& a, const WaterQuality& b) {
+    return sameDouble(a.pH, b.pH) && sameDouble(a.chlorides, b.chlorides) && sameDouble(a.iron, b.iron)
+        && sameDouble(a.calcium, b.calcium) && sameDouble(a.color, b.color);
+}
+
+bool samePipeCommand(const PipeCommand& a, const PipeCommand& b) {
+    return a.pipe == b.pipe && a.hasTemperature == b.hasTemperature && a.state.isOn == b.state.isOn
+        && sameDouble(a.state.debit, b.state.debit) && sameDouble(a.state.temperature, b.state.temperature);
+}
+
+vector<string> readCorpus(const string& path) {
+    ifstream file(path);
+    vector<string> lines;
+    string line;
+    while(getline(file, line)) {
+        lines.push_back(line);
+    }
+    return lines;
+}
+
+// Replaces, inserts or removes a few random characters
+string mutate(string payload, mt19937& random) {
+    static const char alphabet[] = "0123456789.,/-+eExXpPinfaIN onfsetPipbthwr";
+    int mutations = 1 + random() % 3;
+    for(int i = 0; i < mutations; i++) {
+        size_t pos = payload.empty() ? 0 : random() % (payload.size() + 1);
+        char c = alphabet[random() % (sizeof(alphabet) - 1)];
+        switch(random() % 3) {
+            case 0:
+                if(pos < payload.size()) {
+                    payload[pos] = c;
+                }
+                break;
+            case 1:
+                payload.insert(payload.begin() + pos, c);
+                break;
+            case 2:
+                if(pos < payload.size()) {
+                    payload.erase(pos, 1);
+                }
+                break;
+        }
+    }
+    return payload;
+}
+
+template<typename F>
+double nanosecondsPerCall(const vector<string>& payloads, int rounds, F parse) {
+    auto start = chrono::steady_clock::now();
+    for(int i = 0; i < rounds; i++) {
+        for(auto& payload : payloads) {
+            parse(payload);
+        }
+    }
+    double nanos = chrono::duration<double, nano>(chrono::steady_clock::now() - start).count();
+    return nanos / (rounds * payloads.size());
+}
+
+int main(int argc, char* argv[]) {
+    string corpusDir = argc > 1 ? argv[1] : "bench/corpus";
+    auto qualityCorpus = readCorpus(corpusDir + "/waterQuality.txt");
+    auto displayCorpus = readCorpus(corpusDir + "/display.txt");
+    if(qualityCorpus.empty() || displayCorpus.empty()) {
+        cerr << "Corpus not found in " << corpusDir << "\n";
+        return 1;
+    }
+
+    // Differential check
+    mt19937 random(1234);
+    size_t checked = 0, mismatches = 0;
+    for(int round = 0; round < 20000; round++) {
+        for(auto& seed : qualityCorpus) {
+            string payload = round == 0 ? seed : mutate(seed, random);
+            WaterQuality expected = {}, actual = {};
+            bool expectedOk = referenceWaterQuality(payload, expected);
+            bool actualOk = parseWaterQuality(payload, actual);
+            checked++;
+            if(expectedOk != actualOk || (expectedOk && !sameWaterQuality(expected, actual))) {
+                if(mismatches++ < 10) {
+                    cerr << "waterQuality mismatch: \"" << payload << "\"\n";
+                }
+            }
+        }
+        for(auto& seed : displayCorpus) {
+            string payload = round == 0 ? seed : mutate(seed, random);
+            PipeCommand expected = {}, actual = {};
+            bool expectedOk = referencePipeCommand(payload, expected);
+            bool actualOk = parsePipeCommand(payload, actual);
+            checked++;
+            if(expectedOk != actualOk || (expectedOk && !samePipeCommand(expected, actual))) {
+                if(mismatches++ < 10) {
+                    cerr << "display mismatch: \"" << payload << "\"\n";
+                }
+            }
+        }
+    }
+    cout << checked << " payloads checked, " << mismatches << " mismatches\n";
+
+    // Microbenchmark on well-formed payloads
+    vector<string> qualityPayloads = { "7,300,0.2,300,20", "7.2,320.5,0.25,140,22.75", "6.5,250,0.1,100,15" };
+    vector<string> displayPayloads = { "setPipe/bath/on/0.2/20", "setPipe/shower/off", "setPipe/shower/on/0.15/35" };
+    const int rounds = 200000;
+    WaterQuality waterQuality;
+    PipeCommand command;
+
+    size_t before = allocations;
+    double oldQuality = nanosecondsPerCall(qualityPayloads, rounds, [&](const string& p) { referenceWaterQuality(p, waterQuality); });
+    double oldQualityAllocs = (double)(allocations - before) / (rounds * qualityPayloads.size());
+    before = allocations;
+    double newQuality = nanosecondsPerCall(qualityPayloads, rounds, [&](const string& p) { parseWaterQuality(p, waterQuality); });
+    double newQualityAllocs = (double)(allocations - before) / (rounds * qualityPayloads.size());
+    before = allocations;
+    double oldDisplay = nanosecondsPerCall(displayPayloads, rounds, [&](const string& p) { referencePipeCommand(p, command); });
+    double oldDisplayAllocs = (double)(allocations - before) / (rounds * displayPayloads.size());
+    before = allocations;
+    double newDisplay = nanosecondsPerCall(displayPayloads, rounds, [&](const string& p) { parsePipeCommand(p, command); });
+    double newDisplayAllocs = (double)(allocations - before) / (rounds * displayPayloads.size());
+
+    cout << "waterQuality: splitString/stod " << oldQuality << " ns, " << oldQualityAllocs << " allocations"
+         << " | from_chars " << newQuality << " ns, " << newQualityAllocs << " allocations\n";
+    cout << "display: splitString/stod " << oldDisplay << " ns, " << oldDisplayAllocs << " allocations"
+         << " | from_chars " << newDisplay << " ns, " << newDisplayAllocs << " allocations\n";
+    return mismatches == 0 ? 0 : 1;
+}
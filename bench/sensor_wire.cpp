@@ -0,0 +1,121 @@
+// Compares the size and decoding throughput of the text and binary waterQuality payloads,
+// and checks that both decode to the same readings.
+// Usage: sensor_wire
+#include <chrono>
+#include <cmath>
+#include <iostream>
+#include <random>
+#include "../src/BathRegistry.hpp"
+#include "../src/util.cpp"
+using namespace std;
+
+// Readings with the precision of the sensors (0.001), around the accepted ranges
+vector<WaterQuality> randomReadings(size_t count) {
+    mt19937 random(1234);
+    auto reading = [&](double min, double max) {
+        return round(uniform_real_distribution<double>(min, max)(random) * 1000) / 1000;
+    };
+    vector<WaterQuality> readings;
+    for(size_t i = 0; i < count; i++) {
+        readings.push_back({ .pH = reading(6, 9), .chlorides = reading(200, 450), .iron = reading(0, 0.5),
+                             .calcium = reading(80, 200), .color = reading(10, 35) });
+    }
+    return readings;
+}
+
+// Shortest representation of each value, as a sensor would send it
+string toText(const WaterQuality& quality) {
+    double values[] = { quality.pH, quality.chlorides, quality.iron, quality.calcium, quality.color };
+    char buffer[128];
+    char* end = buffer;
+    for(size_t i = 0; i < 5; i++) {
+        if(i > 0) {
+            *end++ = ',';
+        }
+        end = to_chars(end, buffer + sizeof(buffer), values[i]).ptr;
+    }
+    return string(buffer, end);
+}
+
+string toBinary(const WaterQuality& quality, SensorEncoding encoding) {
+    double values[] = { quality.pH, quality.chlorides, quality.iron, quality.calcium, quality.color };
+    char buffer[SENSOR_HEADER_SIZE + 8 * 5];
+    size_t size = encodeSensorValues(values, 5, encoding, buffer);
+    return string(buffer, size);
+}
+
+bool sameReading(const WaterQuality& a, const WaterQuality& b) {
+    return a.pH == b.pH && a.chlorides == b.chlorides && a.iron == b.iron && a.calcium == b.calcium && a.color == b.color;
+}
+
+struct Result {
+    double nanos;
+    double bytes;
+    size_t mismatches;
+};
+
+template<typename F>
+Result measure(const vector<string>& payloads, const vector<WaterQuality>& readings, int rounds, F decode) {
+    Result result = { 0, 0, 0 };
+    WaterQuality quality;
+    for(size_t i = 0; i < payloads.size(); i++) {
+        result.bytes += payloads[i].size();
+        if(!decode(payloads[i], quality) || !sameReading(quality, readings[i])) {
+            result.mismatches++;
+        }
+    }
+    result.bytes /= payloads.size();
+
+    // Sum of the decoded values, so that the decoding is not optimized away
+    volatile double sink = 0;
+    auto start = chrono::steady_clock::now();
+    for(int round = 0; round < rounds; round++) {
+        for(auto& payload : payloads) {
+            decode(payload, quality);
+            sink = sink + quality.pH;
+        }
+    }
+    result.nanos = chrono::duration<double, nano>(chrono::steady_clock::now() - start).count() / (rounds * payloads.size());
+    return result;
+}
+
+void print(const string& name, const Result& result) {
+    cout << name << ": " << result.bytes << " bytes, " << result.nanos << " ns, "
+         << 1000 / result.nanos << " M messages/s, " << result.bytes * 1000 / result.nanos << " MB/s, "
+         << result.mismatches << " mismatches\n";
+}
+
+int main() {
+    const size_t count = 10000;
+    const int rounds = 100;
+    auto readings = randomReadings(count);
+    vector<string> text, fixed, float64;
+    for(auto& reading : readings) {
+        text.push_back(toText(reading));
+        fixed.push_back(toBinary(reading, FIXED_MILLI));
+        float64.push_back(toBinary(reading, FLOAT64));
+    }
+
+    auto textResult = measure(text, readings, rounds, parseWaterQuality);
+    auto fixedResult = measure(fixed, readings, rounds, decodeWaterQuality);
+    auto floatResult = measure(float64, readings, rounds, decodeWaterQuality);
+    print("text     ", textResult);
+    print("fixed    ", fixedResult);
+    print("float64  ", floatResult);
+    cout << "fixed point decodes " << textResult.nanos / fixedResult.nanos << "x faster with "
+         << 100 * (1 - fixedResult.bytes / textResult.bytes) << "% fewer bytes than text\n";
+
+    // Truncated payloads and unknown versions are rejected
+    WaterQuality quality;
+    size_t accepted = 0;
+    for(size_t size = 0; size < fixed[0].size(); size++) {
+        accepted += decodeWaterQuality(string_view(fixed[0]).substr(0, size), quality);
+    }
+    string future = fixed[0];
+    future[0] = SENSOR_WIRE_VERSION + 1;
+    accepted += decodeWaterQuality(future, quality);
+    cout << accepted << " malformed payloads accepted\n";
+
+    bool ok = textResult.mismatches + fixedResult.mismatches + floatResult.mismatches + accepted == 0;
+    return ok ? 0 : 1;
+}
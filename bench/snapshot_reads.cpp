@@ -0,0 +1,103 @@
+// Compares the read throughput of the bath state behind a mutex (the previous bathLock) and
+// behind the seqlock snapshot, with 1 to N reader threads and a writer publishing a new state continuously.
+// Every published state has the same value in all its fields, so a torn read is detected.
+// Usage: snapshot_reads [max readers]
+#include <chrono>
+#include <iostream>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "../src/Seqlock.hpp"
+#include "../src/SmartBath.hpp"
+using namespace std;
+
+BathSnapshot makeState(uint64_t n) {
+    double value = n;
+    return { .bathState = { .isOn = (n & 1) == 1, .temperature = value, .debit = value },
+             .showerState = { .isOn = (n & 1) == 1, .temperature = value, .debit = value },
+             .currentVolume = value, .isOnWaterStopper = (n & 1) == 1 };
+}
+
+bool isConsistent(const BathSnapshot& state) {
+    double value = state.currentVolume;
+    bool odd = ((uint64_t)value & 1) == 1;
+    return state.bathState.temperature == value && state.bathState.debit == value
+        && state.showerState.temperature == value && state.showerState.debit == value
+        && state.bathState.isOn == odd && state.showerState.isOn == odd && state.isOnWaterStopper == odd;
+}
+
+struct Result {
+    double readsPerSecond;
+    uint64_t torn;
+};
+
+// Runs the readers for the given duration while the writer stores new states
+template<typename Read, typename Write>
+Result run(int readers, chrono::milliseconds duration, Read read, Write write) {
+    atomic<bool> running { true };
+    vector<uint64_t> reads(readers * 8), torn(readers * 8);
+    vector<thread> threads;
+    for(int i = 0; i < readers; i++) {
+        // Counters are 64 bytes apart, so that the readers don't share cache lines
+        threads.push_back(thread([&, i] {
+            uint64_t count = 0, bad = 0;
+            BathSnapshot state;
+            while(running.load(memory_order_relaxed)) {
+                read(state);
+                bad += !isConsistent(state);
+                count++;
+            }
+            reads[i * 8] = count;
+            torn[i * 8] = bad;
+        }));
+    }
+    thread writer([&] {
+        uint64_t n = 1;
+        while(running.load(memory_order_relaxed)) {
+            write(makeState(n++));
+            this_thread::yield();
+        }
+    });
+    this_thread::sleep_for(duration);
+    running = false;
+    writer.join();
+    Result result = { 0, 0 };
+    for(int i = 0; i < readers; i++) {
+        threads[i].join();
+        result.readsPerSecond += reads[i * 8];
+        result.torn += torn[i * 8];
+    }
+    result.readsPerSecond /= chrono::duration<double>(duration).count();
+    return result;
+}
+
+int main(int argc, char* argv[]) {
+    int maxReaders = argc > 1 ? atoi(argv[1]) : thread::hardware_concurrency();
+    if(maxReaders < 1) {
+        maxReaders = 1;
+    }
+    const auto duration = chrono::milliseconds(500);
+    cout << thread::hardware_concurrency() << " hardware threads\n";
+
+    uint64_t torn = 0;
+    for(int readers = 1; readers <= maxReaders; readers *= 2) {
+        mutex lock;
+        BathSnapshot locked = makeState(0);
+        auto mutexResult = run(readers, duration,
+            [&](BathSnapshot& state) { lock_guard<mutex> guard(lock); state = locked; },
+            [&](const BathSnapshot& state) { lock_guard<mutex> guard(lock); locked = state; });
+
+        Seqlock<BathSnapshot> snapshot;
+        snapshot.store(makeState(0));
+        auto seqlockResult = run(readers, duration,
+            [&](BathSnapshot& state) { snapshot.load(state); },
+            [&](const BathSnapshot& state) { snapshot.store(state); });
+
+        torn += mutexResult.torn + seqlockResult.torn;
+        cout << readers << " readers: mutex " << mutexResult.readsPerSecond / 1e6 << " M reads/s"
+             << " | seqlock " << seqlockResult.readsPerSecond / 1e6 << " M reads/s"
+             << " (" << seqlockResult.readsPerSecond / mutexResult.readsPerSecond << "x), "
+             << seqlockResult.torn << " torn reads\n";
+    }
+    return torn == 0 ? 0 : 1;
+}
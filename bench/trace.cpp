@@ -0,0 +1,68 @@
+// Cost of the trace points: a span and an instant event while tracing is off and on, a metered mutex while tracing,
+// and writing the Chrome trace of a full ring. The threads record into rings of their own, so they do not contend.
+// Usage: trace [--benchmark_filter=<regex>] [--benchmark_repetitions=<n>] [--benchmark_out=<path>] (Google Benchmark)
+#include <benchmark/benchmark.h>
+#include "../src/Metrics.cpp"
+using namespace std;
+
+int main(int argc, char** argv) {
+    static MeteredMutex meteredMutex("bench");
+
+    benchmark::RegisterBenchmark("off/span", [](benchmark::State& state) {
+        setTracing(false);
+        for(auto _ : state) {
+            TraceSpan span("bench", "span", "bath");
+        }
+    });
+    benchmark::RegisterBenchmark("off/instant", [](benchmark::State& state) {
+        setTracing(false);
+        for(auto _ : state) {
+            traceInstant("bench", "instant", "bath");
+        }
+    });
+    benchmark::RegisterBenchmark("off/MeteredMutex", [](benchmark::State& state) {
+        setTracing(false);
+        for(auto _ : state) {
+            meteredMutex.lock();
+            meteredMutex.unlock();
+        }
+    });
+    benchmark::RegisterBenchmark("on/span", [](benchmark::State& state) {
+        setTracing(true);
+        for(auto _ : state) {
+            TraceSpan span("bench", "span", "bath");
+        }
+        setTracing(false);
+    });
+    benchmark::RegisterBenchmark("on/instant", [](benchmark::State& state) {
+        setTracing(true);
+        for(auto _ : state) {
+            traceInstant("bench", "instant", "bath");
+        }
+        setTracing(false);
+    });
+    benchmark::RegisterBenchmark("on/MeteredMutex", [](benchmark::State& state) {
+        setTracing(true);
+        for(auto _ : state) {
+            meteredMutex.lock();
+            meteredMutex.unlock();
+        }
+        setTracing(false);
+    });
+    // The ring of the benchmarks above is full by now
+    benchmark::RegisterBenchmark("writeChromeTrace", [](benchmark::State& state) {
+        string trace;
+        for(auto _ : state) {
+            writeChromeTrace(trace);
+            benchmark::DoNotOptimize(trace.data());
+        }
+    });
+
+    benchmark::Initialize(&argc, argv);
+    if(benchmark::ReportUnrecognizedArguments(argc, argv)) {
+        return 1;
+    }
+    benchmark::RunSpecifiedBenchmarks();
+    benchmark::Shutdown();
+    return 0;
+}
@@ -0,0 +1,101 @@
+// Measures the cost of the rolling water quality statistics per sample, and compares the debounced shut-off
+// with the previous range check of the latest sample on simulated sensor streams:
+// noise with rare spikes, values hovering around a limit, and a slow drift of the pH.
+// Usage: water_quality [samples]
+#include <chrono>
+#include <cmath>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+#include "../src/WaterAnalytics.cpp"
+using namespace std;
+
+typedef chrono::steady_clock Clock;
+
+typedef struct Sample {
+    double values[WATER_PARAMETERS];
+} Sample;
+
+// Nominal values, in the middle of the ranges
+static const double NOMINAL[WATER_PARAMETERS] = { 7.5, 325, 0.2, 140, 22.5 };
+
+// The previous SmartBath::checkWaterQuality
+bool inRange(const Sample& sample) {
+    for(int i = 0; i < WATER_PARAMETERS; i++) {
+        if(!(PARAMETER_LIMITS[i][0] <= sample.values[i] && sample.values[i] <= PARAMETER_LIMITS[i][1])) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Shut-offs and state changes of both rules on the stream
+void compare(const char* name, const vector<Sample>& samples) {
+    WaterAnalytics analytics;
+    uint64_t rangeShutoffs = 0, rangeChanges = 0, debouncedChanges = 0;
+    bool rangeUnsafe = false;
+    for(auto& sample : samples) {
+        bool unsafe = !inRange(sample);
+        if(unsafe != rangeUnsafe) {
+            rangeChanges++;
+            rangeShutoffs += unsafe;
+        }
+        rangeUnsafe = unsafe;
+        debouncedChanges += analytics.add(sample.values);
+    }
+    WaterQualityStats stats = analytics.getStats();
+    cout << name << ": range check " << rangeShutoffs << " shut-offs, " << rangeChanges << " state changes; debounced "
+         << stats.shutoffs << " shut-offs, " << debouncedChanges << " state changes, " << stats.parameters[0].anomalies
+         << " pH anomalies\n";
+}
+
+int main(int argc, char** argv) {
+    size_t count = argc > 1 ? stoul(argv[1]) : 1000000;
+    mt19937_64 random(42);
+    normal_distribution<double> noise(0, 1);
+
+    // Sensor noise of 2% of the range width, and a pH spike out of range every 1000 samples
+    vector<Sample> noisy(count);
+    for(size_t n = 0; n < count; n++) {
+        for(int i = 0; i < WATER_PARAMETERS; i++) {
+            noisy[n].values[i] = NOMINAL[i] + noise(random) * (PARAMETER_LIMITS[i][1] - PARAMETER_LIMITS[i][0]) * 0.02;
+        }
+        if(random() % 1000 == 0) {
+            noisy[n].values[0] = 9.2;
+        }
+    }
+
+    WaterAnalytics analytics;
+    auto begin = Clock::now();
+    for(auto& sample : noisy) {
+        analytics.add(sample.values);
+    }
+    double addTime = chrono::duration<double, nano>(Clock::now() - begin).count() / count;
+    cout << "add " << addTime << " ns/sample (" << (int)(1000 / addTime) << " M samples/s), "
+         << sizeof(WaterAnalytics) << " bytes per bath\n";
+
+    compare("noise and spikes", noisy);
+
+    // The pH hovers around its upper limit, going over it for a few minutes at a time
+    vector<Sample> hovering = noisy;
+    for(size_t n = 0; n < count; n++) {
+        hovering[n].values[0] = 8.5 + 0.05 * sin(n / 300.0) + noise(random) * 0.02;
+    }
+    compare("hovering at limit", hovering);
+
+    // The pH drifts from 7.5 to 9 over 10000 samples
+    WaterAnalytics drift;
+    size_t drifting = 0, crossed = 0, unsafe = 0;
+    for(size_t n = 0; n < 10000; n++) {
+        Sample sample = noisy[n];
+        sample.values[0] = 7.5 + 1.5 * n / 10000 + noise(random) * 0.02;
+        drift.add(sample.values);
+        if(!drifting && drift.getStats().parameters[0].drifting) drifting = n;
+        if(!crossed && sample.values[0] > 8.5) crossed = n;
+        if(!unsafe && drift.isUnsafe()) unsafe = n;
+    }
+    cout << "slow pH drift: drifting at sample " << drifting << ", first sample over the limit " << crossed
+         << ", unsafe at sample " << unsafe << "\n";
+    return 0;
+}
@@ -9,7 +9,8 @@ import { getClient } from '../paho';
 const bathtubVolume = 300;
 const showerMaxDebit = 0.2;
 const bathMaxDebit = 0.25;
-const topic = 'display';
+// Topics of the bath are prefixed with its device ID
+const topic = `${process.env.REACT_APP_BATH_ID}/display`;
 
 function Screen() {
     let [app, setApp] = useRecoilState(appState);
@@ -0,0 +1,532 @@
+#include "Archive.hpp"
+#include "Journal.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <charconv>
+#include <cmath>
+#include <cstring>
+#include <dirent.h>
+#include <fcntl.h>
+#include <iostream>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+using namespace std;
+
+static const char ARCHIVE_MAGIC[8] = { 'S', 'B', 'A', 'R', 'C', 'H', 'V', 0 };
+static const uint32_t ARCHIVE_BYTE_ORDER = 0x01020304;
+
+static const char* COLUMN_NAMES[] = { "volume", "pH", "chlorides", "iron", "calcium", "color" };
+
+
+void BitWriter::write(uint64_t value, int count) {
+    if(count == 0) {
+        return;
+    }
+    if(count < 64) {
+        value &= (1ull << count) - 1;
+    }
+    int used = bits % 64;
+    if(used == 0) {
+        words.push_back(0);
+    }
+    int free = 64 - used;
+    if(count <= free) {
+        words.back() |= value << (free - count);
+    } else {
+        // The high bits end the current word, the low bits start the next one
+        words.back() |= value >> (count - free);
+        words.push_back(value << (64 - (count - free)));
+    }
+    bits += count;
+}
+
+const vector<uint64_t>& BitWriter::data() const {
+    return words;
+}
+
+size_t BitWriter::memoryUsage() const {
+    return words.capacity() * sizeof(uint64_t);
+}
+
+BitReader::BitReader(const uint64_t* words, size_t count) : words(words), size(count * 64) {
+}
+
+uint64_t BitReader::read(int count) {
+    if(count == 0) {
+        return 0;
+    }
+    if(position + count > size) {
+        overrun = true;
+        position = size;
+        return 0;
+    }
+    uint64_t index = position / 64;
+    int offset = position % 64;
+    uint64_t value = words[index] << offset;
+    if(offset + count > 64) {
+        value |= words[index + 1] >> (64 - offset);
+    }
+    position += count;
+    return count == 64 ? value : value >> (64 - count);
+}
+
+bool BitReader::readBit() {
+    return read(1) != 0;
+}
+
+// Sign extends the low count bits of value
+static int64_t signExtend(uint64_t value, int count) {
+    return (int64_t)(value << (64 - count)) >> (64 - count);
+}
+
+void TimestampEncoder::append(int64_t time) {
+    if(!started) {
+        stream.write(time, 64);
+        previous = time;
+        started = true;
+        return;
+    }
+    int64_t delta = time - previous;
+    int64_t deltaOfDelta = delta - previousDelta;
+    previous = time;
+    previousDelta = delta;
+    if(deltaOfDelta == 0) {
+        stream.write(0, 1);
+    } else if(deltaOfDelta >= -64 && deltaOfDelta < 64) {
+        stream.write(0b10, 2);
+        stream.write(deltaOfDelta, 7);
+    } else if(deltaOfDelta >= -256 && deltaOfDelta < 256) {
+        stream.write(0b110, 3);
+        stream.write(deltaOfDelta, 9);
+    } else if(deltaOfDelta >= -2048 && deltaOfDelta < 2048) {
+        stream.write(0b1110, 4);
+        stream.write(deltaOfDelta, 12);
+    } else {
+        stream.write(0b1111, 4);
+        stream.write(deltaOfDelta, 64);
+    }
+}
+
+const BitWriter& TimestampEncoder::data() const {
+    return stream;
+}
+
+TimestampDecoder::TimestampDecoder(BitReader& stream) : stream(stream) {
+}
+
+int64_t TimestampDecoder::next() {
+    if(!started) {
+        previous = stream.read(64);
+        started = true;
+        return previous;
+    }
+    int64_t deltaOfDelta = 0;
+    if(stream.readBit()) {
+        if(!stream.readBit()) {
+            deltaOfDelta = signExtend(stream.read(7), 7);
+        } else if(!stream.readBit()) {
+            deltaOfDelta = signExtend(stream.read(9), 9);
+        } else if(!stream.readBit()) {
+            deltaOfDelta = signExtend(stream.read(12), 12);
+        } else {
+            deltaOfDelta = stream.read(64);
+        }
+    }
+    previousDelta += deltaOfDelta;
+    previous += previousDelta;
+    return previous;
+}
+
+void ValueEncoder::append(double value) {
+    uint64_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    if(!started) {
+        stream.write(bits, 64);
+        previous = bits;
+        started = true;
+        return;
+    }
+    uint64_t xored = bits ^ previous;
+    previous = bits;
+    if(xored == 0) {
+        stream.write(0, 1);
+        return;
+    }
+    // The leading zeros are written in 5 bits
+    int xoredLeading = min(__builtin_clzll(xored), 31);
+    int xoredTrailing = __builtin_ctzll(xored);
+    if(leading >= 0 && xoredLeading >= leading && xoredTrailing >= trailing) {
+        // The meaningful bits fit in the window of the previous XOR
+        stream.write(0b10, 2);
+        stream.write(xored >> trailing, 64 - leading - trailing);
+        return;
+    }
+    leading = xoredLeading;
+    trailing = xoredTrailing;
+    int meaningful = 64 - leading - trailing;
+    stream.write(0b11, 2);
+    stream.write(leading, 5);
+    // 64 meaningful bits are written as 0
+    stream.write(meaningful, 6);
+    stream.write(xored >> trailing, meaningful);
+}
+
+const BitWriter& ValueEncoder::data() const {
+    return stream;
+}
+
+ValueDecoder::ValueDecoder(BitReader& stream) : stream(stream) {
+}
+
+double ValueDecoder::next() {
+    if(!started) {
+        previous = stream.read(64);
+        started = true;
+    } else if(stream.readBit()) {
+        if(stream.readBit()) {
+            leading = stream.read(5);
+            int meaningful = stream.read(6);
+            if(meaningful == 0) {
+                meaningful = 64;
+            }
+            trailing = max(64 - leading - meaningful, 0);
+        }
+        previous ^= stream.read(64 - leading - trailing) << trailing;
+    }
+    double value;
+    memcpy(&value, &previous, sizeof(value));
+    return value;
+}
+
+void ArchiveSegment::append(int64_t time, const double (&row)[(int)ArchiveColumn::Count]) {
+    if(rows == 0) {
+        firstTime = time;
+    }
+    lastTime = time;
+    rows++;
+    times.append(time);
+    for(int i = 0; i < (int)ArchiveColumn::Count; i++) {
+        values[i].append(row[i]);
+    }
+}
+
+const BitWriter& ArchiveSegment::stream(int index) const {
+    return index == 0 ? times.data() : values[index - 1].data();
+}
+
+size_t ArchiveSegment::fileSize() const {
+    size_t size = sizeof(ArchiveSegmentHeader);
+    for(int i = 0; i < ARCHIVE_STREAMS; i++) {
+        size += stream(i).data().size() * sizeof(uint64_t);
+    }
+    return size;
+}
+
+bool ArchiveSegment::write(int fd) const {
+    ArchiveSegmentHeader header = {};
+    memcpy(header.magic, ARCHIVE_MAGIC, sizeof(header.magic));
+    header.version = ARCHIVE_VERSION;
+    header.byteOrder = ARCHIVE_BYTE_ORDER;
+    header.rows = rows;
+    header.streams = ARCHIVE_STREAMS;
+    header.firstTime = firstTime;
+    header.lastTime = lastTime;
+    uint64_t offset = sizeof(ArchiveSegmentHeader);
+    for(int i = 0; i < ARCHIVE_STREAMS; i++) {
+        header.offsets[i] = offset;
+        offset += stream(i).data().size() * sizeof(uint64_t);
+    }
+    header.offsets[ARCHIVE_STREAMS] = offset;
+
+    string content;
+    content.reserve(offset);
+    content.append((const char*)&header, sizeof(header));
+    for(int i = 0; i < ARCHIVE_STREAMS; i++) {
+        auto& words = stream(i).data();
+        content.append((const char*)words.data(), words.size() * sizeof(uint64_t));
+    }
+    return writeAll(fd, content.data(), content.size());
+}
+
+size_t ArchiveSegment::memoryUsage() const {
+    size_t bytes = sizeof(ArchiveSegment);
+    for(int i = 0; i < ARCHIVE_STREAMS; i++) {
+        bytes += stream(i).memoryUsage();
+    }
+    return bytes;
+}
+
+
+Archive::Archive(ArchiveWriter* writer, string directory) : writer(writer), directory(directory) {
+    if(::mkdir(directory.c_str(), 0755) != 0 && errno != EEXIST) {
+        cout << "Archive " << directory << " can't be created, telemetry will not be archived.\n";
+    }
+    current = make_shared<ArchiveSegment>();
+}
+
+Archive::~Archive() {
+    uint64_t sequence;
+    {
+        lock_guard<mutex> lock(archiveMutex);
+        seal();
+        sequence = lastSequence;
+    }
+    writer->waitWritten(sequence);
+}
+
+void Archive::append(int64_t time, const double (&row)[(int)ArchiveColumn::Count]) {
+    lock_guard<mutex> lock(archiveMutex);
+    // The rows of a segment are scanned in order, so a clock that went back drops the row
+    if(current->rows > 0 && time < current->lastTime) {
+        return;
+    }
+    current->append(time, row);
+    if(current->rows >= ARCHIVE_SEGMENT_ROWS) {
+        seal();
+    }
+}
+
+void Archive::seal() {
+    if(current->rows == 0) {
+        return;
+    }
+    sealed.push_back(current);
+    lastSequence = writer->enqueue({ .archive = this, .segment = current, .sequence = 0 });
+    current = make_shared<ArchiveSegment>();
+}
+
+void Archive::written(const ArchiveSegment* segment) {
+    lock_guard<mutex> lock(archiveMutex);
+    sealed.erase(find_if(sealed.begin(), sealed.end(), [&](auto& item) { return item.get() == segment; }));
+}
+
+string Archive::segmentPath(const ArchiveSegment& segment) const {
+    return directory + "/" + to_string(segment.firstTime) + "-" + to_string(segment.lastTime) + ".seg";
+}
+
+bool Archive::scanStreams(uint32_t rows, BitReader& timeStream, BitReader& valueStream, int64_t from, int64_t to,
+    const ScanCallback& visit) {
+    TimestampDecoder times(timeStream);
+    ValueDecoder values(valueStream);
+    for(uint32_t row = 0; row < rows; row++) {
+        int64_t time = times.next();
+        double value = values.next();
+        // A corrupted stream ends the segment
+        if(timeStream.overrun || valueStream.overrun || time >= to) {
+            break;
+        }
+        // The water quality is NaN until the sensor sent it
+        if(time >= from && !isnan(value) && !visit(time, value)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool Archive::scanSegment(const ArchiveSegment& segment, ArchiveColumn column, int64_t from, int64_t to,
+    const ScanCallback& visit) {
+    auto& times = segment.stream(0).data();
+    auto& values = segment.stream((int)column + 1).data();
+    BitReader timeStream(times.data(), times.size());
+    BitReader valueStream(values.data(), values.size());
+    return scanStreams(segment.rows, timeStream, valueStream, from, to, visit);
+}
+
+bool Archive::scanFile(const string& path, ArchiveColumn column, int64_t from, int64_t to, const ScanCallback& visit) {
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if(fd < 0) {
+        return true;
+    }
+    struct stat status;
+    if(::fstat(fd, &status) != 0 || (size_t)status.st_size < sizeof(ArchiveSegmentHeader)) {
+        ::close(fd);
+        return true;
+    }
+    size_t size = status.st_size;
+    void* data = ::mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if(data == MAP_FAILED) {
+        return true;
+    }
+    // Only the pages of the timestamps and of the column are read
+    ArchiveSegmentHeader header;
+    memcpy(&header, data, sizeof(header));
+    bool valid = memcmp(header.magic, ARCHIVE_MAGIC, sizeof(header.magic)) == 0
+        && header.version == ARCHIVE_VERSION
+        && header.byteOrder == ARCHIVE_BYTE_ORDER
+        && header.streams == ARCHIVE_STREAMS
+        && header.offsets[0] >= sizeof(header)
+        && header.offsets[ARCHIVE_STREAMS] <= size;
+    for(int i = 0; valid && i < ARCHIVE_STREAMS; i++) {
+        valid = header.offsets[i] % sizeof(uint64_t) == 0 && header.offsets[i] <= header.offsets[i + 1];
+    }
+    bool more = true;
+    if(valid) {
+        ::madvise(data, size, MADV_SEQUENTIAL);
+        const char* base = (const char*)data;
+        int index = (int)column + 1;
+        BitReader timeStream((const uint64_t*)(base + header.offsets[0]), (header.offsets[1] - header.offsets[0]) / 8);
+        BitReader valueStream((const uint64_t*)(base + header.offsets[index]),
+            (header.offsets[index + 1] - header.offsets[index]) / 8);
+        more = scanStreams(header.rows, timeStream, valueStream, from, to, visit);
+    } else {
+        cout << "Archive segment " << path << " is not valid, it is skipped.\n";
+    }
+    ::munmap(data, size);
+    return more;
+}
+
+void Archive::scan(ArchiveColumn column, int64_t from, int64_t to, const ScanCallback& visit) {
+    struct Source {
+        int64_t firstTime;
+        int64_t lastTime;
+        string path;
+        shared_ptr<const ArchiveSegment> segment;
+    };
+    vector<Source> sources;
+    {
+        // The segments still in memory are taken before listing the files, so that a segment written
+        // in between is found at least once. The copy of the current segment is a few kilobytes.
+        lock_guard<mutex> lock(archiveMutex);
+        for(auto& segment : sealed) {
+            sources.push_back({ segment->firstTime, segment->lastTime, string(), segment });
+        }
+        if(current->rows > 0) {
+            sources.push_back({ current->firstTime, current->lastTime, string(), make_shared<ArchiveSegment>(*current) });
+        }
+    }
+    size_t inMemory = sources.size();
+    DIR* listing = ::opendir(directory.c_str());
+    if(listing != nullptr) {
+        while(struct dirent* entry = ::readdir(listing)) {
+            // <first>-<last>.seg
+            string_view name = entry->d_name;
+            int64_t firstTime, lastTime;
+            auto first = from_chars(name.data(), name.data() + name.size(), firstTime);
+            if(first.ec != errc() || first.ptr == name.data() + name.size() || *first.ptr != '-') {
+                continue;
+            }
+            auto last = from_chars(first.ptr + 1, name.data() + name.size(), lastTime);
+            if(last.ec != errc() || string_view(last.ptr, name.data() + name.size() - last.ptr) != ".seg") {
+                continue;
+            }
+            bool duplicate = any_of(sources.begin(), sources.begin() + inMemory,
+                [&](const Source& source) { return source.firstTime == firstTime; });
+            if(!duplicate) {
+                sources.push_back({ firstTime, lastTime, directory + "/" + string(name), nullptr });
+            }
+        }
+        ::closedir(listing);
+    }
+    sort(sources.begin(), sources.end(), [](const Source& a, const Source& b) { return a.firstTime < b.firstTime; });
+    for(auto& source : sources) {
+        if(source.lastTime < from || source.firstTime >= to) {
+            continue;
+        }
+        bool more = source.segment ? scanSegment(*source.segment, column, from, to, visit)
+            : scanFile(source.path, column, from, to, visit);
+        if(!more) {
+            return;
+        }
+    }
+}
+
+size_t Archive::memoryUsage() {
+    lock_guard<mutex> lock(archiveMutex);
+    size_t bytes = current->memoryUsage() + sealed.capacity() * sizeof(shared_ptr<const ArchiveSegment>);
+    for(auto& segment : sealed) {
+        bytes += segment->memoryUsage();
+    }
+    return bytes;
+}
+
+const char* Archive::columnName(ArchiveColumn column) {
+    return COLUMN_NAMES[(int)column];
+}
+
+bool Archive::parseColumn(string_view name, ArchiveColumn& column) {
+    for(int i = 0; i < (int)ArchiveColumn::Count; i++) {
+        if(name == COLUMN_NAMES[i]) {
+            column = (ArchiveColumn)i;
+            return true;
+        }
+    }
+    return false;
+}
+
+
+ArchiveWriter::ArchiveWriter() {
+    writerThread = std::thread(writeSegments, this);
+}
+
+ArchiveWriter::~ArchiveWriter() {
+    stop();
+}
+
+void ArchiveWriter::stop() {
+    {
+        lock_guard<mutex> lock(writerMutex);
+        if(!running) {
+            return;
+        }
+        running = false;
+    }
+    workCondition.notify_one();
+    writerThread.join();
+}
+
+uint64_t ArchiveWriter::enqueue(Entry entry) {
+    uint64_t sequence;
+    {
+        lock_guard<mutex> lock(writerMutex);
+        sequence = ++queuedSequence;
+        entry.sequence = sequence;
+        pending.push_back(std::move(entry));
+    }
+    workCondition.notify_one();
+    return sequence;
+}
+
+void ArchiveWriter::waitWritten(uint64_t sequence) {
+    unique_lock<mutex> lock(writerMutex);
+    writtenCondition.wait(lock, [&]() { return writtenSequence >= sequence; });
+}
+
+void ArchiveWriter::writeSegments(ArchiveWriter* writer) {
+    unique_lock<mutex> lock(writer->writerMutex);
+    while(true) {
+        writer->workCondition.wait(lock, [&]() { return !writer->pending.empty() || !writer->running; });
+        if(writer->pending.empty()) {
+            break;
+        }
+        Entry entry = std::move(writer->pending.front());
+        writer->pending.pop_front();
+        lock.unlock();
+
+        const ArchiveSegment& segment = *entry.segment;
+        string path = entry.archive->segmentPath(segment);
+        bool written = replaceFile(path, [&](int fd) { return segment.write(fd); });
+        if(!written) {
+            cout << "Archive segment " << path << " can't be written.\n";
+        }
+        // Once the file is renamed, scans read it instead of the segment in memory
+        entry.archive->written(entry.segment.get());
+
+        lock.lock();
+        if(written) {
+            writer->stats.segments++;
+            writer->stats.rows += segment.rows;
+            writer->stats.bytes += segment.fileSize();
+        } else {
+            writer->stats.failed++;
+        }
+        writer->writtenSequence = entry.sequence;
+        writer->writtenCondition.notify_all();
+    }
+}
+
+ArchiveStats ArchiveWriter::getStats() {
+    lock_guard<mutex> lock(writerMutex);
+    return stats;
+}
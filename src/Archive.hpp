@@ -0,0 +1,245 @@
+#pragma once
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+using namespace std;
+
+#define ARCHIVE_VERSION 1
+
+// Rows of a segment: an hour of interval checks. The open segment is lost on a crash.
+#ifndef ARCHIVE_SEGMENT_ROWS
+#define ARCHIVE_SEGMENT_ROWS 3600
+#endif
+// Maximum number of points returned by a scan request
+#ifndef ARCHIVE_MAX_POINTS
+#define ARCHIVE_MAX_POINTS 10000
+#endif
+
+// Value columns of a row. The timestamps are a separate column.
+enum class ArchiveColumn { Volume, PH, Chlorides, Iron, Calcium, Color, Count };
+
+#define ARCHIVE_STREAMS ((int)ArchiveColumn::Count + 1)
+
+typedef struct ArchiveStats {
+    // Segments written and their rows
+    uint64_t segments;
+    uint64_t rows;
+    // Size of the written files, headers included
+    uint64_t bytes;
+    // Segments that could not be written
+    uint64_t failed;
+} ArchiveStats;
+
+// Layout of a segment file. Numbers are in the byte order of the host that wrote the file:
+//   header | timestamp stream | one stream per value column
+// Each stream is a sequence of 64-bit words, read from the most significant bit.
+typedef struct ArchiveSegmentHeader {
+    // "SBARCHV" followed by a 0
+    char magic[8];
+    uint32_t version;
+    // 0x01020304, to reject a file written with another byte order
+    uint32_t byteOrder;
+    uint32_t rows;
+    uint32_t streams;
+    // Unix time in milliseconds of the first and last rows
+    int64_t firstTime;
+    int64_t lastTime;
+    // Offset of each stream in bytes, and the end of the last one
+    uint64_t offsets[ARCHIVE_STREAMS + 1];
+} ArchiveSegmentHeader;
+
+// Bits appended to a vector of words, most significant bit first
+class BitWriter {
+private:
+    vector<uint64_t> words;
+    uint64_t bits = 0;
+public:
+    void write(uint64_t value, int count);
+    const vector<uint64_t>& data() const;
+    size_t memoryUsage() const;
+};
+
+// Reads the bits written by BitWriter. Reading past the end returns zeros and sets overrun.
+class BitReader {
+private:
+    const uint64_t* words;
+    uint64_t size;
+    uint64_t position = 0;
+public:
+    bool overrun = false;
+    BitReader(const uint64_t* words, size_t count);
+    uint64_t read(int count);
+    bool readBit();
+};
+
+/**
+ * Gorilla encoding of the timestamps: the first one in full, then the delta of the deltas in a variable number of bits.
+ * Rows taken at a steady interval cost 1 bit, and a few milliseconds of jitter cost 10 bits.
+*/
+class TimestampEncoder {
+private:
+    BitWriter stream;
+    int64_t previous = 0;
+    int64_t previousDelta = 0;
+    bool started = false;
+public:
+    void append(int64_t time);
+    const BitWriter& data() const;
+};
+
+class TimestampDecoder {
+private:
+    BitReader& stream;
+    int64_t previous = 0;
+    int64_t previousDelta = 0;
+    bool started = false;
+public:
+    TimestampDecoder(BitReader& stream);
+    int64_t next();
+};
+
+/**
+ * Gorilla encoding of the values: each value is XORed with the previous one.
+ * An unchanged value costs 1 bit. Otherwise only the meaningful bits of the XOR are written,
+ * in the window of leading and trailing zeros of the previous XOR when they fit.
+*/
+class ValueEncoder {
+private:
+    BitWriter stream;
+    uint64_t previous = 0;
+    int leading = -1;
+    int trailing = 0;
+    bool started = false;
+public:
+    void append(double value);
+    const BitWriter& data() const;
+};
+
+class ValueDecoder {
+private:
+    BitReader& stream;
+    uint64_t previous = 0;
+    int leading = 0;
+    int trailing = 0;
+    bool started = false;
+public:
+    ValueDecoder(BitReader& stream);
+    double next();
+};
+
+// Rows compressed in memory, until the segment is full and written
+class ArchiveSegment {
+private:
+    TimestampEncoder times;
+    ValueEncoder values[(int)ArchiveColumn::Count];
+public:
+    uint32_t rows = 0;
+    int64_t firstTime = 0;
+    int64_t lastTime = 0;
+
+    void append(int64_t time, const double (&row)[(int)ArchiveColumn::Count]);
+    const BitWriter& stream(int index) const;
+    // Writes the segment file into fd
+    bool write(int fd) const;
+    size_t fileSize() const;
+    size_t memoryUsage() const;
+};
+
+class ArchiveWriter;
+
+/**
+ * Telemetry of a bath kept for months in archive-<id>/<first>-<last>.seg files, one per segment.
+ * Each row is compressed when it is appended. Full segments are written by the archive writer thread,
+ * and the files are memory mapped to be scanned, so appending never waits for the disk.
+ * Thread safe.
+*/
+class Archive {
+    friend class ArchiveWriter;
+public:
+    // Called with the rows of a scan in time order. Returning false stops the scan.
+    typedef function<bool(int64_t time, double value)> ScanCallback;
+private:
+    ArchiveWriter* writer;
+    const string directory;
+    mutex archiveMutex;
+    // Segment receiving the rows
+    shared_ptr<ArchiveSegment> current;
+    // Segments queued on the writer. They are scanned from memory until their file is written.
+    vector<shared_ptr<const ArchiveSegment>> sealed;
+    uint64_t lastSequence = 0;
+
+    void seal();
+    // Called by the writer thread once the file of the segment is written, or failed
+    void written(const ArchiveSegment* segment);
+    string segmentPath(const ArchiveSegment& segment) const;
+    // Decodes the timestamps and the values of a column. Returns false if visit stopped the scan.
+    static bool scanStreams(uint32_t rows, BitReader& timeStream, BitReader& valueStream, int64_t from, int64_t to,
+        const ScanCallback& visit);
+    static bool scanSegment(const ArchiveSegment& segment, ArchiveColumn column, int64_t from, int64_t to,
+        const ScanCallback& visit);
+    // Maps the file of a segment. A file that is not a valid segment is skipped.
+    static bool scanFile(const string& path, ArchiveColumn column, int64_t from, int64_t to, const ScanCallback& visit);
+public:
+    // The archive must be destroyed before its writer
+    Archive(ArchiveWriter* writer, string directory);
+    // Writes the open segment, and waits until the queued ones are written
+    ~Archive();
+
+    // Appends a row of values taken at time (unix milliseconds). Times must not go back.
+    void append(int64_t time, const double (&row)[(int)ArchiveColumn::Count]);
+
+    /**
+     * Calls visit with the values of the column taken in [from, to), in time order.
+     * Only the timestamps and the requested column are decoded.
+    */
+    void scan(ArchiveColumn column, int64_t from, int64_t to, const ScanCallback& visit);
+
+    size_t memoryUsage();
+
+    // Name used by the API (volume, pH, chlorides, iron, calcium, color)
+    static const char* columnName(ArchiveColumn column);
+    // Returns false if the name is not a column
+    static bool parseColumn(string_view name, ArchiveColumn& column);
+};
+
+// Writes the full segments of all the archives from a dedicated thread
+class ArchiveWriter {
+    friend class Archive;
+private:
+    struct Entry {
+        Archive* archive;
+        shared_ptr<const ArchiveSegment> segment;
+        uint64_t sequence;
+    };
+
+    mutex writerMutex;
+    // Signaled when segments are queued, and when one is written
+    condition_variable workCondition;
+    condition_variable writtenCondition;
+    deque<Entry> pending;
+    uint64_t queuedSequence = 0;
+    uint64_t writtenSequence = 0;
+    bool running = true;
+    std::thread writerThread;
+
+    ArchiveStats stats = {};
+
+    static void writeSegments(ArchiveWriter* writer);
+    uint64_t enqueue(Entry entry);
+    void waitWritten(uint64_t sequence);
+public:
+    ArchiveWriter();
+    ~ArchiveWriter();
+
+    ArchiveStats getStats();
+
+    // Writes the queued segments and stops the thread. Called by the destructor.
+    void stop();
+};
@@ -0,0 +1,920 @@
+#pragma once
+#include <algorithm>
+
+#include <pistache/net.h>
+#include <pistache/http.h>
+#include <pistache/peer.h>
+#include <pistache/http_headers.h>
+#include <pistache/cookie.h>
+#include <pistache/router.h>
+#include <pistache/endpoint.h>
+#include <pistache/common.h>
+#include "BathRegistry.cpp"
+#include "util.cpp"
+#include "env.hpp"
+
+using namespace std;
+using namespace Pistache;
+
+class BathEndpoint {
+public:
+    explicit BathEndpoint(Address addr)
+        : httpEndpoint(std::make_shared<Http::Endpoint>(addr))
+    {
+        // The bath served by the routes without the /baths/:id prefix
+        registry.addBath(DEFAULT_BATH_ID);
+    }
+
+    // The registry receives and publishes through the given transports instead of MQTT_SERVER_ADDRESS
+    BathEndpoint(Address addr, unique_ptr<MqttTransport> receiver, unique_ptr<MqttTransport> sender)
+        : registry(std::move(receiver), std::move(sender)), httpEndpoint(std::make_shared<Http::Endpoint>(addr))
+    {
+        registry.addBath(DEFAULT_BATH_ID);
+    }
+
+    // Initialization of the server. Additional options can be provided here
+    void init(size_t thr = 2) {
+        auto opts = Http::Endpoint::options()
+            .threads(static_cast<int>(thr));
+        httpEndpoint->init(opts);
+        // Server routes are loaded up
+        setupRoutes();
+    }
+
+    // Server is started threaded.  
+    void start() {
+        httpEndpoint->setHandler(router.handler());
+        httpEndpoint->serveThreaded();
+    }
+
+    // When signaled server shuts down
+    void stop(){
+        httpEndpoint->shutdown();
+    }
+
+private:
+    // JSON MimeType used in request responses
+    Pistache::Http::Mime::MediaType JSON_MIME = MIME(Application, Json);
+
+    void setupRoutes() {
+        using namespace Rest;
+        // Defining various endpoints
+        route(Routes::Get, "/baths", Routes::bind(&BathEndpoint::getBaths, this));
+        route(Routes::Post, "/baths/:id", Routes::bind(&BathEndpoint::addBath, this));
+        route(Routes::Delete, "/baths/:id", Routes::bind(&BathEndpoint::removeBath, this));
+        route(Routes::Get, "/models", Routes::bind(&BathEndpoint::getModels, this));
+        route(Routes::Get, "/topics", Routes::bind(&BathEndpoint::getTopics, this));
+        route(Routes::Get, "/metrics", Routes::bind(&BathEndpoint::getMetrics, this));
+        route(Routes::Get, "/trace", Routes::bind(&BathEndpoint::getTrace, this));
+        route(Routes::Post, "/trace/:on", Routes::bind(&BathEndpoint::toggleTracing, this));
+        // Bath routes are available for the default bath and, prefixed with /baths/:id, for every hosted bath
+        bathRoute(Routes::Get, "/tick", Routes::bind(&BathEndpoint::getTickStats, this));
+        bathRoute(Routes::Get, "/telemetry", Routes::bind(&BathEndpoint::getTelemetry, this));
+        bathRoute(Routes::Post, "/telemetry/:name/:absolute/:relative/:heartbeat", Routes::bind(&BathEndpoint::setTelemetryDeadband, this));
+        bathRoute(Routes::Get, "/waterQuality", Routes::bind(&BathEndpoint::getWaterQualityStats, this));
+        bathRoute(Routes::Post, "/waterQuality/debounce/:shutoff/:resume/:hysteresis", Routes::bind(&BathEndpoint::setWaterDebounce, this));
+        bathRoute(Routes::Get, "/model", Routes::bind(&BathEndpoint::getModel, this));
+        bathRoute(Routes::Get, "/fill", Routes::bind(&BathEndpoint::getFillStats, this));
+        bathRoute(Routes::Post, "/fill/mode/:mode", Routes::bind(&BathEndpoint::setFillMode, this));
+        bathRoute(Routes::Get, "/physics", Routes::bind(&BathEndpoint::getPhysics, this));
+        bathRoute(Routes::Post, "/physics/step/:ms", Routes::bind(&BathEndpoint::setPhysicsStep, this));
+        bathRoute(Routes::Get, "/volume", Routes::bind(&BathEndpoint::getCurrentVolume, this));
+        bathRoute(Routes::Get, "/:pipe/state", Routes::bind(&BathEndpoint::getPipeState, this));
+        bathRoute(Routes::Post, "/:pipe/off", Routes::bind(&BathEndpoint::setPipeStateOff, this));
+        bathRoute(Routes::Post, "/:pipe/on", Routes::bind(&BathEndpoint::setPipeStateOn, this));
+        bathRoute(Routes::Post, "/:pipe/on/:debit", Routes::bind(&BathEndpoint::setPipeStateOn, this));
+        bathRoute(Routes::Post, "/:pipe/on/:debit/:temperature", Routes::bind(&BathEndpoint::setPipeStateOn, this));
+        bathRoute(Routes::Post, "/stopper/:on", Routes::bind(&BathEndpoint::toggleStopper, this));
+        bathRoute(Routes::Post, "/profiles/add/:name/:weight/:bathTemp/:showerTemp", Routes::bind(&BathEndpoint::addProfile, this));
+        bathRoute(Routes::Post, "/profiles/edit/:name/:weight/:bathTemp/:showerTemp", Routes::bind(&BathEndpoint::editProfile, this));
+        bathRoute(Routes::Post, "/profiles/remove/:name", Routes::bind(&BathEndpoint::removeProfile, this));
+        bathRoute(Routes::Post, "/profiles/set/:name", Routes::bind(&BathEndpoint::setProfile, this));
+        bathRoute(Routes::Get, "/profiles/get/:name", Routes::bind(&BathEndpoint::getProfile, this));
+        bathRoute(Routes::Get, "/profiles/get-set", Routes::bind(&BathEndpoint::getProfileSet, this));
+        bathRoute(Routes::Post, "/prepare", Routes::bind(&BathEndpoint::prepareBathForProfile, this));
+        bathRoute(Routes::Post, "/cancel-prepare", Routes::bind(&BathEndpoint::cancelBathPreparation, this));
+        bathRoute(Routes::Post, "/prepare/:weight", Routes::bind(&BathEndpoint::prepareBath, this));
+        bathRoute(Routes::Post, "/prepare/:weight/:temperature", Routes::bind(&BathEndpoint::prepareBath, this));
+        bathRoute(Routes::Post, "/salt/:on/", Routes::bind(&BathEndpoint::toggleSaltPump, this));
+        bathRoute(Routes::Post, "/batch", Routes::bind(&BathEndpoint::applyBatch, this));
+        bathRoute(Routes::Get, "/events", Routes::bind(&BathEndpoint::pollEvents, this));
+        bathRoute(Routes::Get, "/events/:since", Routes::bind(&BathEndpoint::pollEvents, this));
+        bathRoute(Routes::Get, "/events/:since/:timeout", Routes::bind(&BathEndpoint::pollEvents, this));
+        bathRoute(Routes::Get, "/history/:metric", Routes::bind(&BathEndpoint::getHistory, this));
+        bathRoute(Routes::Get, "/archive/:column", Routes::bind(&BathEndpoint::scanArchive, this));
+    }
+
+    typedef void (*AddRoute)(Rest::Router&, const std::string&, Rest::Route::Handler);
+
+    // Registers a route whose handler time is recorded in smartbath_http_request_duration_seconds,
+    // and traced as a span named after the method
+    void route(AddRoute addRoute, const string& resource, Rest::Route::Handler handler) {
+        addRoute(router, resource, timed(addRoute, resource, handler));
+    }
+
+    // Registers a bath route both for the default bath and for the bath with the given :id.
+    // Both share the histogram of the route.
+    void bathRoute(AddRoute addRoute, const string& resource, Rest::Route::Handler handler) {
+        auto timedHandler = timed(addRoute, resource, handler);
+        addRoute(router, resource, timedHandler);
+        addRoute(router, "/baths/:id" + resource, timedHandler);
+    }
+
+    static Rest::Route::Handler timed(AddRoute addRoute, const string& resource, Rest::Route::Handler handler) {
+        const char* method = addRoute == Rest::Routes::Get ? "GET" : addRoute == Rest::Routes::Post ? "POST" : "DELETE";
+        Histogram* histogram = &MetricsRegistry::global().histogram("smartbath_http_request_duration_seconds",
+            "Time spent in the HTTP handlers", string("method=\"") + method + "\",route=\"" + resource + "\"");
+        return [method, histogram, handler](const Rest::Request& request, Http::ResponseWriter response) {
+            ScopedTimer timer(*histogram);
+            if(!tracing()) {
+                return handler(request, std::move(response));
+            }
+            setTraceThreadName("http");
+            TraceSpan span("http", method, request.resource());
+            return handler(request, std::move(response));
+        };
+    }
+
+    // Returns the bath addressed by the request, or nullptr after sending 404 if it is not hosted.
+    shared_ptr<SmartBath> getBath(const Rest::Request& request, Http::ResponseWriter& response) {
+        string id = DEFAULT_BATH_ID;
+        if(request.hasParam(":id")) {
+            id = request.param(":id").as<std::string>();
+        }
+        auto bath = registry.getBath(id);
+        if(!bath) {
+            sendError(response, Http::Code::Not_Found, "BATH_NOT_FOUND");
+        }
+        return bath;
+    }
+
+    // Buffer of the calling Pistache thread, the responses are written into it.
+    // It keeps its capacity between requests, so that writing a response does not allocate.
+    static string& responseBuffer() {
+        static thread_local string buffer;
+        return buffer;
+    }
+
+    void sendJson(Http::ResponseWriter& response, Http::Code code, const JsonWriter& json) {
+        response.send(code, json.data(), json.size(), JSON_MIME);
+    }
+
+    void sendError(Http::ResponseWriter& response, Http::Code code, string_view error) {
+        JsonWriter json(responseBuffer());
+        json.beginObject().field("error", error).endObject();
+        sendJson(response, code, json);
+    }
+
+    void sendSuccess(Http::ResponseWriter& response) {
+        JsonWriter json(responseBuffer());
+        json.beginObject().field("success", true).endObject();
+        sendJson(response, Http::Code::Ok, json);
+    }
+
+    void getBaths(const Rest::Request& request, Http::ResponseWriter response) {
+        auto stats = registry.getStats();
+        JsonWriter json(responseBuffer());
+        json.beginObject().key("baths").beginArray();
+        for(auto& id : registry.getBathIds()) {
+            json.value(string_view(id));
+        }
+        json.endArray();
+        json.field("threads", (uint64_t)stats.threadCount);
+        json.field("threadsPerBath", stats.threadsPerBath);
+        json.field("totalMemory", (uint64_t)stats.totalMemory);
+        json.field("memoryPerBath", stats.memoryPerBath);
+        tickStatsToJson(json.key("ticks"), stats.ticks);
+        publisherStatsToJson(json.key("publisher"), stats.publisher);
+        journalStatsToJson(json.key("journal"), stats.journal);
+        archiveStatsToJson(json.key("archive"), stats.archive);
+        json.endObject();
+        sendJson(response, Http::Code::Ok, json);
+    }
+
+    // Counters and histograms of the process, in the Prometheus text format
+    void getMetrics(const Rest::Request& request, Http::ResponseWriter response) {
+        string& buffer = responseBuffer();
+        buffer.clear();
+        MetricsRegistry::global().writePrometheus(buffer);
+        response.headers().addRaw(Http::Header::Raw("Content-Type", "text/plain; version=0.0.4"));
+        response.send(Http::Code::Ok, buffer.data(), buffer.size());
+    }
+
+    // Events recorded by the threads, in the Chrome trace_event format
+    void getTrace(const Rest::Request& request, Http::ResponseWriter response) {
+        string& buffer = responseBuffer();
+        writeChromeTrace(buffer);
+        response.send(Http::Code::Ok, buffer.data(), buffer.size(), JSON_MIME);
+    }
+
+    void toggleTracing(const Rest::Request& request, Http::ResponseWriter response) {
+        string on = request.param(":on").as<std::string>();
+        bool onBool;
+        if(on == "on") {
+            onBool = true;
+        } else if(on == "off") {
+            onBool = false;
+        } else {
+            response.send(Http::Code::Bad_Request);
+            return;
+        }
+        setTracing(onBool);
+        JsonWriter json(responseBuffer());
+        json.beginObject().field("tracing", onBool).endObject();
+        sendJson(response, Http::Code::Ok, json);
+    }
+
+    void addBath(const Rest::Request& request, Http::ResponseWriter response) {
+        string id = request.param(":id").as<std::string>();
+        auto model = request.query().get("model");
+        try {
+            if(model) {
+                registry.addBath(id, *model);
+            } else {
+                registry.addBath(id);
+            }
+            sendSuccess(response);
+        } catch(runtime_error err) {
+            sendError(response, Http::Code::Bad_Request, err.what());
+        }
+    }
+
+    void removeBath(const Rest::Request& request, Http::ResponseWriter response) {
+        string id = request.param(":id").as<std::string>();
+        try {
+            registry.removeBath(id);
+            sendSuccess(response);
+        } catch(runtime_error err) {
+            sendError(response, Http::Code::Not_Found, err.what());
+        }
+    }
+
+    // Get the limits of the device models that can be hosted
+    void getModels(const Rest::Request& request, Http::ResponseWriter response) {
+        JsonWriter json(responseBuffer());
+        json.beginObject().key("models").beginArray();
+        for(auto& model : BathRegistry::getModels()) {
+            deviceTraitsToJson(json, model);
+        }
+        json.endArray().endObject();
+        sendJson(response, Http::Code::Ok, json);
+    }
+
+    // Get the device model of the bath
+    void getModel(const Rest::Request& request, Http::ResponseWriter response) {
+        auto bath = getBath(request, response);
+        if(!bath) return;
+        JsonWriter json(responseBuffer());
+        deviceTraitsToJson(json, bath->getModel());
+        sendJson(response, Http::Code::Ok, json);
+    }
+
+    // Get how many messages were received on each MQTT topic and how long their handlers took
+    void getTopics(const Rest::Request& request, Http::ResponseWriter response) {
+        auto stats = registry.getTopicStats();
+        JsonWriter json(responseBuffer());
+        json.beginObject().key("topics").beginArray();
+        for(auto& topic : stats) {
+            topicStatsToJson(json, topic);
+        }
+        json.endArray();
+        json.field("unmatched", registry.getUnmatchedMessages());
+        json.endObject();
+        sendJson(response, Http::Code::Ok, json);
+    }
+
+    // Get how late the interval checks of the bath ran
+    void getTickStats(const Rest::Request& request, Http::ResponseWriter response) {
+        auto bath = getBath(request, response);
+        if(!bath) return;
+        try {
+            auto stats = registry.getTickStats(bath->getId());
+            JsonWriter json(responseBuffer());
+            tickStatsToJson(json, stats);
+            sendJson(response, Http::Code::Ok, json);
+        } catch(runtime_error err) {
+            sendError(response, Http::Code::Not_Found, err.what());
+        }
+    }
+
+    // Get how many metric values were sent and suppressed
+    void getTelemetry(const Rest::Request& request, Http::ResponseWriter response) {
+        auto bath = getBath(request, response);
+        if(!bath) return;
+        auto counters = bath->getTelemetryCounters();
+        JsonWriter json(responseBuffer());
+        json.beginObject();
+        for(auto& metric : counters) {
+            telemetryCountersToJson(json.key(metric.first), metric.second);
+        }
+        json.endObject();
+        sendJson(response, Http::Code::Ok, json);
+    }
+
+    void setTelemetryDeadband(const Rest::Request& request, Http::ResponseWriter response) {
+        auto bath = getBath(request, response);
+        if(!bath) return;
+        string name;
+        Deadband deadband;
+        try {
+            name = request.param(":name").as<std::string>();
+            deadband.absolute = stod(request.param(":absolute").as<std::string>());
+            deadband.relative = stod(request.param(":relative").as<std::string>());
+            deadband.heartbeat = stod(request.param(":heartbeat").as<std::string>());
+        } catch(...) {
+            response.send(Http::Code::Bad_Request);
+            return;
+        }
+        try {
+            bath->setTelemetryDeadband(name, deadband);
+            sendSuccess(response);
+        } catch(runtime_error err) {
+            sendError(response, Http::Code::Bad_Request, err.what());
+        }
+    }
+
+    // Overshoot of the shut-offs at the fill target and at the capacity, in each fill mode
+    void getFillStats(const Rest::Request& request, Http::ResponseWriter response) {
+        auto bath = getBath(request, response);
+        if(!bath) return;
+        JsonWriter json(responseBuffer());
+        json.beginObject().field("mode", bath->getFillMode() == FillMode::Polling ? "polling" : "deadline");
+        fillStatsToJson(json.key("polling"), bath->getFillStats(FillMode::Polling));
+        fillStatsToJson(json.key("deadline"), bath->getFillStats(FillMode::Deadline));
+        json.endObject();
+        sendJson(response, Http::Code::Ok, json);
+    }
+
+    // polling or deadline
+    void setFillMode(const Rest::Request& request, Http::ResponseWriter response) {
+        auto bath = getBath(request, response);
+        if(!bath) return;
+        auto mode = request.param(":mode").as<std::string>();
+        if(mode == "polling") {
+            bath->setFillMode(FillMode::Polling);
+        } else if(mode == "deadline") {
+            bath->setFillMode(FillMode::Deadline);
+        } else {
+            response.send(Http::Code::Bad_Request);
+            return;
+        }
+        sendSuccess(response);
+    }
+
+    // Get the step of the physics, the water in the bathtub and the flow
+    void getPhysics(const Rest::Request& request, Http::ResponseWriter response) {
+        auto bath = getBath(request, response);
+        if(!bath) return;
+        JsonWriter json(responseBuffer());
+        physicsStatsToJson(json, bath->getPhysicsStats());
+        sendJson(response, Http::Code::Ok, json);
+    }
+
+    // Length of a physics step in milliseconds
+    void setPhysicsStep(const Rest::Request& request, Http::ResponseWriter response) {
+        auto bath = getBath(request, response);
+        if(!bath) return;
+        int64_t step;
+        try {
+            step = stoll(request.param(":ms").as<std::string>());
+        } catch(...) {
+            response.send(Http::Code::Bad_Request);
+            return;
+        }
+        try {
+            bath->setPhysicsStep(step);
+            sendSuccess(response);
+        } catch(runtime_error err) {
+            sendError(response, Http::Code::Bad_Request, err.what());
+        }
+    }
+
+    // Rolling statistics, anomalies and drift of the water quality parameters
+    void getWaterQualityStats(const Rest::Request& request, Http::ResponseWriter response) {
+        auto bath = getBath(request, response);
+        if(!bath) return;
+        auto stats = bath->getWaterQualityStats();
+        JsonWriter json(responseBuffer());
+        waterQualityStatsToJson(json, stats);
+        sendJson(response, Http::Code::Ok, json);
+    }
+
+    // Samples out of range before the pipes are shut off, samples back in range before the water is safe again,
+    // and the hysteresis as a fraction of the range width
+    void setWaterDebounce(const Rest::Request& request, Http::ResponseWriter response) {
+        auto bath = getBath(request, response);
+        if(!bath) return;
+        WaterDebounce debounce;
+        try {
+            int shutoff = stoi(request.param(":shutoff").as<std::string>());
+            int resume = stoi(request.param(":resume").as<std::string>());
+            debounce.hysteresis = stod(request.param(":hysteresis").as<std::string>());
+            if(shutoff < 0 || resume < 0) {
+                throw std::invalid_argument("negative");
+            }
+            debounce.shutoffSamples = shutoff;
+            debounce.resumeSamples = resume;
+        } catch(...) {
+            response.send(Http::Code::Bad_Request);
+            return;
+        }
+        try {
+            bath->setWaterDebounce(debounce);
+            sendSuccess(response);
+        } catch(runtime_error err) {
+            sendError(response, Http::Code::Bad_Request, err.what());
+        }
+    }
+
+    // Get the pipe state
+    void getPipeState(const Rest::Request& request, Http::ResponseWriter response) {
+        auto bath = getBath(request, response);
+        if(!bath) return;
+        // The state is read from the last published snapshot, so the bath is not locked
+        auto pipe = request.param(":pipe").as<std::string>();
+
+        PipeState state;
+        if(pipe == "bath") {
+            state = bath->getBathState();
+        }
+        else if(pipe == "shower") {
+            state = bath->getShowerState();
+        }
+        else {
+            // Return error if pipe is not known
+            sendError(response, Http::Code::Bad_Request, "UNKNOWN_PIPE");
+            return;
+        }
+
+        // Response to be sent
+        JsonWriter json(responseBuffer());
+        pipeStateToJson(json, state);
+        sendJson(response, Http::Code::Ok, json);
+    }
+
+    void setPipeStateOn(const Rest::Request& request, Http::ResponseWriter response) {
+        auto bath = getBath(request, response);
+        if(!bath) return;
+        string pipe = request.param(":pipe").as<std::string>();
+        if(!(pipe == "bath" || pipe == "shower")) {
+            // Return error if pipe is not known
+            sendError(response, Http::Code::Bad_Request, "UNKNOWN_PIPE");
+            return;
+        }
+
+        double temperature, debit;
+
+        // Try get temperature
+        try {
+            temperature = request.param(":temperature").as<double>();
+        } catch(std::runtime_error err) {
+            auto errorWhat = err.what();
+            if(strcmp(errorWhat, "Unknown parameter") == 0) { // If temperature is not set, set a default temperature
+                temperature = bath->getDefaultTemperature();
+            } else { // If there is another error, send Bad Request response
+                sendError(response, Http::Code::Bad_Request, "BAD_TEMPERATURE_FORMAT");
+                return;
+            }
+        }
+
+        // Try get debit
+        try {
+            debit = request.param(":debit").as<double>();
+        } catch(std::runtime_error err) {
+            auto errorWhat = err.what();
+            if(strcmp(errorWhat, "Unknown parameter") == 0) { // If debit is not set, set a default debit
+                debit = 0.2;
+            } else { // If there is another error, send Bad Request response
+                sendError(response, Http::Code::Bad_Request, "BAD_DEBIT_FORMAT");
+                return;
+            }
+        }
+
+        // Everything is OK from now on
+        PipeState state = { .isOn = true, .temperature = temperature, .debit = debit };
+        try {
+            if(pipe == "bath") {
+                bath->setBathState(state);
+            }
+            else if(pipe == "shower") {
+                bath->setShowerState(state);
+            }
+        } catch(runtime_error err) {
+            sendError(response, Http::Code::Bad_Request, err.what());
+            return;
+        }
+
+        JsonWriter json(responseBuffer());
+        pipeStateToJson(json, state);
+        sendJson(response, Http::Code::Ok, json);
+    }
+
+    // Turn off the pipe
+    void setPipeStateOff(const Rest::Request& request, Http::ResponseWriter response) {
+        auto bath = getBath(request, response);
+        if(!bath) return;
+        string pipe = request.param(":pipe").as<std::string>();
+        PipeState state = { .isOn = false, .temperature = 0, .debit = 0 };
+        try {
+            if(pipe == "bath") {
+                bath->setBathState(state);
+            }
+            else if(pipe == "shower") {
+                bath->setShowerState(state);
+            }
+        } catch(runtime_error err) {
+            sendError(response, Http::Code::Bad_Request, err.what());
+            return;
+        }
+        
+        response.send(Http::Code::Ok);
+    }
+
+    void getCurrentVolume(const Rest::Request& request, Http::ResponseWriter response) {
+        auto bath = getBath(request, response);
+        if(!bath) return;
+        double volume = bath->getBathtubCurrentVolume();
+        JsonWriter json(responseBuffer());
+        json.beginObject().field("currentVolume", volume).endObject();
+        sendJson(response, Http::Code::Ok, json);
+    }
+
+    void toggleStopper(const Rest::Request& request, Http::ResponseWriter response) {
+        auto bath = getBath(request, response);
+        if(!bath) return;
+        string on = request.param(":on").as<std::string>();
+        bool onBool;
+        if(on == "on") {
+            onBool = true;
+        } else if(on == "off") {
+            onBool = false;
+        } else {
+            response.send(Http::Code::Bad_Request);
+            return;
+        }
+        bath->toggleStopper(onBool);
+        JsonWriter json(responseBuffer());
+        json.beginObject().field("stopper", (int)onBool).endObject();
+        sendJson(response, Http::Code::Ok, json);
+    }
+
+    void addProfile(const Rest::Request& request, Http::ResponseWriter response) {
+        auto bath = getBath(request, response);
+        if(!bath) return;
+        string name;
+        double weight, bathTemp, showerTemp;
+        try {
+            name = request.param(":name").as<std::string>();
+            weight = stod(request.param(":weight").as<std::string>());
+            bathTemp = stod(request.param(":bathTemp").as<std::string>());
+            showerTemp = stod(request.param(":showerTemp").as<std::string>());
+        } catch(...) {
+            response.send(Http::Code::Bad_Request);
+            return;
+        }
+        try {
+            UserProfile profile = {
+                .weight = weight,
+                .preferredBathTemperature = bathTemp,
+                .preferredShowerTemperature = showerTemp
+            };
+            bath->addProfile(name, profile);
+            JsonWriter json(responseBuffer());
+            profileToJson(json, profile);
+            sendJson(response, Http::Code::Ok, json);
+        } catch(runtime_error err) {
+            sendError(response, Http::Code::Bad_Request, err.what());
+        }
+    }
+
+    void editProfile(const Rest::Request& request, Http::ResponseWriter response) {
+        auto bath = getBath(request, response);
+        if(!bath) return;
+        string name;
+        double weight, bathTemp, showerTemp;
+        try {
+            name = request.param(":name").as<std::string>();
+            weight = stod(request.param(":weight").as<std::string>());
+            bathTemp = stod(request.param(":bathTemp").as<std::string>());
+            showerTemp = stod(request.param(":showerTemp").as<std::string>());
+        } catch(...) {
+            response.send(Http::Code::Bad_Request);
+            return;
+        }
+        try {
+            UserProfile profile = {
+                .weight = weight,
+                .preferredBathTemperature = bathTemp,
+                .preferredShowerTemperature = showerTemp
+            };
+            bath->editProfile(name, profile);
+            JsonWriter json(responseBuffer());
+            profileToJson(json, profile);
+            sendJson(response, Http::Code::Ok, json);
+        } catch(runtime_error err) {
+            sendError(response, Http::Code::Bad_Request, err.what());
+        }
+    }
+
+    void removeProfile(const Rest::Request& request, Http::ResponseWriter response) {
+        auto bath = getBath(request, response);
+        if(!bath) return;
+        string name = request.param(":name").as<std::string>();
+        try {
+            bath->removeProfile(name);
+            sendSuccess(response);
+        } catch(runtime_error err) {
+            sendError(response, Http::Code::Bad_Request, err.what());
+        }
+    }
+
+    void setProfile(const Rest::Request& request, Http::ResponseWriter response) {
+        auto bath = getBath(request, response);
+        if(!bath) return;
+        string name = request.param(":name").as<std::string>();
+        try {
+            bath->setProfile(name);
+            sendSuccess(response);
+        } catch(runtime_error err) {
+            sendError(response, Http::Code::Bad_Request, err.what());
+        }
+    }
+
+    void getProfile(const Rest::Request& request, Http::ResponseWriter response) {
+        auto bath = getBath(request, response);
+        if(!bath) return;
+        string name = request.param(":name").as<std::string>();
+        try {
+            auto profile = bath->getProfile(name);
+            JsonWriter json(responseBuffer());
+            profileToJson(json, profile);
+            sendJson(response, Http::Code::Ok, json);
+        } catch(runtime_error err) {
+            sendError(response, Http::Code::Bad_Request, err.what());
+        }
+    }
+
+    void getProfileSet(const Rest::Request& request, Http::ResponseWriter response) {
+        auto bath = getBath(request, response);
+        if(!bath) return;
+        auto profile = bath->getProfileSet();
+        if(profile == nullptr) {
+            response.send(Http::Code::Ok, "null", JSON_MIME);
+        } else {
+            JsonWriter json(responseBuffer());
+            profileToJson(json, *profile);
+            sendJson(response, Http::Code::Ok, json);
+        }
+    }
+
+    void prepareBathForProfile(const Rest::Request& request, Http::ResponseWriter response) {
+        auto bath = getBath(request, response);
+        if(!bath) return;
+        try {
+            int seconds = bath->prepareBath();
+            JsonWriter json(responseBuffer());
+            json.beginObject().field("readyAfter", seconds).endObject();
+            sendJson(response, Http::Code::Ok, json);
+        } catch(runtime_error err) {
+            sendError(response, Http::Code::Bad_Request, err.what());
+        }
+    }
+
+    void prepareBath(const Rest::Request& request, Http::ResponseWriter response) {
+        auto bath = getBath(request, response);
+        if(!bath) return;
+        double weight = request.param(":weight").as<double>();
+        double temperature;
+
+        // Try get temperature
+        try {
+            temperature = request.param(":temperature").as<double>();
+        } catch(std::runtime_error err) {
+            auto errorWhat = err.what();
+            if(strcmp(errorWhat, "Unknown parameter") == 0) { // If temperature is not set, set a default temperature
+                temperature = bath->getDefaultTemperature();
+            } else { // If there is another error, send Bad Request response
+                sendError(response, Http::Code::Bad_Request, "BAD_TEMPERATURE_FORMAT");
+                return;
+            }
+        }
+
+        try {
+            int seconds = bath->prepareBath(weight, temperature);
+            JsonWriter json(responseBuffer());
+            json.beginObject().field("readyAfter", seconds).endObject();
+            sendJson(response, Http::Code::Ok, json);
+        } catch(runtime_error err) {
+            sendError(response, Http::Code::Bad_Request, err.what());
+        }
+    }
+
+    void cancelBathPreparation(const Rest::Request& request, Http::ResponseWriter response) {
+        auto bath = getBath(request, response);
+        if(!bath) return;
+        try {
+            bath->cancelBathPreparation();
+            sendSuccess(response);
+        } catch(runtime_error err) {
+            sendError(response, Http::Code::Bad_Request, err.what());
+        }
+    }
+    void toggleSaltPump(const Rest::Request& request, Http::ResponseWriter response) {
+        auto bath = getBath(request, response);
+        if(!bath) return;
+        string on = request.param(":on").as<std::string>();
+        bool onBool;
+        if(on == "on") {
+            onBool = true;
+        } else if(on == "off") {
+            onBool = false;
+        } else {
+            response.send(Http::Code::Bad_Request);
+            return;
+        }
+        try {
+            bath->toggleSaltPump(onBool);
+            JsonWriter json(responseBuffer());
+            json.beginObject().field("saltPump", (int)onBool).endObject();
+            sendJson(response, Http::Code::Ok, json);
+        } catch (runtime_error err) {
+            sendError(response, Http::Code::Bad_Request, err.what());
+        }
+    }
+
+    // Apply several operations in one request. The body is an array of route paths,
+    // e.g. ["stopper/on", "bath/on/0.2/38", "salt/on"]. Either all of them are applied or none.
+    void applyBatch(const Rest::Request& request, Http::ResponseWriter response) {
+        auto bath = getBath(request, response);
+        if(!bath) return;
+        vector<string_view> paths;
+        if(!parseStringArray(request.body(), paths)) {
+            sendError(response, Http::Code::Bad_Request, "BAD_BATCH_FORMAT");
+            return;
+        }
+        vector<BatchOperation> operations(paths.size());
+        for(size_t i = 0; i < paths.size(); i++) {
+            if(!parseBatchOperation(paths[i], operations[i])) {
+                JsonWriter json(responseBuffer());
+                json.beginObject().field("error", "BAD_OPERATION").field("operation", (uint64_t)i).endObject();
+                sendJson(response, Http::Code::Bad_Request, json);
+                return;
+            }
+        }
+
+        // The bath applies the whole batch under its own lock
+        vector<BatchResult> results;
+        bool committed = bath->applyBatch(operations, results);
+        JsonWriter json(responseBuffer());
+        json.beginObject().field("committed", committed).key("results").beginArray();
+        for(auto& result : results) {
+            json.beginObject().field("success", result.error.empty());
+            if(!result.error.empty()) {
+                json.field("error", string_view(result.error));
+            }
+            if(result.readyAfter >= 0) {
+                json.field("readyAfter", result.readyAfter);
+            }
+            json.endObject();
+        }
+        json.endArray().endObject();
+        sendJson(response, committed ? Http::Code::Ok : Http::Code::Bad_Request, json);
+    }
+
+    // Long-poll the state changes of the bath published after the :since version.
+    // Without :since, the current version is returned at once, to use as the first cursor.
+    // The request waits up to :timeout seconds (25 by default, at most 60) for an event.
+    void pollEvents(const Rest::Request& request, Http::ResponseWriter response) {
+        auto bath = getBath(request, response);
+        if(!bath) return;
+        uint64_t since = EventStream::CURRENT_VERSION;
+        double timeout = 25;
+        try {
+            if(request.hasParam(":since")) {
+                since = request.param(":since").as<uint64_t>();
+            }
+            if(request.hasParam(":timeout")) {
+                timeout = request.param(":timeout").as<double>();
+            }
+        } catch(...) {
+            response.send(Http::Code::Bad_Request);
+            return;
+        }
+        timeout = std::min(std::max(timeout, 0.0), 60.0);
+
+        // The writer outlives the handler, it is answered by the thread that publishes the next event.
+        // The bath is not captured, so that removing it answers the waiting requests.
+        auto writer = make_shared<Http::ResponseWriter>(std::move(response));
+        auto mime = JSON_MIME;
+        bath->pollEvents(since, chrono::milliseconds((int64_t)(timeout * 1000)), [writer, mime](int status, const string& body) {
+            writer->send(static_cast<Http::Code>(status), body.data(), body.size(), mime);
+        });
+    }
+
+    // Min/max/avg of a metric, answered from its rollups.
+    // Query parameters: from and to in unix seconds (the last hour by default), step in seconds (60 by default).
+    void getHistory(const Rest::Request& request, Http::ResponseWriter response) {
+        auto bath = getBath(request, response);
+        if(!bath) return;
+        HistoryMetric metric;
+        if(!History::parseMetric(request.param(":metric").as<std::string>(), metric)) {
+            sendError(response, Http::Code::Not_Found, "UNKNOWN_METRIC");
+            return;
+        }
+        auto query = request.query();
+        int64_t to, from, step;
+        try {
+            auto toParam = query.get("to");
+            auto fromParam = query.get("from");
+            auto stepParam = query.get("step");
+            to = toParam ? stoll(*toParam) : chrono::duration_cast<chrono::seconds>(
+                chrono::system_clock::now().time_since_epoch()).count();
+            from = fromParam ? stoll(*fromParam) : to - 3600;
+            step = stepParam ? stoll(*stepParam) : 60;
+        } catch(...) {
+            response.send(Http::Code::Bad_Request);
+            return;
+        }
+        // Reused by the requests of the thread, like the response buffer
+        static thread_local HistoryQuery result;
+        try {
+            bath->getHistory(metric, from, to, step, result);
+        } catch(runtime_error err) {
+            sendError(response, Http::Code::Bad_Request, err.what());
+            return;
+        }
+        JsonWriter json(responseBuffer());
+        json.beginObject()
+            .field("metric", History::metricName(metric))
+            .field("from", from)
+            .field("to", to)
+            .field("step", step)
+            .field("resolution", result.resolution)
+            .key("points").beginArray();
+        for(auto& point : result.points) {
+            historyPointToJson(json, point);
+        }
+        json.endArray().endObject();
+        sendJson(response, Http::Code::Ok, json);
+    }
+
+    // Archived values of a column, as [time, value] pairs.
+    // Query parameters: from and to in unix milliseconds (the last hour by default), limit (ARCHIVE_MAX_POINTS at most).
+    // When the limit is reached, next is the from of the following request.
+    void scanArchive(const Rest::Request& request, Http::ResponseWriter response) {
+        auto bath = getBath(request, response);
+        if(!bath) return;
+        ArchiveColumn column;
+        if(!Archive::parseColumn(request.param(":column").as<std::string>(), column)) {
+            sendError(response, Http::Code::Not_Found, "UNKNOWN_COLUMN");
+            return;
+        }
+        auto query = request.query();
+        int64_t to, from, limit;
+        try {
+            auto toParam = query.get("to");
+            auto fromParam = query.get("from");
+            auto limitParam = query.get("limit");
+            to = toParam ? stoll(*toParam) : chrono::duration_cast<chrono::milliseconds>(
+                chrono::system_clock::now().time_since_epoch()).count();
+            from = fromParam ? stoll(*fromParam) : to - 3600 * 1000;
+            limit = limitParam ? stoll(*limitParam) : ARCHIVE_MAX_POINTS;
+        } catch(...) {
+            response.send(Http::Code::Bad_Request);
+            return;
+        }
+        if(to <= from || limit <= 0 || limit > ARCHIVE_MAX_POINTS) {
+            sendError(response, Http::Code::Bad_Request, "INVALID_RANGE");
+            return;
+        }
+        JsonWriter json(responseBuffer());
+        json.beginObject()
+            .field("column", Archive::columnName(column))
+            .field("from", from)
+            .field("to", to)
+            .key("points").beginArray();
+        int64_t count = 0, next = -1;
+        bath->scanArchive(column, from, to, [&](int64_t time, double value) {
+            if(count == limit) {
+                next = time;
+                return false;
+            }
+            json.beginArray().value(time).value(value).endArray();
+            count++;
+            return true;
+        });
+        json.endArray();
+        if(next >= 0) {
+            json.field("next", next);
+        }
+        json.endObject();
+        sendJson(response, Http::Code::Ok, json);
+    }
+
+    // Registry hosting all the baths of the process
+    BathRegistry registry;
+
+    // Defining the httpEndpoint and a router.
+    std::shared_ptr<Http::Endpoint> httpEndpoint;
+    Rest::Router router;
+};
@@ -0,0 +1,74 @@
+#pragma once
+#include "BathPhysics.hpp"
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+using namespace std;
+
+// Advances the water by one step with the given per-step terms
+static inline void stepWater(double& volume, double& temperature, double inflow, double heat, double drain,
+    double cooling) {
+    double mixed = volume + inflow;
+    // The inflow mixes with the water in the tub, an empty tub keeps its temperature. The drain does not change it.
+    double mixedTemperature = (volume * temperature + heat) / (mixed > 0 ? mixed : 1.0);
+    temperature = mixed > 0 ? mixedTemperature : temperature;
+    volume = max(mixed - drain, 0.0);
+    temperature = PHYSICS_ROOM_TEMPERATURE + (temperature - PHYSICS_ROOM_TEMPERATURE) * cooling;
+}
+
+BathPhysics::BathPhysics(int64_t stepMs) {
+    setStep(stepMs);
+}
+
+void BathPhysics::setStep(int64_t stepMs) {
+    if(stepMs < PHYSICS_MIN_STEP_MS || 1000 % stepMs != 0) {
+        throw std::runtime_error("INVALID_STEP");
+    }
+    this->stepMs = stepMs;
+    step = stepMs / 1000.0;
+    updateSteps();
+}
+
+int64_t BathPhysics::getStep() const {
+    return stepMs;
+}
+
+void BathPhysics::setFlow(WaterFlow flow) {
+    this->flow = flow;
+    updateSteps();
+}
+
+const WaterFlow& BathPhysics::getFlow() const {
+    return flow;
+}
+
+void BathPhysics::updateSteps() {
+    inflowStep = flow.inflow * step;
+    heatStep = inflowStep * flow.inflowTemperature;
+    drainStep = flow.drain * step;
+    cooling = exp(-PHYSICS_COOLING_RATE * step);
+}
+
+bool BathPhysics::advance(WaterState& state, double& seconds, double limit) const {
+    // Rounding errors of seconds must not add a step
+    int64_t steps = (int64_t)(seconds / step + 1e-9);
+    double volume = state.volume, temperature = state.temperature;
+    bool filling = inflowStep > 0;
+    for(int64_t i = 0; i < steps; i++) {
+        stepWater(volume, temperature, inflowStep, heatStep, drainStep, cooling);
+        if(filling && volume >= limit) {
+            state = { volume, temperature };
+            seconds = max(seconds - (i + 1) * step, 0.0);
+            return true;
+        }
+    }
+    double remainder = seconds - steps * step;
+    if(remainder > 1e-9) {
+        double fraction = remainder / step;
+        stepWater(volume, temperature, inflowStep * fraction, heatStep * fraction, drainStep * fraction,
+            exp(-PHYSICS_COOLING_RATE * remainder));
+    }
+    state = { volume, temperature };
+    seconds = 0;
+    return false;
+}
@@ -0,0 +1,244 @@
+#include "BathRegistry.hpp"
+#include "MqttTransport.cpp"
+#include "SmartBath.cpp"
+#include "TickScheduler.cpp"
+#include "TopicDispatcher.cpp"
+using namespace std;
+
+
+BathRegistry::BathRegistry(size_t tickWorkers) : BathRegistry(makeTransport(SERVER_ADDRESS, CLIENT_ID, true),
+    makeTransport(SERVER_ADDRESS, CLIENT_ID + "-publisher", false), tickWorkers) {}
+
+BathRegistry::BathRegistry(unique_ptr<MqttTransport> receiver, unique_ptr<MqttTransport> sender, size_t tickWorkers)
+    : receiver(std::move(receiver)), publisher(std::move(sender)), scheduler(tickWorkers) {
+    addHandlers();
+    mqttThread = std::thread(listenForDevices, this);
+}
+
+BathRegistry::~BathRegistry() {
+    // Stop the threads before destroying the baths. The flag is set first, so that
+    // listenForDevices stops if it subscribes after the command was sent.
+    stopRequested = true;
+    sendStopCommand();
+    scheduler.stop();
+    mqttThread.join();
+    publisher.stop();
+    // Destroying the baths waits for their last profile changes and archive segments, so the writers are stopped after
+    baths.clear();
+    journalWriter.stop();
+    archiveWriter.stop();
+}
+
+void BathRegistry::addHandlers() {
+    // Bath topics are prefixed with the device ID, so they are registered with a single level wildcard
+    addBathHandler("temperature", &SmartBath::handleTemperature);
+    addBathHandler("waterQuality", &SmartBath::handleWaterQuality);
+    addBathHandler("salt", &SmartBath::handleSalt);
+    addBathHandler("display", &SmartBath::handleDisplay);
+    addBathHandler("temperature/bin", &SmartBath::handleTemperatureBinary);
+    addBathHandler("waterQuality/bin", &SmartBath::handleWaterQualityBinary);
+    addBathHandler("salt/bin", &SmartBath::handleSaltBinary);
+    // The command topic is not prefixed: a stop ends the MQTT thread of the registry, so it concerns all the baths.
+    // The destructor sends it to wake up listenForDevices.
+    dispatcher.addHandler("command", 1, [this](string_view, string_view payload) {
+        if(payload == "stop") {
+            stopRequested = true;
+        }
+        return true;
+    });
+}
+
+void BathRegistry::addBathHandler(string topic, bool (SmartBath::*handler)(string_view)) {
+    dispatcher.addHandler("+/" + topic, 0, [this, handler](string_view device, string_view payload) {
+        auto bath = getBath(string(device));
+        if(!bath) {
+            return false;
+        }
+        return (bath.get()->*handler)(payload);
+    });
+}
+
+int BathRegistry::listenForDevices(BathRegistry* registry) {
+    const vector<string> TOPICS = registry->dispatcher.getTopics();
+    const vector<int> QOS = registry->dispatcher.getQos();
+
+    MqttTransport& transport = *registry->receiver;
+    setTraceThreadName("mqtt");
+    try {
+        cout << "Connecting to the MQTT server... " << flush;
+        transport.connect();
+        cout << "OK\n";
+
+        std::cout << "Subscribing to topics... " << std::flush;
+        transport.subscribe(TOPICS, QOS);
+        std::cout << "OK\n";
+
+        Histogram& lag = MetricsRegistry::global().histogram("smartbath_mqtt_consume_lag_seconds",
+            "Time the received messages waited before being dispatched (loopback broker only)");
+        string topic, payload;
+        while(!registry->stopRequested && transport.consume(topic, payload)) {
+            if(uint64_t arrival = transport.lastArrival()) {
+                lag.record(metricsNow() - arrival);
+            }
+            bool messageRecognized;
+            {
+                TraceSpan span("mqtt", "dispatch", topic);
+                messageRecognized = registry->dispatcher.dispatch(topic, payload);
+            }
+            if(messageRecognized) {
+                // Binary payloads are not printable
+                if(topic.size() > 4 && topic.compare(topic.size() - 4, 4, "/bin") == 0) {
+                    cout << "[Received] " << topic << ": " << payload.size() << " bytes" << endl;
+                } else {
+                    cout << "[Received] " << topic << ": " << payload << endl;
+                }
+            }
+        }
+
+        transport.disconnect();
+        return 0;
+    } catch(const runtime_error& exc) {
+        cerr << "\n  " << exc.what() << endl;
+        return 1;
+    }
+}
+
+void BathRegistry::sendStopCommand() {
+    receiver->publish("command", "stop", 1);
+}
+
+vector<shared_ptr<SmartBath>> BathRegistry::getBaths() {
+    shared_lock<shared_mutex> lock(bathsMutex);
+    vector<shared_ptr<SmartBath>> result;
+    result.reserve(baths.size());
+    for(auto itr = baths.begin(); itr != baths.end(); ++itr) {
+        result.push_back(itr->second.bath);
+    }
+    return result;
+}
+
+template<typename Model>
+shared_ptr<SmartBath> BathRegistry::addBath(string id) {
+    // The ID is used as a MQTT topic level, so it can't contain separators or wildcards
+    if(id.empty() || id.find_first_of("/+#") != string::npos) {
+        throw std::runtime_error("INVALID_BATH_ID");
+    }
+    unique_lock<shared_mutex> lock(bathsMutex);
+    if(baths.find(id) != baths.end()) {
+        throw std::runtime_error("BATH_ALREADY_EXISTS");
+    }
+    auto bath = make_shared<BasicBath<Model>>(id, &publisher, &journalWriter, &archiveWriter, &scheduler);
+    // The task only keeps a weak reference, so that removing the bath destroys it.
+    // It is a reference to the BasicBath, which is final, so that the interval check is not a virtual call.
+    weak_ptr<BasicBath<Model>> weakBath = bath;
+    uint64_t tickTask = scheduler.schedule([weakBath] {
+        auto bath = weakBath.lock();
+        if(bath) {
+            bath->intervalCheck();
+        }
+    }, chrono::seconds(1));
+    baths.insert({ id, { .bath = bath, .tickTask = tickTask } });
+    return bath;
+}
+
+// Models that can be hosted, and the addBath of each
+typedef struct HostedModel {
+    DeviceTraits traits;
+    shared_ptr<SmartBath> (BathRegistry::*addBath)(string id);
+} HostedModel;
+
+static const HostedModel HOSTED_MODELS[] = {
+    { deviceTraits<Model300L>(), &BathRegistry::addBath<Model300L> },
+    { deviceTraits<Model180L>(), &BathRegistry::addBath<Model180L> },
+};
+
+shared_ptr<SmartBath> BathRegistry::addBath(string id, string_view model) {
+    for(auto& hosted : HOSTED_MODELS) {
+        if(model == hosted.traits.name) {
+            return (this->*hosted.addBath)(id);
+        }
+    }
+    throw std::runtime_error("UNKNOWN_MODEL");
+}
+
+vector<DeviceTraits> BathRegistry::getModels() {
+    vector<DeviceTraits> models;
+    for(auto& hosted : HOSTED_MODELS) {
+        models.push_back(hosted.traits);
+    }
+    return models;
+}
+
+void BathRegistry::removeBath(string id) {
+    shared_ptr<SmartBath> removed;
+    {
+        unique_lock<shared_mutex> lock(bathsMutex);
+        auto it = baths.find(id);
+        if(it == baths.end()) {
+            throw std::runtime_error("BATH_NOT_FOUND");
+        }
+        scheduler.cancel(it->second.tickTask);
+        removed = std::move(it->second.bath);
+        baths.erase(it);
+    }
+    // Destroying the bath waits for its journal and archive to reach the disk, so the lookups must not wait for it
+    removed.reset();
+}
+
+shared_ptr<SmartBath> BathRegistry::getBath(const string& id) {
+    shared_lock<shared_mutex> lock(bathsMutex);
+    auto it = baths.find(id);
+    if(it == baths.end()) {
+        return nullptr;
+    }
+    return it->second.bath;
+}
+
+vector<string> BathRegistry::getBathIds() {
+    shared_lock<shared_mutex> lock(bathsMutex);
+    vector<string> result;
+    result.reserve(baths.size());
+    for(auto itr = baths.begin(); itr != baths.end(); ++itr) {
+        result.push_back(itr->first);
+    }
+    return result;
+}
+
+TickStats BathRegistry::getTickStats(const string& id) {
+    shared_lock<shared_mutex> lock(bathsMutex);
+    auto it = baths.find(id);
+    if(it == baths.end()) {
+        throw std::runtime_error("BATH_NOT_FOUND");
+    }
+    return scheduler.getStats(it->second.tickTask);
+}
+
+RegistryStats BathRegistry::getStats() {
+    auto hosted = getBaths();
+    RegistryStats stats;
+    stats.bathCount = hosted.size();
+    // Scheduler threads, mqttThread, the publisher, the journal writer and the archive writer threads,
+    // no matter how many baths are hosted
+    stats.threadCount = scheduler.getThreadCount() + 4;
+    stats.totalMemory = sizeof(BathRegistry);
+    for(auto& bath : hosted) {
+        // The map node and the shared_ptr control block are counted together with the bath
+        stats.totalMemory += bath->memoryUsage() + bath->getId().capacity()
+            + sizeof(pair<const string, HostedBath>) + 2 * sizeof(void*);
+    }
+    stats.threadsPerBath = stats.bathCount ? (double)stats.threadCount / stats.bathCount : 0;
+    stats.memoryPerBath = stats.bathCount ? (double)stats.totalMemory / stats.bathCount : 0;
+    stats.ticks = scheduler.getStats();
+    stats.publisher = publisher.getStats();
+    stats.journal = journalWriter.getStats();
+    stats.archive = archiveWriter.getStats();
+    return stats;
+}
+
+vector<TopicStats> BathRegistry::getTopicStats() {
+    return dispatcher.getStats();
+}
+
+uint64_t BathRegistry::getUnmatchedMessages() {
+    return dispatcher.getUnmatched();
+}
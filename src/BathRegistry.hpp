@@ -0,0 +1,115 @@
+#pragma once
+#include <atomic>
+#include <memory>
+#include <shared_mutex>
+#include <unordered_map>
+#include <vector>
+#include "MqttTransport.hpp"
+#include "SmartBath.hpp"
+#include "TickScheduler.hpp"
+#include "TopicDispatcher.hpp"
+using namespace std;
+
+// Device ID of the bath that is served by the routes without the /baths/:id prefix
+#ifndef DEFAULT_BATH_ID
+#define DEFAULT_BATH_ID MQTT_CLIENT_ID
+#endif
+
+// Statistics about the baths hosted by the registry
+typedef struct RegistryStats {
+    size_t bathCount;
+    // Threads owned by the registry (shared by all the baths)
+    size_t threadCount;
+    double threadsPerBath;
+    size_t totalMemory;
+    double memoryPerBath;
+    // Lateness of the interval checks of all the baths
+    TickStats ticks;
+    PublisherStats publisher;
+    JournalStats journal;
+    ArchiveStats archive;
+} RegistryStats;
+
+// A bath and the ID of its interval check in the scheduler
+typedef struct HostedBath {
+    shared_ptr<SmartBath> bath;
+    uint64_t tickTask;
+} HostedBath;
+
+// Hosts all the baths of the process, keyed by device ID.
+// All the baths share one MQTT client, one publisher, one journal writer and one archive writer, and their interval checks run on the workers of one scheduler.
+class BathRegistry {
+private:
+    unordered_map<string, HostedBath> baths;
+    // Protects the baths map. Lookups take it shared, add/remove take it exclusive.
+    shared_mutex bathsMutex;
+
+    // Receives the messages of all the baths
+    unique_ptr<MqttTransport> receiver;
+    // Publishes the messages of all the baths
+    MqttPublisher publisher;
+    // Writes the profile journals of all the baths
+    JournalWriter journalWriter;
+    // Writes the telemetry archives of all the baths
+    ArchiveWriter archiveWriter;
+
+    // Runs the interval check of every bath each second
+    TickScheduler scheduler;
+    // Routes the received messages to the handlers of their topic
+    TopicDispatcher dispatcher;
+    // Thread that runs the listenForDevices function
+    std::thread mqttThread;
+    // Set by the destructor and the stop command, to end listenForDevices
+    atomic<bool> stopRequested { false };
+
+    // Registers the handlers of the bath topics and of the command topic
+    void addHandlers();
+    // Registers a handler that routes <id>/<topic> messages to the bath with that ID
+    void addBathHandler(string topic, bool (SmartBath::*handler)(string_view));
+    // Threaded function that receives the MQTT messages and dispatches them
+    static int listenForDevices(BathRegistry* registry);
+    void sendStopCommand();
+
+    // Snapshot of the hosted baths, so that they can be used without holding the map lock
+    vector<shared_ptr<SmartBath>> getBaths();
+public:
+    // Connects to the broker at SERVER_ADDRESS
+    BathRegistry(size_t tickWorkers = 2);
+    // receiver gets the messages of the baths, sender publishes theirs
+    BathRegistry(unique_ptr<MqttTransport> receiver, unique_ptr<MqttTransport> sender, size_t tickWorkers = 2);
+    ~BathRegistry();
+
+    /**
+     * Creates a new bath of the device model with the given device ID.
+     * Throws runtime_error if the ID is invalid or already used.
+    */
+    template<typename Model = DefaultModel>
+    shared_ptr<SmartBath> addBath(string id);
+
+    // Same as above, with the name of the model. Throws runtime_error if the model is unknown.
+    shared_ptr<SmartBath> addBath(string id, string_view model);
+
+    // Limits of the models that can be hosted
+    static vector<DeviceTraits> getModels();
+
+    /**
+     * Removes the bath with the given device ID.
+     * Throws runtime_error if the bath does not exist.
+    */
+    void removeBath(string id);
+
+    // Returns nullptr if there is no bath with the given device ID.
+    shared_ptr<SmartBath> getBath(const string& id);
+
+    vector<string> getBathIds();
+
+    // Lateness of the interval checks of the bath. Throws runtime_error if the bath does not exist.
+    TickStats getTickStats(const string& id);
+
+    RegistryStats getStats();
+
+    // Messages received and handler latency per topic
+    vector<TopicStats> getTopicStats();
+    // Messages received on topics with no handler
+    uint64_t getUnmatchedMessages();
+};
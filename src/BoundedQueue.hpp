@@ -0,0 +1,97 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+using namespace std;
+
+// Fixed capacity lock-free queue for many producers and many consumers (Vyukov's bounded queue).
+// Each cell carries a sequence number telling whether it is ready to be written or read,
+// so producers and consumers only contend on their own position counter.
+template<typename T>
+class BoundedQueue {
+private:
+    struct Cell {
+        atomic<size_t> sequence;
+        T value;
+    };
+
+    unique_ptr<Cell[]> buffer;
+    const size_t mask;
+    // Kept on separate cache lines, so that producers and consumers don't invalidate each other
+    alignas(64) atomic<size_t> enqueuePos { 0 };
+    alignas(64) atomic<size_t> dequeuePos { 0 };
+public:
+    // The capacity is rounded up to a power of two.
+    explicit BoundedQueue(size_t capacity) : mask(roundCapacity(capacity) - 1) {
+        buffer.reset(new Cell[mask + 1]);
+        for(size_t i = 0; i <= mask; i++) {
+            buffer[i].sequence.store(i, memory_order_relaxed);
+        }
+    }
+
+    static size_t roundCapacity(size_t capacity) {
+        size_t rounded = 2;
+        while(rounded < capacity) {
+            rounded <<= 1;
+        }
+        return rounded;
+    }
+
+    // Returns false without blocking if the queue is full.
+    bool tryPush(T&& value) {
+        size_t pos = enqueuePos.load(memory_order_relaxed);
+        Cell* cell;
+        while(true) {
+            cell = &buffer[pos & mask];
+            size_t sequence = cell->sequence.load(memory_order_acquire);
+            intptr_t diff = (intptr_t)sequence - (intptr_t)pos;
+            if(diff == 0) {
+                if(enqueuePos.compare_exchange_weak(pos, pos + 1, memory_order_relaxed)) {
+                    break;
+                }
+            } else if(diff < 0) {
+                return false;
+            } else {
+                pos = enqueuePos.load(memory_order_relaxed);
+            }
+        }
+        cell->value = std::move(value);
+        cell->sequence.store(pos + 1, memory_order_release);
+        return true;
+    }
+
+    // Returns false without blocking if the queue is empty.
+    bool tryPop(T& value) {
+        size_t pos = dequeuePos.load(memory_order_relaxed);
+        Cell* cell;
+        while(true) {
+            cell = &buffer[pos & mask];
+            size_t sequence = cell->sequence.load(memory_order_acquire);
+            intptr_t diff = (intptr_t)sequence - (intptr_t)(pos + 1);
+            if(diff == 0) {
+                if(dequeuePos.compare_exchange_weak(pos, pos + 1, memory_order_relaxed)) {
+                    break;
+                }
+            } else if(diff < 0) {
+                return false;
+            } else {
+                pos = dequeuePos.load(memory_order_relaxed);
+            }
+        }
+        value = std::move(cell->value);
+        cell->sequence.store(pos + mask + 1, memory_order_release);
+        return true;
+    }
+
+    // Approximate number of queued values
+    size_t size() {
+        size_t enqueued = enqueuePos.load(memory_order_relaxed);
+        size_t dequeued = dequeuePos.load(memory_order_relaxed);
+        return enqueued > dequeued ? enqueued - dequeued : 0;
+    }
+
+    size_t capacity() {
+        return mask + 1;
+    }
+};
@@ -0,0 +1,59 @@
+#pragma once
+using namespace std;
+
+// Limits of a bathtub model, known at compile time. A model is a struct with these static constexpr members,
+// and the bath of that model is a BasicBath<Model>.
+
+// The bathtub of the first version
+struct Model300L {
+    static constexpr const char* name = "300L";
+    // Volume of the bathtub in liters
+    static constexpr double capacity = 300;
+    // Maximum bath water debit measured in liters/second
+    static constexpr double maxBathDebit = .25;
+    // Maximum shower water debit measured in liters/second
+    static constexpr double maxShowerDebit = .2;
+    // Drain speed of the water when the stopper is lifted, measured in liters/second
+    static constexpr double drainSpeed = .2;
+    // Temperature range of the water flowing through the pipes
+    static constexpr double minWaterTemperature = 5;
+    static constexpr double maxWaterTemperature = 50;
+};
+
+// Compact bathtub, with smaller pipes and a lower maximum temperature
+struct Model180L {
+    static constexpr const char* name = "180L";
+    static constexpr double capacity = 180;
+    static constexpr double maxBathDebit = .2;
+    static constexpr double maxShowerDebit = .15;
+    static constexpr double drainSpeed = .15;
+    static constexpr double minWaterTemperature = 5;
+    static constexpr double maxWaterTemperature = 45;
+};
+
+// Model of the baths created without one
+typedef Model300L DefaultModel;
+
+// The limits of a model as values, for the code shared by all the models and for the API
+typedef struct DeviceTraits {
+    const char* name;
+    double capacity;
+    double maxBathDebit;
+    double maxShowerDebit;
+    double drainSpeed;
+    double minWaterTemperature;
+    double maxWaterTemperature;
+} DeviceTraits;
+
+template<typename Model>
+constexpr DeviceTraits deviceTraits() {
+    return {
+        .name = Model::name,
+        .capacity = Model::capacity,
+        .maxBathDebit = Model::maxBathDebit,
+        .maxShowerDebit = Model::maxShowerDebit,
+        .drainSpeed = Model::drainSpeed,
+        .minWaterTemperature = Model::minWaterTemperature,
+        .maxWaterTemperature = Model::maxWaterTemperature
+    };
+}
@@ -0,0 +1,161 @@
+#include "EventStream.hpp"
+#include "JsonWriter.hpp"
+#include "Metrics.cpp"
+using namespace std;
+
+
+EventStream::EventStream(size_t capacity) : ring(capacity) {
+}
+
+EventStream::~EventStream() {
+    string body;
+    JsonWriter json(body);
+    json.beginObject().field("error", "STREAM_CLOSED").endObject();
+    for(auto& waiter : waiters) {
+        try {
+            waiter.respond(503, body);
+        } catch(...) {
+            swallowedErrors("event_response").add();
+        }
+    }
+}
+
+uint64_t EventStream::oldestVersion() {
+    return version > ring.size() ? version - ring.size() + 1 : 1;
+}
+
+void EventStream::render(uint64_t since, string& body) {
+    JsonWriter json(body);
+    json.beginObject().field("version", version).key("events").beginArray();
+    for(uint64_t v = since + 1; v <= version; v++) {
+        auto& event = ring[(v - 1) % ring.size()];
+        json.beginObject()
+            .field("version", event.version)
+            .field("type", string_view(event.type))
+            .key("data").raw(event.data)
+            .endObject();
+    }
+    json.endArray().endObject();
+}
+
+void EventStream::respondAll(Waiter* begin, Waiter* end, int status, const string& body) {
+    static Counter& failures = swallowedErrors("event_response");
+    for(Waiter* waiter = begin; waiter != end; waiter++) {
+        try {
+            waiter->respond(status, body);
+        } catch(...) {
+            failures.add();
+        }
+    }
+}
+
+void EventStream::publish(string type, string data) {
+    lock_guard<mutex> lock(streamMutex);
+    version++;
+    ring[(version - 1) % ring.size()] = { .version = version, .type = std::move(type), .data = std::move(data) };
+    published++;
+}
+
+void EventStream::deliver() {
+    vector<Waiter> ready;
+    // A client only waits when it has seen every event, so the waiters are in the order of their cursors,
+    // and the ones with the same cursor receive the same body
+    vector<string> bodies;
+    vector<size_t> firstOfBody;
+    {
+        lock_guard<mutex> lock(streamMutex);
+        if(waiters.empty() || waiters.front().since == version) {
+            return;
+        }
+        size_t kept = 0;
+        for(size_t i = 0; i < waiters.size(); i++) {
+            if(waiters[i].since == version) {
+                waiters[kept++] = std::move(waiters[i]);
+                continue;
+            }
+            if(ready.empty() || ready.back().since != waiters[i].since) {
+                firstOfBody.push_back(ready.size());
+                bodies.emplace_back();
+                render(waiters[i].since, bodies.back());
+            }
+            ready.push_back(std::move(waiters[i]));
+        }
+        waiters.resize(kept);
+        woken += ready.size();
+    }
+    // Responding can be slow, so it is done outside the lock
+    firstOfBody.push_back(ready.size());
+    for(size_t b = 0; b < bodies.size(); b++) {
+        respondAll(ready.data() + firstOfBody[b], ready.data() + firstOfBody[b + 1], 200, bodies[b]);
+    }
+}
+
+void EventStream::poll(uint64_t since, chrono::milliseconds timeout, Responder respond) {
+    string body;
+    int status = 200;
+    {
+        lock_guard<mutex> lock(streamMutex);
+        if(since == CURRENT_VERSION) {
+            render(version, body);
+        } else if(since > version || since + 1 < oldestVersion()) {
+            // The events after the cursor were dropped, or the cursor is from another run of the server
+            expired++;
+            status = 410;
+            JsonWriter json(body);
+            json.beginObject().field("error", "CURSOR_EXPIRED").field("version", version).endObject();
+        } else if(since < version || timeout.count() <= 0) {
+            render(since, body);
+        } else if(waiters.size() >= EVENT_STREAM_MAX_WAITERS) {
+            rejected++;
+            status = 503;
+            JsonWriter json(body);
+            json.beginObject().field("error", "TOO_MANY_WAITERS").endObject();
+        } else {
+            waiters.push_back({ .since = since, .deadline = Clock::now() + timeout, .respond = std::move(respond) });
+            return;
+        }
+    }
+    respond(status, body);
+}
+
+void EventStream::expireWaiters() {
+    vector<Waiter> ready;
+    string body;
+    {
+        lock_guard<mutex> lock(streamMutex);
+        auto now = Clock::now();
+        size_t kept = 0;
+        for(size_t i = 0; i < waiters.size(); i++) {
+            if(waiters[i].deadline <= now) {
+                ready.push_back(std::move(waiters[i]));
+            } else {
+                waiters[kept++] = std::move(waiters[i]);
+            }
+        }
+        waiters.resize(kept);
+        timedOut += ready.size();
+        if(!ready.empty()) {
+            // No event arrived, so the body only carries the current version
+            render(version, body);
+        }
+    }
+    respondAll(ready.data(), ready.data() + ready.size(), 200, body);
+}
+
+uint64_t EventStream::getVersion() {
+    lock_guard<mutex> lock(streamMutex);
+    return version;
+}
+
+EventStreamStats EventStream::getStats() {
+    lock_guard<mutex> lock(streamMutex);
+    return {
+        .version = version,
+        .waiters = waiters.size(),
+        .published = published,
+        .woken = woken,
+        .timedOut = timedOut,
+        .expired = expired,
+        .rejected = rejected
+    };
+}
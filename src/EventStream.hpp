@@ -0,0 +1,102 @@
+#pragma once
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <vector>
+using namespace std;
+
+// Maximum number of events kept for the clients that are behind
+#ifndef EVENT_STREAM_CAPACITY
+#define EVENT_STREAM_CAPACITY 1024
+#endif
+// Maximum number of long-poll requests waiting on a bath
+#ifndef EVENT_STREAM_MAX_WAITERS
+#define EVENT_STREAM_MAX_WAITERS 20000
+#endif
+
+// State change of a bath, pushed to the clients of GET /events
+typedef struct StreamEvent {
+    // Incremented by each event, starting at 1
+    uint64_t version;
+    // pipe, volume, waterQuality or fillTarget
+    string type;
+    // JSON object
+    string data;
+} StreamEvent;
+
+typedef struct EventStreamStats {
+    uint64_t version;
+    size_t waiters;
+    uint64_t published;
+    // Responses sent because an event arrived, and because the wait timed out
+    uint64_t woken;
+    uint64_t timedOut;
+    // Requests rejected because the cursor was older than the buffer, or because there were too many waiters
+    uint64_t expired;
+    uint64_t rejected;
+} EventStreamStats;
+
+// Long-poll event stream with a version cursor.
+// The events are kept in one bounded ring shared by all the clients, so a client costs one waiter
+// entry while it waits and nothing in between. A client that falls behind the ring is evicted:
+// it receives CURSOR_EXPIRED and resynchronizes from the current state.
+// Thread safe. The versions are assigned in the order of publish, whatever the order of the deliver calls.
+class EventStream {
+public:
+    typedef chrono::steady_clock Clock;
+    // Receives the HTTP status and the JSON body of the response
+    typedef function<void(int status, const string& body)> Responder;
+    // Cursor of a client that has not received any version yet
+    static const uint64_t CURRENT_VERSION = UINT64_MAX;
+private:
+    struct Waiter {
+        uint64_t since;
+        Clock::time_point deadline;
+        Responder respond;
+    };
+
+    mutex streamMutex;
+    // Ring of the last events, the event of version v is at (v - 1) % capacity
+    vector<StreamEvent> ring;
+    uint64_t version = 0;
+    vector<Waiter> waiters;
+
+    uint64_t published = 0;
+    uint64_t woken = 0;
+    uint64_t timedOut = 0;
+    uint64_t expired = 0;
+    uint64_t rejected = 0;
+
+    // Oldest version still in the ring. streamMutex must be held.
+    uint64_t oldestVersion();
+    // Writes the events after since into body. streamMutex must be held.
+    void render(uint64_t since, string& body);
+    // Answers the waiters in [begin, end), outside of the lock
+    void respondAll(Waiter* begin, Waiter* end, int status, const string& body);
+public:
+    explicit EventStream(size_t capacity = EVENT_STREAM_CAPACITY);
+    // The waiting clients receive STREAM_CLOSED
+    ~EventStream();
+
+    // Appends an event. The clients waiting for it are answered by the next deliver, so that the owner
+    // can publish while it holds its own lock and answer them after releasing it.
+    void publish(string type, string data);
+
+    // Answers the clients waiting for the events published since the last call
+    void deliver();
+
+    /**
+     * Answers with the events after since, or waits until one is published or the timeout expires.
+     * With since CURRENT_VERSION, the current version is returned at once, to use as the first cursor.
+     * The responder is called on the calling thread, or later on the thread that publishes or expires.
+    */
+    void poll(uint64_t since, chrono::milliseconds timeout, Responder respond);
+
+    // Answers the waits whose timeout expired with no event
+    void expireWaiters();
+
+    uint64_t getVersion();
+    EventStreamStats getStats();
+};
@@ -0,0 +1,160 @@
+#include "FleetTick.hpp"
+#include <cmath>
+#include <immintrin.h>
+#include "BathPhysics.cpp"
+using namespace std;
+
+
+size_t addFleetBath(FleetState& fleet, double capacity) {
+    fleet.volume.push_back(0);
+    fleet.temperature.push_back(PHYSICS_ROOM_TEMPERATURE);
+    fleet.inflowStep.push_back(0);
+    fleet.heatStep.push_back(0);
+    fleet.drainStep.push_back(0);
+    fleet.capacity.push_back(capacity);
+    fleet.fillTarget.push_back(numeric_limits<double>::infinity());
+    return fleet.volume.size() - 1;
+}
+
+size_t fleetSize(const FleetState& fleet) {
+    return fleet.volume.size();
+}
+
+void setFleetFlow(FleetState& fleet, size_t bath, WaterFlow flow) {
+    double step = fleet.stepMs / 1000.0;
+    fleet.inflowStep[bath] = flow.inflow * step;
+    fleet.heatStep[bath] = fleet.inflowStep[bath] * flow.inflowTemperature;
+    fleet.drainStep[bath] = flow.drain * step;
+}
+
+// Sizes the bitmasks for the fleet and clears them
+static void resetResult(size_t bathCount, FleetTickResult& result) {
+    size_t words = (bathCount + 63) / 64;
+    result.shutOff.assign(words, 0);
+    result.targetReached.assign(words, 0);
+    result.saltLow.assign(words, 0);
+}
+
+// Advances the baths in [begin, end) one at a time, through the steps of a second
+static void advanceRange(FleetState& fleet, FleetTickResult& result, size_t begin, size_t end) {
+    const int64_t steps = 1000 / fleet.stepMs;
+    const double cooling = exp(-PHYSICS_COOLING_RATE * (fleet.stepMs / 1000.0));
+    for(size_t i = begin; i < end; i++) {
+        double volume = fleet.volume[i], temperature = fleet.temperature[i];
+        bool shutOff = false, targetReached = false;
+        for(int64_t s = 0; s < steps; s++) {
+            stepWater(volume, temperature, fleet.inflowStep[i], fleet.heatStep[i], fleet.drainStep[i], cooling);
+            if(fleet.inflowStep[i] <= 0) {
+                continue;
+            }
+            bool full = volume >= fleet.capacity[i];
+            // Turning the pipes off at the capacity cancels the fill target instead
+            bool target = !full && fleet.fillTarget[i] <= volume;
+            if(full) {
+                volume = fleet.capacity[i];
+            }
+            if(full || target) {
+                fleet.inflowStep[i] = 0;
+                fleet.heatStep[i] = 0;
+                fleet.fillTarget[i] = numeric_limits<double>::infinity();
+                shutOff = true;
+                targetReached = target;
+            }
+        }
+        fleet.volume[i] = volume;
+        fleet.temperature[i] = temperature;
+        uint64_t bit = 1ULL << (i % 64);
+        if(shutOff) {
+            result.shutOff[i / 64] |= bit;
+        }
+        if(targetReached) {
+            result.targetReached[i / 64] |= bit;
+        }
+        if(volume <= 0.25 * fleet.capacity[i]) {
+            result.saltLow[i / 64] |= bit;
+        }
+    }
+}
+
+void advanceFleetScalar(FleetState& fleet, FleetTickResult& result) {
+    size_t count = fleetSize(fleet);
+    resetResult(count, result);
+    advanceRange(fleet, result, 0, count);
+}
+
+__attribute__((target("avx2")))
+void advanceFleetAvx2(FleetState& fleet, FleetTickResult& result) {
+    size_t count = fleetSize(fleet);
+    resetResult(count, result);
+
+    const int64_t steps = 1000 / fleet.stepMs;
+    double* volume = fleet.volume.data();
+    double* temperature = fleet.temperature.data();
+    double* inflowStep = fleet.inflowStep.data();
+    double* heatStep = fleet.heatStep.data();
+    const double* drainStep = fleet.drainStep.data();
+    const double* capacity = fleet.capacity.data();
+    double* fillTarget = fleet.fillTarget.data();
+    const __m256d zero = _mm256_setzero_pd();
+    const __m256d one = _mm256_set1_pd(1.0);
+    const __m256d quarter = _mm256_set1_pd(0.25);
+    const __m256d infinity = _mm256_set1_pd(numeric_limits<double>::infinity());
+    const __m256d room = _mm256_set1_pd(PHYSICS_ROOM_TEMPERATURE);
+    const __m256d cooling = _mm256_set1_pd(exp(-PHYSICS_COOLING_RATE * (fleet.stepMs / 1000.0)));
+
+    // 4 baths per iteration, kept in registers through the steps of the second.
+    // Same operations as stepWater and advanceRange, so both paths give the same results.
+    size_t i = 0;
+    for(; i + 4 <= count; i += 4) {
+        __m256d v = _mm256_loadu_pd(volume + i);
+        __m256d t = _mm256_loadu_pd(temperature + i);
+        __m256d in = _mm256_loadu_pd(inflowStep + i);
+        __m256d heat = _mm256_loadu_pd(heatStep + i);
+        __m256d drain = _mm256_loadu_pd(drainStep + i);
+        __m256d cap = _mm256_loadu_pd(capacity + i);
+        __m256d target = _mm256_loadu_pd(fillTarget + i);
+        __m256d shutOff = zero, targetReached = zero;
+        for(int64_t s = 0; s < steps; s++) {
+            __m256d mixed = _mm256_add_pd(v, in);
+            __m256d wet = _mm256_cmp_pd(mixed, zero, _CMP_GT_OQ);
+            __m256d mixedTemperature = _mm256_div_pd(_mm256_add_pd(_mm256_mul_pd(v, t), heat),
+                _mm256_blendv_pd(one, mixed, wet));
+            t = _mm256_blendv_pd(t, mixedTemperature, wet);
+            v = _mm256_max_pd(_mm256_sub_pd(mixed, drain), zero);
+            t = _mm256_add_pd(room, _mm256_mul_pd(_mm256_sub_pd(t, room), cooling));
+
+            __m256d filling = _mm256_cmp_pd(in, zero, _CMP_GT_OQ);
+            __m256d full = _mm256_and_pd(filling, _mm256_cmp_pd(v, cap, _CMP_GE_OQ));
+            __m256d reached = _mm256_andnot_pd(full, _mm256_and_pd(filling, _mm256_cmp_pd(target, v, _CMP_LE_OQ)));
+            __m256d off = _mm256_or_pd(full, reached);
+            v = _mm256_blendv_pd(v, cap, full);
+            in = _mm256_andnot_pd(off, in);
+            heat = _mm256_andnot_pd(off, heat);
+            target = _mm256_blendv_pd(target, infinity, off);
+            shutOff = _mm256_or_pd(shutOff, off);
+            targetReached = _mm256_or_pd(targetReached, reached);
+        }
+        _mm256_storeu_pd(volume + i, v);
+        _mm256_storeu_pd(temperature + i, t);
+        _mm256_storeu_pd(inflowStep + i, in);
+        _mm256_storeu_pd(heatStep + i, heat);
+        _mm256_storeu_pd(fillTarget + i, target);
+
+        __m256d salt = _mm256_cmp_pd(v, _mm256_mul_pd(cap, quarter), _CMP_LE_OQ);
+        unsigned shift = i % 64;
+        result.shutOff[i / 64] |= (uint64_t)_mm256_movemask_pd(shutOff) << shift;
+        result.targetReached[i / 64] |= (uint64_t)_mm256_movemask_pd(targetReached) << shift;
+        result.saltLow[i / 64] |= (uint64_t)_mm256_movemask_pd(salt) << shift;
+    }
+    // Remaining baths
+    advanceRange(fleet, result, i, count);
+}
+
+void advanceFleet(FleetState& fleet, FleetTickResult& result) {
+    static const bool hasAvx2 = __builtin_cpu_supports("avx2");
+    if(hasAvx2) {
+        advanceFleetAvx2(fleet, result);
+    } else {
+        advanceFleetScalar(fleet, result);
+    }
+}
@@ -0,0 +1,58 @@
+#pragma once
+#include <cstdint>
+#include <limits>
+#include <string>
+#include <vector>
+#include "BathPhysics.hpp"
+using namespace std;
+
+// Water of many baths, stored as contiguous arrays so that one interval check can advance all of them
+// in a single vectorized pass. Every array has one entry per bath, and all the baths share the physics step.
+// BathRegistry does not use it: its baths are SmartBath objects, each ticked on its own. bench/fleet_tick measures it.
+typedef struct FleetState {
+    // Length of a physics step in milliseconds, it must divide a second (see BathPhysics)
+    int64_t stepMs = PHYSICS_STEP_MS;
+    // Current volume of the bathtub in liters, and temperature of its water
+    vector<double> volume;
+    vector<double> temperature;
+    // Liters in, heat in (liters times degrees) and liters drained per step, set by setFleetFlow
+    vector<double> inflowStep;
+    vector<double> heatStep;
+    vector<double> drainStep;
+    // Volume of the bathtub in liters
+    vector<double> capacity;
+    // Target volume of the bath preparation, infinity when no target is set
+    vector<double> fillTarget;
+} FleetState;
+
+// Bitmasks produced by one pass, bit i of word i / 64 referring to bath i
+typedef struct FleetTickResult {
+    // The bathtub filled up or the fill target was reached, and the pipes were turned off
+    vector<uint64_t> shutOff;
+    // The fill target was reached and the display must be notified
+    vector<uint64_t> targetReached;
+    // The volume is at most 25% of the capacity, so the salt pump must be turned off
+    vector<uint64_t> saltLow;
+} FleetTickResult;
+
+// Adds an empty bath with the pipes off and no drain (stopper on). Returns its index.
+size_t addFleetBath(FleetState& fleet, double capacity);
+
+size_t fleetSize(const FleetState& fleet);
+
+// Sets the flow of the bath. It must be set again after the step of the fleet changes.
+void setFleetFlow(FleetState& fleet, size_t bath, WaterFlow flow);
+
+/**
+ * Advances every bath by one second in fixed steps, like SmartBath::intervalCheck does for one bath in polling mode:
+ * after the step where the volume reaches the capacity or the fill target while water flows in, the pipes are turned off,
+ * the volume is capped at the capacity, the fill target is cleared, and the rest of the second drains and cools the water.
+ * Uses AVX2 when the CPU supports it and falls back to the scalar loop otherwise.
+*/
+void advanceFleet(FleetState& fleet, FleetTickResult& result);
+
+// Portable implementation of advanceFleet.
+void advanceFleetScalar(FleetState& fleet, FleetTickResult& result);
+
+// Same loop compiled for AVX2. Must only be called if the CPU supports AVX2.
+void advanceFleetAvx2(FleetState& fleet, FleetTickResult& result);
@@ -0,0 +1,124 @@
+#include "History.hpp"
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+using namespace std;
+
+static const char* METRIC_NAMES[] = {
+    "volume", "bathDebit", "showerDebit", "temperature", "pH", "chlorides", "iron", "calcium", "color", "salt"
+};
+
+
+void MetricHistory::add(Rollup& rollup, int64_t time, double value) {
+    int64_t start = time - time % rollup.resolution;
+    if(rollup.ring.empty()) {
+        rollup.ring.resize(rollup.capacity);
+    }
+    Bucket& bucket = rollup.ring[(start / rollup.resolution) % rollup.capacity];
+    if(bucket.start != start) {
+        // The slot holds a newer bucket, the sample is older than the ring
+        if(bucket.start > start) {
+            return;
+        }
+        bucket = { .start = (uint32_t)start, .count = 0, .min = (float)value, .max = (float)value, .sum = 0 };
+    }
+    bucket.count++;
+    bucket.min = min(bucket.min, (float)value);
+    bucket.max = max(bucket.max, (float)value);
+    bucket.sum += value;
+    rollup.latest = max(rollup.latest, start);
+}
+
+void MetricHistory::add(int64_t time, double value) {
+    if(time <= 0 || time > UINT32_MAX || !isfinite(value)) {
+        return;
+    }
+    for(auto& rollup : rollups) {
+        add(rollup, time, value);
+    }
+}
+
+void MetricHistory::query(int64_t from, int64_t to, int64_t step, HistoryQuery& result) const {
+    if(step <= 0 || from < 0 || to <= from) {
+        throw std::runtime_error("INVALID_RANGE");
+    }
+    if((to - from + step - 1) / step > HISTORY_MAX_POINTS) {
+        throw std::runtime_error("TOO_MANY_POINTS");
+    }
+    // Points start at multiples of the step, so the buckets of a rollup whose resolution divides the step
+    // each fall in a single point. The coarsest such rollup reads the fewest buckets.
+    // The 1 s rollup divides any step.
+    const Rollup* rollup = &rollups[0];
+    for(auto& candidate : rollups) {
+        if(step % candidate.resolution == 0) {
+            rollup = &candidate;
+        }
+    }
+    result.resolution = rollup->resolution;
+    result.points.clear();
+    if(rollup->ring.empty()) {
+        return;
+    }
+    // Only the buckets still in the ring are read, so a query reads at most capacity buckets
+    int64_t oldest = rollup->latest - (int64_t)(rollup->capacity - 1) * rollup->resolution;
+    int64_t first = max(from, oldest);
+    first += (rollup->resolution - first % rollup->resolution) % rollup->resolution;
+    int64_t last = min(to, rollup->latest + rollup->resolution);
+    for(int64_t start = first; start < last; start += rollup->resolution) {
+        const Bucket& bucket = rollup->ring[(start / rollup->resolution) % rollup->capacity];
+        if(bucket.start != start || bucket.count == 0) {
+            continue;
+        }
+        int64_t pointTime = start - start % step;
+        if(result.points.empty() || result.points.back().time != pointTime) {
+            result.points.push_back({ .time = pointTime, .min = bucket.min, .max = bucket.max, .avg = 0, .count = 0 });
+        }
+        HistoryPoint& point = result.points.back();
+        point.min = min(point.min, (double)bucket.min);
+        point.max = max(point.max, (double)bucket.max);
+        // The sum is kept in avg until the point is complete
+        point.avg += bucket.sum;
+        point.count += bucket.count;
+    }
+    for(auto& point : result.points) {
+        point.avg /= point.count;
+    }
+}
+
+size_t MetricHistory::memoryUsage() const {
+    size_t bytes = 0;
+    for(auto& rollup : rollups) {
+        bytes += rollup.ring.capacity() * sizeof(Bucket);
+    }
+    return bytes;
+}
+
+void History::add(HistoryMetric metric, int64_t time, double value) {
+    metrics[(int)metric].add(time, value);
+}
+
+void History::query(HistoryMetric metric, int64_t from, int64_t to, int64_t step, HistoryQuery& result) const {
+    metrics[(int)metric].query(from, to, step, result);
+}
+
+size_t History::memoryUsage() const {
+    size_t bytes = 0;
+    for(auto& metric : metrics) {
+        bytes += metric.memoryUsage();
+    }
+    return bytes;
+}
+
+const char* History::metricName(HistoryMetric metric) {
+    return METRIC_NAMES[(int)metric];
+}
+
+bool History::parseMetric(string_view name, HistoryMetric& metric) {
+    for(int i = 0; i < (int)HistoryMetric::Count; i++) {
+        if(name == METRIC_NAMES[i]) {
+            metric = (HistoryMetric)i;
+            return true;
+        }
+    }
+    return false;
+}
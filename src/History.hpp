@@ -0,0 +1,100 @@
+#pragma once
+#include <cstdint>
+#include <string_view>
+#include <vector>
+using namespace std;
+
+// Buckets kept by each rollup of a metric: 5 minutes of 1 s buckets, 24 hours of 1 min buckets, 7 days of 1 h buckets
+#ifndef HISTORY_SECONDS
+#define HISTORY_SECONDS 300
+#endif
+#ifndef HISTORY_MINUTES
+#define HISTORY_MINUTES 1440
+#endif
+#ifndef HISTORY_HOURS
+#define HISTORY_HOURS 168
+#endif
+// Maximum number of points returned by a query
+#ifndef HISTORY_MAX_POINTS
+#define HISTORY_MAX_POINTS 1000
+#endif
+
+enum class HistoryMetric { Volume, BathDebit, ShowerDebit, Temperature, PH, Chlorides, Iron, Calcium, Color, Salt, Count };
+
+// Aggregate of the samples of a metric between time and time + step, time being a multiple of the step
+typedef struct HistoryPoint {
+    // Unix time in seconds
+    int64_t time;
+    double min;
+    double max;
+    double avg;
+    uint64_t count;
+} HistoryPoint;
+
+typedef struct HistoryQuery {
+    // Resolution of the rollup that answered the query, in seconds
+    int64_t resolution;
+    // Only the steps that have samples
+    vector<HistoryPoint> points;
+} HistoryQuery;
+
+/**
+ * Min/max/avg rollups of a metric at 1 s, 1 min and 1 h resolutions.
+ * Each rollup is a ring of fixed size, updated in O(1) on insert, so the memory does not grow with the samples.
+ * Queries are answered from the coarsest rollup that fits the step, and never read the samples.
+*/
+class MetricHistory {
+private:
+    struct Bucket {
+        // Start of the bucket in unix seconds, 0 if the slot is unused
+        uint32_t start;
+        uint32_t count;
+        float min;
+        float max;
+        double sum;
+    };
+
+    struct Rollup {
+        uint32_t resolution;
+        uint32_t capacity;
+        // Start of the newest bucket
+        int64_t latest;
+        // Allocated on the first sample
+        vector<Bucket> ring;
+    };
+
+    Rollup rollups[3] = {
+        { 1, HISTORY_SECONDS, 0, {} },
+        { 60, HISTORY_MINUTES, 0, {} },
+        { 3600, HISTORY_HOURS, 0, {} }
+    };
+
+    static void add(Rollup& rollup, int64_t time, double value);
+public:
+    // Samples older than what the rollups keep are ignored
+    void add(int64_t time, double value);
+
+    /**
+     * Aggregates the samples of [from, to) in steps of step seconds, from rounded up to the resolution of the rollup.
+     * Throws runtime_error if the range is empty or has more than HISTORY_MAX_POINTS steps.
+    */
+    void query(int64_t from, int64_t to, int64_t step, HistoryQuery& result) const;
+
+    size_t memoryUsage() const;
+};
+
+// History of all the metrics of a bath.
+// Not thread safe, the owner must synchronize the calls.
+class History {
+private:
+    MetricHistory metrics[(int)HistoryMetric::Count];
+public:
+    void add(HistoryMetric metric, int64_t time, double value);
+    void query(HistoryMetric metric, int64_t from, int64_t to, int64_t step, HistoryQuery& result) const;
+    size_t memoryUsage() const;
+
+    // Name used by the API (volume, bathDebit, pH, ...)
+    static const char* metricName(HistoryMetric metric);
+    // Returns false if the name is not a metric
+    static bool parseMetric(string_view name, HistoryMetric& metric);
+};
@@ -0,0 +1,336 @@
+#include "Journal.hpp"
+#include <cerrno>
+#include <fcntl.h>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <sys/stat.h>
+#include <unistd.h>
+using namespace std;
+
+
+// FNV-1a, enough to detect a torn or partially synced record
+static uint32_t recordChecksum(string_view record) {
+    uint32_t hash = 2166136261u;
+    for(char c : record) {
+        hash = (hash ^ (unsigned char)c) * 16777619u;
+    }
+    return hash;
+}
+
+// Appends "<record>,<checksum as 8 hex digits>\n"
+static void frameRecord(string& out, string_view record) {
+    static const char HEX[] = "0123456789abcdef";
+    uint32_t checksum = recordChecksum(record);
+    out += record;
+    out += ',';
+    for(int shift = 28; shift >= 0; shift -= 4) {
+        out += HEX[(checksum >> shift) & 0xf];
+    }
+    out += '\n';
+}
+
+// Returns false if the line is not a complete record with a valid checksum
+static bool unframeRecord(string_view line, string_view& record) {
+    if(line.size() < 9 || line[line.size() - 9] != ',') {
+        return false;
+    }
+    uint32_t checksum = 0;
+    for(char c : line.substr(line.size() - 8)) {
+        int digit;
+        if('0' <= c && c <= '9') digit = c - '0';
+        else if('a' <= c && c <= 'f') digit = c - 'a' + 10;
+        else return false;
+        checksum = (checksum << 4) | digit;
+    }
+    record = line.substr(0, line.size() - 9);
+    return recordChecksum(record) == checksum;
+}
+
+// Writes the whole buffer, retrying the partial writes
+static bool writeAll(int fd, const char* data, size_t size) {
+    while(size > 0) {
+        ssize_t written = ::write(fd, data, size);
+        if(written < 0) {
+            if(errno == EINTR) continue;
+            return false;
+        }
+        data += written;
+        size -= written;
+    }
+    return true;
+}
+
+// Syncs the directory of the path, so that a rename in it is durable
+static bool syncDirectory(const string& path) {
+    size_t slash = path.rfind('/');
+    string directory = slash == string::npos ? "." : (slash == 0 ? "/" : path.substr(0, slash));
+    int fd = ::open(directory.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if(fd < 0) {
+        return false;
+    }
+    bool synced = ::fsync(fd) == 0;
+    ::close(fd);
+    return synced;
+}
+
+bool replaceFile(const string& path, const function<bool(int fd)>& write) {
+    string temporaryPath = path + ".tmp";
+    int fd = ::open(temporaryPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    bool written = fd >= 0 && write(fd) && ::fsync(fd) == 0;
+    if(fd >= 0) {
+        ::close(fd);
+    }
+    if(!written || ::rename(temporaryPath.c_str(), path.c_str()) != 0) {
+        ::unlink(temporaryPath.c_str());
+        return false;
+    }
+    return syncDirectory(path);
+}
+
+
+Journal::Journal(JournalWriter* writer, string snapshotPath, string logPath, const ReplayHandler& handler)
+    : writer(writer), snapshotPath(snapshotPath), logPath(logPath) {
+    replay(handler);
+}
+
+Journal::~Journal() {
+    uint64_t sequence;
+    {
+        lock_guard<mutex> lock(writer->writerMutex);
+        sequence = lastSequence;
+    }
+    writer->waitDurable(sequence);
+    if(logFd >= 0) {
+        ::close(logFd);
+    }
+}
+
+void Journal::replay(const ReplayHandler& handler) {
+    struct stat snapshotStatus;
+    if(::stat(snapshotPath.c_str(), &snapshotStatus) == 0) {
+        snapshotSize = snapshotStatus.st_size;
+    }
+
+    ifstream logFile(logPath, ios::binary);
+    stringstream content;
+    content << logFile.rdbuf();
+    logFile.close();
+    string log = content.str();
+    size_t position = 0;
+    while(position < log.size()) {
+        size_t end = log.find('\n', position);
+        string_view record;
+        // A line without its line break was torn by a crash
+        if(end == string::npos || !unframeRecord(string_view(log).substr(position, end - position), record)) {
+            break;
+        }
+        handler(record);
+        position = end + 1;
+    }
+
+    logFd = ::open(logPath.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if(logFd < 0) {
+        cout << "Journal " << logPath << " can't be opened, changes will not be saved.\n";
+        failed = true;
+        return;
+    }
+    // The records after a bad one can't be trusted, and new records must not follow garbage
+    if(position < log.size()) {
+        cout << "Journal " << logPath << " was cut at byte " << position << ", "
+             << log.size() - position << " bytes of torn records were dropped.\n";
+        if(::ftruncate(logFd, position) != 0) {
+            failed = true;
+        }
+    }
+    logSize = position;
+}
+
+uint64_t Journal::append(string_view record) {
+    string framed;
+    framed.reserve(record.size() + 10);
+    frameRecord(framed, record);
+    return writer->enqueue({ .journal = this, .data = std::move(framed), .snapshot = nullptr, .done = nullptr, .snapshotSize = 0 });
+}
+
+bool Journal::needsCompaction() {
+    lock_guard<mutex> lock(writer->writerMutex);
+    return !compactionQueued && logSize > JOURNAL_COMPACT_MIN_BYTES
+        && logSize > JOURNAL_COMPACT_RATIO * snapshotSize;
+}
+
+uint64_t Journal::compact(SnapshotWriter write, CompactionCallback done) {
+    if(!done) {
+        done = [](bool) { };
+    }
+    return writer->enqueue({ .journal = this, .data = string(), .snapshot = std::move(write), .done = std::move(done), .snapshotSize = 0 });
+}
+
+void Journal::waitDurable(uint64_t sequence) {
+    writer->waitDurable(sequence);
+}
+
+
+JournalWriter::JournalWriter() {
+    writerThread = std::thread(writeJournals, this);
+}
+
+JournalWriter::~JournalWriter() {
+    stop();
+}
+
+void JournalWriter::stop() {
+    {
+        lock_guard<mutex> lock(writerMutex);
+        if(!running) {
+            return;
+        }
+        running = false;
+    }
+    workCondition.notify_one();
+    writerThread.join();
+}
+
+uint64_t JournalWriter::enqueue(Entry entry) {
+    uint64_t sequence;
+    {
+        lock_guard<mutex> lock(writerMutex);
+        sequence = ++queuedSequence;
+        Journal* journal = entry.journal;
+        journal->lastSequence = sequence;
+        if(entry.snapshot) {
+            // The records queued so far are in the snapshot, the log starts over after it
+            journal->logSize = 0;
+            journal->compactionQueued = true;
+        } else {
+            journal->logSize += entry.data.size();
+            stats.records++;
+            // Without the separator, the checksum and the line break
+            stats.recordBytes += entry.data.size() - 10;
+        }
+        pending.push_back(std::move(entry));
+    }
+    workCondition.notify_one();
+    return sequence;
+}
+
+void JournalWriter::waitDurable(uint64_t sequence) {
+    unique_lock<mutex> lock(writerMutex);
+    durableCondition.wait(lock, [&]() { return durableSequence >= sequence; });
+}
+
+void JournalWriter::writeJournals(JournalWriter* writer) {
+    vector<Entry> group;
+    unique_lock<mutex> lock(writer->writerMutex);
+    while(true) {
+        writer->workCondition.wait(lock, [&]() { return !writer->pending.empty() || !writer->running; });
+        if(writer->pending.empty()) {
+            break;
+        }
+        // Everything queued while the previous group was synced is committed together
+        group.swap(writer->pending);
+        uint64_t lastSequence = writer->queuedSequence;
+        lock.unlock();
+
+        JournalStats groupStats = {};
+        writer->commitGroup(group, groupStats);
+
+        lock.lock();
+        for(auto& entry : group) {
+            if(entry.snapshot) {
+                entry.journal->compactionQueued = false;
+                if(entry.snapshotSize > 0) {
+                    entry.journal->snapshotSize = entry.snapshotSize;
+                }
+            }
+        }
+        group.clear();
+        writer->stats.commits++;
+        writer->stats.syncs += groupStats.syncs;
+        writer->stats.logBytes += groupStats.logBytes;
+        writer->stats.snapshotBytes += groupStats.snapshotBytes;
+        writer->stats.compactions += groupStats.compactions;
+        writer->stats.failed += groupStats.failed;
+        writer->durableSequence = lastSequence;
+        writer->durableCondition.notify_all();
+    }
+}
+
+void JournalWriter::commitGroup(vector<Entry>& group, JournalStats& groupStats) {
+    vector<Journal*> dirty;
+    for(auto& entry : group) {
+        Journal* journal = entry.journal;
+        if(entry.snapshot) {
+            // The records before the snapshot are written first, so that the log stays ordered
+            flush(journal, groupStats);
+            writeSnapshot(entry, groupStats);
+            continue;
+        }
+        if(journal->pendingWrite.empty()) {
+            dirty.push_back(journal);
+        }
+        journal->pendingWrite += entry.data;
+    }
+    for(Journal* journal : dirty) {
+        flush(journal, groupStats);
+    }
+}
+
+void JournalWriter::flush(Journal* journal, JournalStats& groupStats) {
+    if(journal->pendingWrite.empty()) {
+        return;
+    }
+    // After a failed fdatasync the state of the file is unknown, so the journal is not written anymore
+    if(!journal->failed) {
+        if(writeAll(journal->logFd, journal->pendingWrite.data(), journal->pendingWrite.size())
+            && ::fdatasync(journal->logFd) == 0) {
+            groupStats.syncs++;
+            groupStats.logBytes += journal->pendingWrite.size();
+        } else {
+            journal->failed = true;
+            groupStats.failed++;
+            cout << "Journal " << journal->logPath << " can't be written, changes will not be saved.\n";
+        }
+    }
+    journal->pendingWrite.clear();
+}
+
+void JournalWriter::writeSnapshot(Entry& entry, JournalStats& groupStats) {
+    Journal* journal = entry.journal;
+    if(journal->failed) {
+        entry.done(false);
+        return;
+    }
+    // The log is only emptied once the new snapshot is durable. A crash in between leaves records
+    // that are already in the snapshot, and replaying them again is harmless.
+    size_t size = 0;
+    bool replaced = replaceFile(journal->snapshotPath, [&](int fd) {
+        struct stat status;
+        if(!entry.snapshot(fd) || ::fstat(fd, &status) != 0) {
+            return false;
+        }
+        size = status.st_size;
+        return true;
+    });
+    if(!replaced) {
+        // The log still holds every record, so the journal stays usable
+        groupStats.failed++;
+        cout << "Snapshot " << journal->snapshotPath << " can't be written.\n";
+        entry.done(false);
+        return;
+    }
+    groupStats.snapshotBytes += size;
+    groupStats.compactions++;
+    entry.snapshotSize = size;
+    if(::ftruncate(journal->logFd, 0) != 0 || ::fdatasync(journal->logFd) != 0) {
+        journal->failed = true;
+        groupStats.failed++;
+        cout << "Journal " << journal->logPath << " can't be written, changes will not be saved.\n";
+    }
+    entry.done(true);
+}
+
+JournalStats JournalWriter::getStats() {
+    lock_guard<mutex> lock(writerMutex);
+    return stats;
+}
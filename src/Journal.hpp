@@ -0,0 +1,154 @@
+#pragma once
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+using namespace std;
+
+// A log is compacted into its snapshot once it is larger than this many bytes...
+#ifndef JOURNAL_COMPACT_MIN_BYTES
+#define JOURNAL_COMPACT_MIN_BYTES (64 * 1024)
+#endif
+// ...and larger than this many times the snapshot, so that compacting costs O(1) per record
+#ifndef JOURNAL_COMPACT_RATIO
+#define JOURNAL_COMPACT_RATIO 2
+#endif
+
+typedef struct JournalStats {
+    // Records appended, and their size without the framing
+    uint64_t records;
+    uint64_t recordBytes;
+    // Group commits: one write and one fdatasync per log that has records in the group
+    uint64_t commits;
+    uint64_t syncs;
+    // Bytes written to the logs and to the snapshots
+    uint64_t logBytes;
+    uint64_t snapshotBytes;
+    uint64_t compactions;
+    // Writes, syncs or renames that failed
+    uint64_t failed;
+} JournalStats;
+
+class JournalWriter;
+
+/**
+ * Replaces the file at path with the content written by write, so that a crash leaves either the old or the new file.
+ * The content is written to a temporary file that is synced, renamed over path, and the rename is synced.
+*/
+bool replaceFile(const string& path, const function<bool(int fd)>& write);
+
+/**
+ * Append-only log of records, compacted into a snapshot file owned by the caller.
+ * Each record is one line ending with its checksum, so a record torn by a crash is detected and dropped on replay.
+ * Replaying a record again must give the same state, because a crash during a compaction can leave the
+ * records that are already in the new snapshot in the log.
+*/
+class Journal {
+    friend class JournalWriter;
+public:
+    // Called with each record of the log, without its framing
+    typedef function<void(string_view record)> ReplayHandler;
+    // Writes the content of a new snapshot into fd. Called on the writer thread.
+    typedef function<bool(int fd)> SnapshotWriter;
+    // Called on the writer thread once the snapshot replaced the old one and the log was emptied, or failed
+    typedef function<void(bool compacted)> CompactionCallback;
+private:
+    JournalWriter* writer;
+    const string snapshotPath;
+    const string logPath;
+    int logFd = -1;
+
+    // The following fields are protected by the mutex of the writer
+    // Sequence number of the last entry queued for this journal
+    uint64_t lastSequence = 0;
+    // Size of the log after the queued records, and of the last snapshot
+    size_t logSize = 0;
+    size_t snapshotSize = 0;
+    bool compactionQueued = false;
+
+    // The following fields are only used by the writer thread
+    // Records of the current group, written with one call
+    string pendingWrite;
+    bool failed = false;
+
+    void replay(const ReplayHandler& handler);
+public:
+    /**
+     * Replays the log and opens it for appending.
+     * A torn or corrupted tail of the log is cut off.
+     * The journal must be destroyed before its writer.
+    */
+    Journal(JournalWriter* writer, string snapshotPath, string logPath, const ReplayHandler& handler);
+    // Waits until the queued entries are written
+    ~Journal();
+
+    /**
+     * Queues a record, which must not contain line breaks.
+     * @returns the sequence number to pass to waitDurable.
+    */
+    uint64_t append(string_view record);
+
+    // True when the log has grown enough to be compacted, and no compaction is queued
+    bool needsCompaction();
+    /**
+     * Replaces the snapshot with the content written by write, then empties the log.
+     * It is ordered with the records: the snapshot must contain the state after the last appended record.
+     * @returns the sequence number of the compaction.
+    */
+    uint64_t compact(SnapshotWriter write, CompactionCallback done);
+
+    // Blocks until the entry with the given sequence number is on disk
+    void waitDurable(uint64_t sequence);
+};
+
+/**
+ * Writes the journals of all the baths from a dedicated thread.
+ * Appending only queues the record. The thread takes everything queued while it was busy as one group:
+ * one write and one fdatasync per journal, no matter how many records and callers the group has.
+*/
+class JournalWriter {
+    friend class Journal;
+private:
+    struct Entry {
+        Journal* journal;
+        // A framed record, or empty for a compaction
+        string data;
+        Journal::SnapshotWriter snapshot;
+        Journal::CompactionCallback done;
+        // Size of the snapshot, once it is written
+        size_t snapshotSize;
+    };
+
+    mutex writerMutex;
+    // Signaled when entries are queued, and when a group is on disk
+    condition_variable workCondition;
+    condition_variable durableCondition;
+    vector<Entry> pending;
+    uint64_t queuedSequence = 0;
+    uint64_t durableSequence = 0;
+    bool running = true;
+    std::thread writerThread;
+
+    JournalStats stats = {};
+
+    static void writeJournals(JournalWriter* writer);
+    // Writes and syncs the records of a group. Called without the lock.
+    void commitGroup(vector<Entry>& group, JournalStats& groupStats);
+    void flush(Journal* journal, JournalStats& groupStats);
+    void writeSnapshot(Entry& entry, JournalStats& groupStats);
+
+    uint64_t enqueue(Entry entry);
+    void waitDurable(uint64_t sequence);
+public:
+    JournalWriter();
+    ~JournalWriter();
+
+    JournalStats getStats();
+
+    // Writes the queued entries and stops the thread. Called by the destructor.
+    void stop();
+};
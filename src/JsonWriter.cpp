@@ -0,0 +1,168 @@
+#pragma once
+#include "JsonWriter.hpp"
+#include <charconv>
+#include <cmath>
+using namespace std;
+
+
+void appendNumber(string& out, double value) {
+    // JSON has no representation for NaN and infinities
+    if(!isfinite(value)) {
+        out += "null";
+        return;
+    }
+    char digits[32];
+    auto result = to_chars(digits, digits + sizeof(digits), value);
+    out.append(digits, result.ptr);
+}
+
+void appendNumber(string& out, int64_t value) {
+    char digits[24];
+    auto result = to_chars(digits, digits + sizeof(digits), value);
+    out.append(digits, result.ptr);
+}
+
+void appendNumber(string& out, uint64_t value) {
+    char digits[24];
+    auto result = to_chars(digits, digits + sizeof(digits), value);
+    out.append(digits, result.ptr);
+}
+
+string& threadBuffer() {
+    static thread_local string buffer;
+    buffer.clear();
+    return buffer;
+}
+
+JsonWriter::JsonWriter(string& buffer) : buffer(buffer) {
+    buffer.clear();
+}
+
+void JsonWriter::separator() {
+    if(afterKey) {
+        afterKey = false;
+        return;
+    }
+    uint64_t bit = 1ULL << depth;
+    if(hasItems & bit) {
+        buffer += ", ";
+    }
+    hasItems |= bit;
+}
+
+void JsonWriter::appendString(string_view text) {
+    static const char HEX[] = "0123456789abcdef";
+    buffer += '"';
+    for(char c : text) {
+        switch(c) {
+            case '"': buffer += "\\\""; break;
+            case '\\': buffer += "\\\\"; break;
+            case '\n': buffer += "\\n"; break;
+            case '\r': buffer += "\\r"; break;
+            case '\t': buffer += "\\t"; break;
+            default:
+                if((unsigned char)c < 0x20) {
+                    buffer += "\\u00";
+                    buffer += HEX[(unsigned char)c >> 4];
+                    buffer += HEX[c & 0xf];
+                } else {
+                    buffer += c;
+                }
+        }
+    }
+    buffer += '"';
+}
+
+JsonWriter& JsonWriter::beginObject() {
+    separator();
+    buffer += '{';
+    depth++;
+    hasItems &= ~(1ULL << depth);
+    return *this;
+}
+
+JsonWriter& JsonWriter::endObject() {
+    depth--;
+    buffer += '}';
+    return *this;
+}
+
+JsonWriter& JsonWriter::beginArray() {
+    separator();
+    buffer += '[';
+    depth++;
+    hasItems &= ~(1ULL << depth);
+    return *this;
+}
+
+JsonWriter& JsonWriter::endArray() {
+    depth--;
+    buffer += ']';
+    return *this;
+}
+
+JsonWriter& JsonWriter::key(string_view name) {
+    separator();
+    appendString(name);
+    buffer += ": ";
+    afterKey = true;
+    return *this;
+}
+
+JsonWriter& JsonWriter::value(double number) {
+    separator();
+    appendNumber(buffer, number);
+    return *this;
+}
+
+JsonWriter& JsonWriter::value(int number) {
+    return value((int64_t)number);
+}
+
+JsonWriter& JsonWriter::value(int64_t number) {
+    separator();
+    appendNumber(buffer, number);
+    return *this;
+}
+
+JsonWriter& JsonWriter::value(uint64_t number) {
+    separator();
+    appendNumber(buffer, number);
+    return *this;
+}
+
+JsonWriter& JsonWriter::value(bool flag) {
+    separator();
+    buffer += flag ? "true" : "false";
+    return *this;
+}
+
+JsonWriter& JsonWriter::value(string_view text) {
+    separator();
+    appendString(text);
+    return *this;
+}
+
+JsonWriter& JsonWriter::value(const char* text) {
+    return value(string_view(text));
+}
+
+JsonWriter& JsonWriter::null() {
+    separator();
+    buffer += "null";
+    return *this;
+}
+
+JsonWriter& JsonWriter::raw(string_view json) {
+    separator();
+    buffer += json;
+    return *this;
+}
+
+const char* JsonWriter::data() const {
+    return buffer.data();
+}
+
+size_t JsonWriter::size() const {
+    return buffer.size();
+}
@@ -0,0 +1,59 @@
+#pragma once
+#include <cstdint>
+#include <string>
+#include <string_view>
+using namespace std;
+
+// Appends the shortest representation that reads back to the same double (to_chars), or null if it is not finite.
+void appendNumber(string& out, double value);
+void appendNumber(string& out, int64_t value);
+void appendNumber(string& out, uint64_t value);
+
+// Scratch buffer of the calling thread, cleared. It keeps its capacity, so reusing it does not allocate.
+// The content is only valid until the next call on the same thread.
+string& threadBuffer();
+
+// Writes JSON into a caller provided buffer, without intermediate strings.
+// Commas between members and elements are inserted automatically.
+// Nesting is limited to 64 levels.
+class JsonWriter {
+private:
+    string& buffer;
+    // One bit per nesting level, set once the level has a member or element
+    uint64_t hasItems = 0;
+    int depth = 0;
+    // Set after a key, so that the value that follows it is not preceded by a comma
+    bool afterKey = false;
+
+    void separator();
+    void appendString(string_view text);
+public:
+    // The buffer is cleared, its capacity is kept
+    explicit JsonWriter(string& buffer);
+
+    JsonWriter& beginObject();
+    JsonWriter& endObject();
+    JsonWriter& beginArray();
+    JsonWriter& endArray();
+
+    JsonWriter& key(string_view name);
+
+    JsonWriter& value(double number);
+    JsonWriter& value(int number);
+    JsonWriter& value(int64_t number);
+    JsonWriter& value(uint64_t number);
+    JsonWriter& value(bool flag);
+    JsonWriter& value(string_view text);
+    JsonWriter& value(const char* text);
+    JsonWriter& null();
+    // Writes a value that is already serialized as JSON
+    JsonWriter& raw(string_view json);
+
+    template<typename T>
+    JsonWriter& field(string_view name, T fieldValue) {
+        return key(name).value(fieldValue);
+    }
+
+    const char* data() const;
+    size_t size() const;
+};
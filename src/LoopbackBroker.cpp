@@ -0,0 +1,200 @@
+#include "LoopbackBroker.hpp"
+#include <algorithm>
+#include "Metrics.cpp"
+using namespace std;
+
+
+bool LoopbackBroker::topicMatches(string_view pattern, string_view topic) {
+    // Wildcards at the first level don't match the system topics
+    if(!topic.empty() && topic[0] == '$' && !pattern.empty() && (pattern[0] == '+' || pattern[0] == '#')) {
+        return false;
+    }
+    size_t p = 0, t = 0;
+    while(true) {
+        size_t patternEnd = min(pattern.find('/', p), pattern.size());
+        size_t topicEnd = min(topic.find('/', t), topic.size());
+        string_view level = pattern.substr(p, patternEnd - p);
+        // Matches the rest of the topic
+        if(level == "#") {
+            return true;
+        }
+        if(level != "+" && level != topic.substr(t, topicEnd - t)) {
+            return false;
+        }
+        bool patternDone = patternEnd == pattern.size(), topicDone = topicEnd == topic.size();
+        if(patternDone || topicDone) {
+            // "a/#" also matches "a"
+            return patternDone ? topicDone : pattern.substr(patternEnd + 1) == "#";
+        }
+        p = patternEnd + 1;
+        t = topicEnd + 1;
+    }
+}
+
+void LoopbackBroker::subscribe(LoopbackTransport* client, const string& pattern, int qos) {
+    unique_lock<shared_mutex> lock(subscriptionsMutex);
+    for(auto& subscription : subscriptions) {
+        if(subscription.client == client && subscription.pattern == pattern) {
+            subscription.qos = qos;
+            return;
+        }
+    }
+    subscriptions.push_back({ .pattern = pattern, .qos = qos, .client = client });
+}
+
+void LoopbackBroker::removeClient(LoopbackTransport* client) {
+    unique_lock<shared_mutex> lock(subscriptionsMutex);
+    subscriptions.erase(remove_if(subscriptions.begin(), subscriptions.end(), [client](const Subscription& subscription) {
+        return subscription.client == client;
+    }), subscriptions.end());
+}
+
+void LoopbackBroker::route(LoopbackTransport* sender, const string& topic, const string& payload, int qos) {
+    published++;
+    // Clients of the matching subscriptions and their highest QoS, reused by the next messages of the thread
+    thread_local vector<pair<LoopbackTransport*, int>> targets;
+    targets.clear();
+    shared_lock<shared_mutex> lock(subscriptionsMutex);
+    for(auto& subscription : subscriptions) {
+        if(!topicMatches(subscription.pattern, topic)) {
+            continue;
+        }
+        auto it = find_if(targets.begin(), targets.end(), [&subscription](const pair<LoopbackTransport*, int>& target) {
+            return target.first == subscription.client;
+        });
+        if(it == targets.end()) {
+            targets.push_back({ subscription.client, subscription.qos });
+        } else {
+            it->second = max(it->second, subscription.qos);
+        }
+    }
+    if(targets.empty()) {
+        unmatched++;
+        return;
+    }
+    for(auto& target : targets) {
+        int deliveryQos = min(qos, target.second);
+        if(target.first->deliver(topic, payload, deliveryQos, deliveryQos >= 1 ? sender->acks : nullptr)) {
+            delivered++;
+        } else {
+            dropped++;
+        }
+    }
+}
+
+LoopbackStats LoopbackBroker::getStats() {
+    LoopbackStats stats;
+    stats.published = published;
+    stats.delivered = delivered;
+    stats.dropped = dropped;
+    stats.unmatched = unmatched;
+    return stats;
+}
+
+LoopbackBroker& LoopbackBroker::shared() {
+    static LoopbackBroker broker;
+    return broker;
+}
+
+
+LoopbackTransport::LoopbackTransport(LoopbackBroker& broker, string clientId, size_t capacity)
+    : broker(broker), clientId(clientId), capacity(capacity), acks(make_shared<Acknowledgements>()) {}
+
+LoopbackTransport::~LoopbackTransport() {
+    disconnect();
+}
+
+void LoopbackTransport::connect() {
+    lock_guard<mutex> lock(inboxMutex);
+    connected = true;
+}
+
+void LoopbackTransport::disconnect() {
+    deque<Delivery> pending;
+    {
+        lock_guard<mutex> lock(inboxMutex);
+        connected = false;
+        pending.swap(inbox);
+    }
+    // Wakes up consume and the publishers waiting for room, before the broker is locked:
+    // a publisher waiting for this inbox holds the subscriptions lock
+    notEmpty.notify_all();
+    notFull.notify_all();
+    for(auto& delivery : pending) {
+        acknowledge(delivery.acks);
+    }
+    broker.removeClient(this);
+}
+
+void LoopbackTransport::subscribe(const vector<string>& topics, const vector<int>& qos) {
+    for(size_t i = 0; i < topics.size(); i++) {
+        broker.subscribe(this, topics[i], min(qos[i], 1));
+    }
+}
+
+bool LoopbackTransport::deliver(const string& topic, const string& payload, int qos,
+    const shared_ptr<Acknowledgements>& senderAcks) {
+    unique_lock<mutex> lock(inboxMutex);
+    if(qos == 0 && inbox.size() >= capacity) {
+        return false;
+    }
+    notFull.wait(lock, [this] { return inbox.size() < capacity || !connected; });
+    if(!connected) {
+        return false;
+    }
+    if(senderAcks) {
+        lock_guard<mutex> ackLock(senderAcks->ackMutex);
+        senderAcks->pending++;
+    }
+    inbox.push_back({ .topic = topic, .payload = payload, .acks = senderAcks, .arrival = metricsNow() });
+    lock.unlock();
+    notEmpty.notify_one();
+    return true;
+}
+
+void LoopbackTransport::acknowledge(const shared_ptr<Acknowledgements>& senderAcks) {
+    if(!senderAcks) {
+        return;
+    }
+    lock_guard<mutex> lock(senderAcks->ackMutex);
+    if(--senderAcks->pending == 0) {
+        senderAcks->acknowledged.notify_all();
+    }
+}
+
+bool LoopbackTransport::consume(string& topic, string& payload) {
+    unique_lock<mutex> lock(inboxMutex);
+    notEmpty.wait(lock, [this] { return !inbox.empty() || !connected; });
+    if(inbox.empty()) {
+        return false;
+    }
+    Delivery delivery = std::move(inbox.front());
+    inbox.pop_front();
+    lock.unlock();
+    notFull.notify_one();
+    topic = std::move(delivery.topic);
+    payload = std::move(delivery.payload);
+    consumedArrival = delivery.arrival;
+    acknowledge(delivery.acks);
+    return true;
+}
+
+uint64_t LoopbackTransport::lastArrival() {
+    return consumedArrival;
+}
+
+bool LoopbackTransport::publish(const string& topic, const string& payload, int qos) {
+    {
+        lock_guard<mutex> lock(inboxMutex);
+        if(!connected) {
+            return false;
+        }
+    }
+    broker.route(this, topic, payload, qos);
+    return true;
+}
+
+void LoopbackTransport::flush(chrono::milliseconds timeout) {
+    unique_lock<mutex> lock(acks->ackMutex);
+    acks->acknowledged.wait_for(lock, timeout, [this] { return acks->pending == 0; });
+}
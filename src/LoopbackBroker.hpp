@@ -0,0 +1,115 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "MqttTransport.hpp"
+using namespace std;
+
+// Messages waiting in the inbox of a loopback client. Past it, QoS 0 messages are dropped and QoS 1 publishers wait.
+#ifndef LOOPBACK_INBOX_CAPACITY
+#define LOOPBACK_INBOX_CAPACITY 65536
+#endif
+
+typedef struct LoopbackStats {
+    uint64_t published;
+    // Copies put in the inboxes of the subscribers
+    uint64_t delivered;
+    // QoS 0 copies dropped because the inbox was full
+    uint64_t dropped;
+    // Published messages no subscription matched
+    uint64_t unmatched;
+} LoopbackStats;
+
+class LoopbackTransport;
+
+/**
+ * MQTT broker inside the process, so that the baths can run and be measured without a network or mosquitto.
+ * It routes the messages of its clients to the matching subscriptions ("+" and "#" wildcards),
+ * each client receiving one copy at the highest QoS of its matching subscriptions, capped by the QoS of the message.
+ * QoS 0: the copy is dropped if the inbox of the subscriber is full. QoS 1: the publisher waits for room,
+ * and flush waits until the subscribers consumed its messages. Sessions are not kept and retained messages are not supported.
+*/
+class LoopbackBroker {
+private:
+    struct Subscription {
+        string pattern;
+        int qos;
+        LoopbackTransport* client;
+    };
+
+    vector<Subscription> subscriptions;
+    // Protects subscriptions. Publishing takes it shared.
+    shared_mutex subscriptionsMutex;
+
+    atomic<uint64_t> published { 0 };
+    atomic<uint64_t> delivered { 0 };
+    atomic<uint64_t> dropped { 0 };
+    atomic<uint64_t> unmatched { 0 };
+
+    friend class LoopbackTransport;
+    void subscribe(LoopbackTransport* client, const string& pattern, int qos);
+    void removeClient(LoopbackTransport* client);
+    void route(LoopbackTransport* sender, const string& topic, const string& payload, int qos);
+public:
+    // True if the topic matches the subscription pattern
+    static bool topicMatches(string_view pattern, string_view topic);
+
+    LoopbackStats getStats();
+
+    // Broker of LOOPBACK_ADDRESS, shared by the whole process
+    static LoopbackBroker& shared();
+};
+
+// Client of a LoopbackBroker
+class LoopbackTransport : public MqttTransport {
+private:
+    // Messages this client published with QoS 1 that were not consumed yet
+    struct Acknowledgements {
+        mutex ackMutex;
+        condition_variable acknowledged;
+        uint64_t pending = 0;
+    };
+    struct Delivery {
+        string topic;
+        string payload;
+        // Set for QoS 1, acknowledged when the message is consumed
+        shared_ptr<Acknowledgements> acks;
+        // Time it was put in the inbox
+        uint64_t arrival;
+    };
+
+    LoopbackBroker& broker;
+    const string clientId;
+    const size_t capacity;
+
+    deque<Delivery> inbox;
+    bool connected = false;
+    mutex inboxMutex;
+    condition_variable notEmpty;
+    condition_variable notFull;
+
+    shared_ptr<Acknowledgements> acks;
+    // Arrival of the last consumed message, only used by the consuming thread
+    uint64_t consumedArrival = 0;
+
+    friend class LoopbackBroker;
+    // Puts a copy of the message in the inbox. Returns false if it was dropped.
+    bool deliver(const string& topic, const string& payload, int qos, const shared_ptr<Acknowledgements>& senderAcks);
+    static void acknowledge(const shared_ptr<Acknowledgements>& senderAcks);
+public:
+    LoopbackTransport(LoopbackBroker& broker, string clientId, size_t capacity = LOOPBACK_INBOX_CAPACITY);
+    ~LoopbackTransport();
+
+    void connect() override;
+    void disconnect() override;
+    void subscribe(const vector<string>& topics, const vector<int>& qos) override;
+    bool consume(string& topic, string& payload) override;
+    uint64_t lastArrival() override;
+    bool publish(const string& topic, const string& payload, int qos) override;
+    void flush(chrono::milliseconds timeout) override;
+};
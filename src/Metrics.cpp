@@ -0,0 +1,214 @@
+#pragma once
+#include "Metrics.hpp"
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+#include <thread>
+#include "JsonWriter.cpp"
+#include "Trace.cpp"
+using namespace std;
+
+// Reference points of the tick calibration, taken when the process starts
+static const uint64_t startTicks = metricsNow();
+static const chrono::steady_clock::time_point startTime = chrono::steady_clock::now();
+
+// Bucket bounds written for the Prometheus histograms, in seconds
+static const double PROMETHEUS_BOUNDS[] = {
+    1e-6, 2.5e-6, 5e-6, 1e-5, 2.5e-5, 5e-5, 1e-4, 2.5e-4, 5e-4, 1e-3, 2.5e-3, 5e-3,
+    1e-2, 2.5e-2, 5e-2, 0.1, 0.25, 0.5, 1, 2.5, 5, 10
+};
+static const double PROMETHEUS_QUANTILES[] = { 0.5, 0.99, 0.999 };
+
+double metricsTickSeconds() {
+#if defined(__x86_64__) || defined(__i386__)
+    // The longer the interval, the better the estimate. It is at least 10 ms.
+    auto elapsed = chrono::steady_clock::now() - startTime;
+    if(elapsed < chrono::milliseconds(10)) {
+        this_thread::sleep_for(chrono::milliseconds(10) - elapsed);
+    }
+    uint64_t ticks = metricsNow();
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - startTime).count();
+    return seconds / (ticks - startTicks);
+#else
+    return 1e-9;
+#endif
+}
+
+uint64_t Counter::value() const {
+    uint64_t total = 0;
+    for(auto& shard : shards) {
+        total += shard.value.load(memory_order_relaxed);
+    }
+    return total;
+}
+
+Histogram::Histogram() : shards(make_unique<Shard[]>(METRICS_SHARDS)) {}
+
+uint64_t Histogram::bucketLowerBound(size_t bucket) {
+    if(bucket < 2 * HISTOGRAM_SUB_BUCKETS) {
+        return bucket;
+    }
+    int exponent = bucket / HISTOGRAM_SUB_BUCKETS + HISTOGRAM_SUB_BITS - 1;
+    uint64_t mantissa = bucket % HISTOGRAM_SUB_BUCKETS + HISTOGRAM_SUB_BUCKETS;
+    return mantissa << (exponent - HISTOGRAM_SUB_BITS);
+}
+
+void Histogram::snapshot(HistogramSnapshot& snapshot) const {
+    snapshot.count = 0;
+    snapshot.sum = 0;
+    for(size_t bucket = 0; bucket < HISTOGRAM_BUCKETS; bucket++) {
+        uint64_t total = 0;
+        for(size_t s = 0; s < METRICS_SHARDS; s++) {
+            total += shards[s].buckets[bucket].load(memory_order_relaxed);
+        }
+        snapshot.buckets[bucket] = total;
+        snapshot.count += total;
+    }
+    for(size_t s = 0; s < METRICS_SHARDS; s++) {
+        snapshot.sum += shards[s].sum.load(memory_order_relaxed);
+    }
+}
+
+double Histogram::quantile(const HistogramSnapshot& snapshot, double q) {
+    if(snapshot.count == 0) {
+        return 0;
+    }
+    uint64_t rank = (uint64_t)ceil(q * snapshot.count), seen = 0;
+    for(size_t bucket = 0; bucket < HISTOGRAM_BUCKETS; bucket++) {
+        seen += snapshot.buckets[bucket];
+        if(seen >= max(rank, (uint64_t)1)) {
+            return bucket + 1 < HISTOGRAM_BUCKETS ? bucketLowerBound(bucket + 1) - 1 : bucketLowerBound(bucket);
+        }
+    }
+    return bucketLowerBound(HISTOGRAM_BUCKETS - 1);
+}
+
+MetricsRegistry::Series& MetricsRegistry::getSeries(const string& name, const string& help, MetricType type,
+    const string& labels) {
+    lock_guard<mutex> lock(registryMutex);
+    auto family = find_if(families.begin(), families.end(), [&name](const Family& f) { return f.name == name; });
+    if(family == families.end()) {
+        families.push_back({ .name = name, .help = help, .type = type, .series = {} });
+        family = families.end() - 1;
+    } else if(family->type != type) {
+        throw std::runtime_error("METRIC_TYPE_MISMATCH");
+    }
+    for(auto& series : family->series) {
+        if(series.labels == labels) {
+            return series;
+        }
+    }
+    family->series.push_back({ .labels = labels, .counter = nullptr, .histogram = nullptr });
+    Series& series = family->series.back();
+    if(type == MetricType::Counter) {
+        series.counter = make_unique<Counter>();
+    } else {
+        series.histogram = make_unique<Histogram>();
+    }
+    return series;
+}
+
+Counter& MetricsRegistry::counter(const string& name, const string& help, const string& labels) {
+    return *getSeries(name, help, MetricType::Counter, labels).counter;
+}
+
+Histogram& MetricsRegistry::histogram(const string& name, const string& help, const string& labels) {
+    return *getSeries(name, help, MetricType::Histogram, labels).histogram;
+}
+
+// Writes name{labels,extra}
+static void appendSeries(string& out, const string& name, const string& labels, const string& extra) {
+    out += name;
+    if(!labels.empty() || !extra.empty()) {
+        out += '{';
+        out += labels;
+        if(!labels.empty() && !extra.empty()) {
+            out += ',';
+        }
+        out += extra;
+        out += '}';
+    }
+    out += ' ';
+}
+
+static string formatBound(double value) {
+    string text;
+    appendNumber(text, value);
+    return text;
+}
+
+void MetricsRegistry::writePrometheus(string& out) {
+    double tickSeconds = metricsTickSeconds();
+    HistogramSnapshot snapshot;
+    lock_guard<mutex> lock(registryMutex);
+    for(auto& family : families) {
+        bool histogram = family.type == MetricType::Histogram;
+        out += "# HELP " + family.name + " " + family.help + "\n";
+        out += "# TYPE " + family.name + (histogram ? " histogram\n" : " counter\n");
+        for(auto& series : family.series) {
+            if(!histogram) {
+                appendSeries(out, family.name, series.labels, "");
+                appendNumber(out, series.counter->value());
+                out += '\n';
+                continue;
+            }
+            series.histogram->snapshot(snapshot);
+            // A bucket is counted under a bound once its lowest value is, so the counts are exact within a bucket width
+            size_t bucket = 0;
+            uint64_t cumulative = 0;
+            for(double bound : PROMETHEUS_BOUNDS) {
+                while(bucket < HISTOGRAM_BUCKETS && Histogram::bucketLowerBound(bucket) * tickSeconds <= bound) {
+                    cumulative += snapshot.buckets[bucket++];
+                }
+                appendSeries(out, family.name + "_bucket", series.labels, "le=\"" + formatBound(bound) + "\"");
+                appendNumber(out, cumulative);
+                out += '\n';
+            }
+            appendSeries(out, family.name + "_bucket", series.labels, "le=\"+Inf\"");
+            appendNumber(out, snapshot.count);
+            out += '\n';
+            appendSeries(out, family.name + "_sum", series.labels, "");
+            appendNumber(out, snapshot.sum * tickSeconds);
+            out += '\n';
+            appendSeries(out, family.name + "_count", series.labels, "");
+            appendNumber(out, snapshot.count);
+            out += '\n';
+        }
+        if(!histogram) {
+            continue;
+        }
+        // Quantiles at the full precision of the buckets
+        out += "# HELP " + family.name + "_quantile Quantiles of " + family.name + "\n";
+        out += "# TYPE " + family.name + "_quantile gauge\n";
+        for(auto& series : family.series) {
+            series.histogram->snapshot(snapshot);
+            for(double q : PROMETHEUS_QUANTILES) {
+                appendSeries(out, family.name + "_quantile", series.labels, "quantile=\"" + formatBound(q) + "\"");
+                appendNumber(out, Histogram::quantile(snapshot, q) * tickSeconds);
+                out += '\n';
+            }
+        }
+    }
+}
+
+MetricsRegistry& MetricsRegistry::global() {
+    static MetricsRegistry registry;
+    return registry;
+}
+
+Counter& swallowedErrors(const string& site) {
+    return MetricsRegistry::global().counter("smartbath_swallowed_errors_total",
+        "Exceptions caught and ignored", "site=\"" + site + "\"");
+}
+
+Counter& malformedPayloads(const string& topic) {
+    return MetricsRegistry::global().counter("smartbath_malformed_payloads_total",
+        "MQTT messages whose payload could not be parsed", "topic=\"" + topic + "\"");
+}
+
+MeteredMutex::MeteredMutex(const char* name)
+    : wait(MetricsRegistry::global().histogram("smartbath_mutex_wait_seconds",
+          "Time spent waiting for a mutex held by another thread", string("mutex=\"") + name + "\"")),
+      hold(MetricsRegistry::global().histogram("smartbath_mutex_hold_seconds",
+          "Time a mutex was held", string("mutex=\"") + name + "\"")),
+      name(name) {}
@@ -0,0 +1,228 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+#include "Trace.hpp"
+using namespace std;
+
+// Shards of the counters and histograms. Each thread records into its own shard, so the
+// cache lines are not shared by the threads that record at the same time.
+#ifndef METRICS_SHARDS
+#define METRICS_SHARDS 16
+#endif
+// A MeteredMutex records the hold time of one lock in this many, per thread
+#ifndef METRICS_HOLD_SAMPLE
+#define METRICS_HOLD_SAMPLE 16
+#endif
+// Histogram buckets per power of two (8: 3 bits of precision, the value is known within 12.5%)
+#define HISTOGRAM_SUB_BITS 3
+#define HISTOGRAM_SUB_BUCKETS (1 << HISTOGRAM_SUB_BITS)
+// Larger values are counted in the last bucket (2^40 ticks, minutes)
+#define HISTOGRAM_MAX_EXPONENT 40
+#define HISTOGRAM_BUCKETS ((HISTOGRAM_MAX_EXPONENT - HISTOGRAM_SUB_BITS + 2) * HISTOGRAM_SUB_BUCKETS)
+
+// Timestamp of the metrics, in ticks of the cycle counter where there is one (a few nanoseconds to read),
+// in nanoseconds otherwise. Ticks are converted to seconds when the metrics are written.
+inline uint64_t metricsNow() {
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    return chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+}
+
+// Seconds per tick, measured against steady_clock since the start of the process
+double metricsTickSeconds();
+
+// Shard of the calling thread, assigned round-robin on its first record
+inline size_t metricsShard() {
+    static atomic<size_t> nextShard { 0 };
+    static thread_local size_t shard = nextShard.fetch_add(1, memory_order_relaxed) % METRICS_SHARDS;
+    return shard;
+}
+
+// Monotonic counter. Adding is a relaxed increment of the shard of the thread.
+class Counter {
+private:
+    struct alignas(64) Shard {
+        atomic<uint64_t> value { 0 };
+    };
+    Shard shards[METRICS_SHARDS];
+public:
+    void add(uint64_t count = 1) {
+        shards[metricsShard()].value.fetch_add(count, memory_order_relaxed);
+    }
+
+    uint64_t value() const;
+};
+
+typedef struct HistogramSnapshot {
+    uint64_t buckets[HISTOGRAM_BUCKETS];
+    uint64_t count;
+    // Sum of the recorded values, in ticks
+    uint64_t sum;
+} HistogramSnapshot;
+
+/**
+ * Durations in ticks, counted in log-linear buckets like an HDR histogram: the values below 16 have a bucket each,
+ * then every power of two is split in HISTOGRAM_SUB_BUCKETS. Recording is two relaxed increments in the shard of the thread.
+*/
+class Histogram {
+private:
+    struct alignas(64) Shard {
+        atomic<uint64_t> buckets[HISTOGRAM_BUCKETS] = {};
+        atomic<uint64_t> sum { 0 };
+    };
+    unique_ptr<Shard[]> shards;
+public:
+    Histogram();
+
+    static size_t bucketOf(uint64_t value) {
+        if(value < 2 * HISTOGRAM_SUB_BUCKETS) {
+            return value;
+        }
+        int exponent = 63 - __builtin_clzll(value);
+        if(exponent > HISTOGRAM_MAX_EXPONENT) {
+            return HISTOGRAM_BUCKETS - 1;
+        }
+        return (exponent - HISTOGRAM_SUB_BITS) * HISTOGRAM_SUB_BUCKETS + (value >> (exponent - HISTOGRAM_SUB_BITS));
+    }
+
+    // Smallest value counted in the bucket
+    static uint64_t bucketLowerBound(size_t bucket);
+
+    void record(uint64_t value) {
+        Shard& shard = shards[metricsShard()];
+        shard.buckets[bucketOf(value)].fetch_add(1, memory_order_relaxed);
+        shard.sum.fetch_add(value, memory_order_relaxed);
+    }
+
+    // Sums the shards. The records made meanwhile may be partly included.
+    void snapshot(HistogramSnapshot& snapshot) const;
+
+    // Value under which the quantile q of the records are, in ticks (upper bound of its bucket)
+    static double quantile(const HistogramSnapshot& snapshot, double q);
+};
+
+// Records the time from its construction to its destruction in a histogram
+class ScopedTimer {
+private:
+    Histogram& histogram;
+    const uint64_t begin;
+public:
+    explicit ScopedTimer(Histogram& histogram) : histogram(histogram), begin(metricsNow()) {}
+    ~ScopedTimer() {
+        histogram.record(metricsNow() - begin);
+    }
+};
+
+/**
+ * Counters and histograms of the process, written in the Prometheus text format by GET /metrics.
+ * A series is registered once (under a lock) and then recorded without locking; the returned references stay valid.
+*/
+class MetricsRegistry {
+private:
+    enum class MetricType { Counter, Histogram };
+    struct Series {
+        // Prometheus labels without the braces, like route="/volume"
+        string labels;
+        unique_ptr<Counter> counter;
+        unique_ptr<Histogram> histogram;
+    };
+    struct Family {
+        string name;
+        string help;
+        MetricType type;
+        deque<Series> series;
+    };
+
+    deque<Family> families;
+    mutex registryMutex;
+
+    Series& getSeries(const string& name, const string& help, MetricType type, const string& labels);
+public:
+    Counter& counter(const string& name, const string& help, const string& labels = "");
+    // The histogram records durations in ticks, its name should end with _seconds
+    Histogram& histogram(const string& name, const string& help, const string& labels = "");
+
+    // Histograms are written with cumulative buckets from 1 µs to 10 s, and a <name>_quantile gauge of their p50, p99 and p999
+    void writePrometheus(string& out);
+
+    static MetricsRegistry& global();
+};
+
+// Exceptions caught and ignored at the given site, which would otherwise go unnoticed
+Counter& swallowedErrors(const string& site);
+// Messages of the given topic whose payload could not be parsed
+Counter& malformedPayloads(const string& topic);
+
+/**
+ * Mutex recording how long it was held and, when lock had to wait for it, how long it waited, in the histograms
+ * smartbath_mutex_hold_seconds and smartbath_mutex_wait_seconds labeled with its name.
+ * Every wait is recorded, but only one hold in METRICS_HOLD_SAMPLE locks of each thread, so that most uncontended
+ * locks and unlocks do not read the clock. While tracing, every hold is also a span of the trace.
+*/
+class MeteredMutex {
+private:
+    mutex inner;
+    Histogram& wait;
+    Histogram& hold;
+    // A string literal, it names the spans of the trace
+    const char* name;
+    // Written by the owner only, 0 when the hold is not sampled
+    uint64_t lockedAt = 0;
+    bool traced = false;
+
+    // Start of the hold if this lock of the calling thread is sampled, 0 otherwise
+    static uint64_t sampleHold() {
+        static thread_local uint32_t locks = 0;
+        return ++locks % METRICS_HOLD_SAMPLE == 0 ? metricsNow() : 0;
+    }
+
+    void traceHold() {
+        traced = tracing();
+        if(traced) {
+            traceRecord('B', "mutex", name);
+        }
+    }
+public:
+    explicit MeteredMutex(const char* name);
+
+    void lock() {
+        if(!inner.try_lock()) {
+            uint64_t begin = metricsNow();
+            inner.lock();
+            wait.record(metricsNow() - begin);
+        }
+        lockedAt = sampleHold();
+        traceHold();
+    }
+
+    bool try_lock() {
+        if(!inner.try_lock()) {
+            return false;
+        }
+        lockedAt = sampleHold();
+        traceHold();
+        return true;
+    }
+
+    void unlock() {
+        uint64_t begin = lockedAt;
+        if(traced) {
+            traceRecord('E', "mutex", name);
+        }
+        inner.unlock();
+        if(begin != 0) {
+            hold.record(metricsNow() - begin);
+        }
+    }
+};
@@ -0,0 +1,102 @@
+#include "MqttPublisher.hpp"
+#include <iostream>
+#include "Metrics.cpp"
+using namespace std;
+
+
+MqttPublisher::MqttPublisher(unique_ptr<MqttTransport> transport, size_t queueCapacity, size_t batchSize)
+    : transport(std::move(transport)), queue(queueCapacity), batchSize(batchSize) {
+    publisherThread = std::thread(publishMessages, this);
+}
+
+MqttPublisher::~MqttPublisher() {
+    stop();
+}
+
+void MqttPublisher::stop() {
+    if(!running.exchange(false)) {
+        return;
+    }
+    waitCondition.notify_one();
+    publisherThread.join();
+}
+
+bool MqttPublisher::publish(string topic, string payload) {
+    OutboundMessage message = { .topic = std::move(topic), .payload = std::move(payload), .queuedAt = metricsNow() };
+    if(!queue.tryPush(std::move(message))) {
+        dropped++;
+        return false;
+    }
+    enqueued++;
+    if(waiting) {
+        waitCondition.notify_one();
+    }
+    return true;
+}
+
+size_t MqttPublisher::publishBatch() {
+    static Histogram& latency = MetricsRegistry::global().histogram("smartbath_mqtt_publish_seconds",
+        "Time from queuing a message to handing it to the transport");
+    OutboundMessage message;
+    size_t count = 0;
+    while(count < batchSize && queue.tryPop(message)) {
+        count++;
+        if(transport->publish(message.topic, message.payload, 0)) {
+            latency.record(metricsNow() - message.queuedAt);
+            sent++;
+#ifdef MQTT_LOG_SENT
+            cout << "[Sent] " << message.topic << ": " << message.payload << "\n";
+#endif
+        } else {
+            failed++;
+        }
+    }
+    if(count == 0) {
+        return 0;
+    }
+    batches++;
+    // Waiting for the last message of the batch bounds the number of messages in flight.
+    // Only this thread waits, the callers of publish are never blocked.
+    transport->flush(chrono::seconds(1));
+    return count;
+}
+
+void MqttPublisher::publishMessages(MqttPublisher* publisher) {
+    setTraceThreadName("publisher");
+    try {
+        publisher->transport->connect();
+    } catch(const runtime_error& exc) {
+        cerr << "\n  " << exc.what() << endl;
+    }
+
+    while(publisher->running) {
+        if(publisher->publishBatch() > 0) {
+            continue;
+        }
+        // The queue is empty: sleep until publish notifies us.
+        // The timeout covers a message pushed between the empty check and the wait.
+        unique_lock<mutex> lock(publisher->waitMutex);
+        publisher->waiting = true;
+        publisher->waitCondition.wait_for(lock, chrono::milliseconds(10));
+        publisher->waiting = false;
+    }
+
+    // Publish what is left before disconnecting
+    while(publisher->publishBatch() > 0);
+#ifdef MQTT_LOG_SENT
+    cout << flush;
+#endif
+    publisher->transport->disconnect();
+}
+
+PublisherStats MqttPublisher::getStats() {
+    PublisherStats stats;
+    stats.queueDepth = queue.size();
+    stats.queueCapacity = queue.capacity();
+    stats.enqueued = enqueued;
+    stats.sent = sent;
+    stats.dropped = dropped;
+    stats.failed = failed;
+    stats.batches = batches;
+    return stats;
+}
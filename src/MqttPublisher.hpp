@@ -0,0 +1,75 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+#include "BoundedQueue.hpp"
+#include "MqttTransport.hpp"
+using namespace std;
+
+// Build with -DMQTT_LOG_SENT to print every published message on stdout.
+// It is off by default, since it is a locked stream write per message on the publisher thread.
+
+// Message waiting to be published
+typedef struct OutboundMessage {
+    string topic;
+    string payload;
+    // Time it was queued (metricsNow)
+    uint64_t queuedAt;
+} OutboundMessage;
+
+typedef struct PublisherStats {
+    // Messages waiting in the queue
+    size_t queueDepth;
+    size_t queueCapacity;
+    uint64_t enqueued;
+    uint64_t sent;
+    // Messages rejected because the queue was full
+    uint64_t dropped;
+    // Messages rejected by the MQTT client
+    uint64_t failed;
+    uint64_t batches;
+} PublisherStats;
+
+// Publishes MQTT messages from a dedicated thread.
+// Callers only push the message in a lock-free queue, so they never wait for the broker.
+// The thread drains the queue in batches through its own transport.
+class MqttPublisher {
+private:
+    unique_ptr<MqttTransport> transport;
+    BoundedQueue<OutboundMessage> queue;
+    const size_t batchSize;
+
+    std::thread publisherThread;
+    atomic<bool> running { true };
+    // Set while the thread waits for messages, so that publish only notifies when it is needed
+    atomic<bool> waiting { false };
+    mutex waitMutex;
+    condition_variable waitCondition;
+
+    atomic<uint64_t> enqueued { 0 };
+    atomic<uint64_t> sent { 0 };
+    atomic<uint64_t> dropped { 0 };
+    atomic<uint64_t> failed { 0 };
+    atomic<uint64_t> batches { 0 };
+
+    static void publishMessages(MqttPublisher* publisher);
+    // Publishes up to batchSize messages. Returns the number of messages taken from the queue.
+    size_t publishBatch();
+public:
+    // The thread connects the transport and disconnects it when it stops
+    MqttPublisher(unique_ptr<MqttTransport> transport, size_t queueCapacity = 65536, size_t batchSize = 64);
+    ~MqttPublisher();
+
+    /**
+     * Queues the message and returns immediately.
+     * @returns false if the queue is full and the message was dropped.
+    */
+    bool publish(string topic, string payload);
+
+    PublisherStats getStats();
+
+    // Publishes the queued messages and stops the thread. Called by the destructor.
+    void stop();
+};
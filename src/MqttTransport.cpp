@@ -0,0 +1,12 @@
+#include "MqttTransport.hpp"
+#include "LoopbackBroker.cpp"
+#include "PahoTransport.cpp"
+using namespace std;
+
+
+unique_ptr<MqttTransport> makeTransport(const string& serverAddress, const string& clientId, bool persistentSession) {
+    if(serverAddress == LOOPBACK_ADDRESS) {
+        return make_unique<LoopbackTransport>(LoopbackBroker::shared(), clientId);
+    }
+    return make_unique<PahoTransport>(serverAddress, clientId, persistentSession);
+}
@@ -0,0 +1,39 @@
+#pragma once
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+using namespace std;
+
+// Server address of the in-process broker (see LoopbackBroker), in place of "tcp://host:port"
+#define LOOPBACK_ADDRESS "loopback"
+
+// Connection of a client to a MQTT broker. The registry receives through one, the publisher sends through another.
+// consume is called by a single thread, publish and flush by a single thread, disconnect by any thread.
+class MqttTransport {
+public:
+    virtual ~MqttTransport() {}
+
+    // Throws runtime_error if the broker can't be reached
+    virtual void connect() = 0;
+    // Ends the session. A consume waiting for a message returns false.
+    virtual void disconnect() = 0;
+
+    virtual void subscribe(const vector<string>& topics, const vector<int>& qos) = 0;
+    // Waits for the next message of the subscriptions. Returns false once the transport is disconnected.
+    virtual bool consume(string& topic, string& payload) = 0;
+    // Time (metricsNow) at which the message returned by the last consume reached the transport, 0 if it is not known
+    virtual uint64_t lastArrival() { return 0; }
+
+    // Returns false if the message was rejected
+    virtual bool publish(const string& topic, const string& payload, int qos) = 0;
+    // Waits until the QoS 1 messages published so far are acknowledged, at most timeout
+    virtual void flush(chrono::milliseconds timeout) = 0;
+};
+
+/**
+ * Transport to the broker at serverAddress: the in-process broker of LOOPBACK_ADDRESS, a Paho client otherwise.
+ * A persistent session keeps the subscriptions of clientId on the broker between connections.
+*/
+unique_ptr<MqttTransport> makeTransport(const string& serverAddress, const string& clientId, bool persistentSession);
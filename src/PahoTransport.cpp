@@ -0,0 +1,75 @@
+#include "PahoTransport.hpp"
+#include <stdexcept>
+using namespace std;
+
+
+PahoTransport::PahoTransport(string serverAddress, string clientId, bool persistentSession)
+    : client(serverAddress, clientId), persistentSession(persistentSession) {}
+
+PahoTransport::~PahoTransport() {
+    disconnect();
+}
+
+void PahoTransport::connect() {
+    auto builder = mqtt::connect_options_builder();
+    builder.clean_session(!persistentSession);
+    if(!persistentSession) {
+        builder.automatic_reconnect(chrono::seconds(1), chrono::seconds(30))
+            .max_inflight(PAHO_MAX_INFLIGHT);
+    }
+    // The messages are queued from the connection on, for consume
+    client.start_consuming();
+    try {
+        client.connect(builder.finalize())->wait();
+    } catch(const mqtt::exception& exc) {
+        throw std::runtime_error(exc.what());
+    }
+}
+
+void PahoTransport::disconnect() {
+    try {
+        if(client.is_connected()) {
+            client.disconnect()->wait();
+        }
+    } catch(const mqtt::exception& exc) { }
+}
+
+void PahoTransport::subscribe(const vector<string>& topics, const vector<int>& qos) {
+    try {
+        for(size_t i = 0; i < topics.size(); i++) {
+            client.subscribe(topics[i], qos[i])->wait();
+        }
+    } catch(const mqtt::exception& exc) {
+        throw std::runtime_error(exc.what());
+    }
+}
+
+bool PahoTransport::consume(string& topic, string& payload) {
+    auto msg = client.consume_message();
+    if(!msg) {
+        return false;
+    }
+    topic = msg->get_topic();
+    payload = msg->get_payload_str();
+    return true;
+}
+
+bool PahoTransport::publish(const string& topic, const string& payload, int qos) {
+    try {
+        lastToken = client.publish(topic, payload.data(), payload.size(), qos, false);
+        return true;
+    } catch(const mqtt::exception& exc) {
+        return false;
+    }
+}
+
+void PahoTransport::flush(chrono::milliseconds timeout) {
+    // The messages are delivered in order, so waiting for the last one bounds the messages in flight
+    if(!lastToken) {
+        return;
+    }
+    try {
+        lastToken->wait_for(timeout);
+    } catch(const mqtt::exception& exc) { }
+    lastToken.reset();
+}
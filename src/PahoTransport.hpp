@@ -0,0 +1,29 @@
+#pragma once
+#include "mqtt/async_client.h"
+#include "MqttTransport.hpp"
+using namespace std;
+
+// Messages a transport without a persistent session keeps in flight
+#ifndef PAHO_MAX_INFLIGHT
+#define PAHO_MAX_INFLIGHT 64
+#endif
+
+// Transport through a Paho async client, to a broker such as mosquitto
+class PahoTransport : public MqttTransport {
+private:
+    mqtt::async_client client;
+    const bool persistentSession;
+    // Last message published, waited for by flush
+    mqtt::delivery_token_ptr lastToken;
+public:
+    // Without a persistent session, the client reconnects automatically
+    PahoTransport(string serverAddress, string clientId, bool persistentSession);
+    ~PahoTransport();
+
+    void connect() override;
+    void disconnect() override;
+    void subscribe(const vector<string>& topics, const vector<int>& qos) override;
+    bool consume(string& topic, string& payload) override;
+    bool publish(const string& topic, const string& payload, int qos) override;
+    void flush(chrono::milliseconds timeout) override;
+};
@@ -0,0 +1,265 @@
+#include "ProfileStore.hpp"
+#include "JsonWriter.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <charconv>
+#include <cstring>
+#include <fcntl.h>
+#include <fstream>
+#include <iostream>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+using namespace std;
+
+static const char PROFILE_STORE_MAGIC[8] = { 'S', 'B', 'P', 'R', 'O', 'F', 'S', 0 };
+static const uint32_t PROFILE_STORE_BYTE_ORDER = 0x01020304;
+
+
+void appendProfileRecord(string& out, string_view name, UserProfile profile) {
+    out += name;
+    out += ',';
+    appendNumber(out, profile.weight);
+    out += ',';
+    appendNumber(out, profile.preferredBathTemperature);
+    out += ',';
+    appendNumber(out, profile.preferredShowerTemperature);
+}
+
+bool parseProfileRecord(string_view line, string& name, UserProfile& profile) {
+    double* fields[] = { &profile.preferredShowerTemperature, &profile.preferredBathTemperature, &profile.weight };
+    for(double* field : fields) {
+        size_t comma = line.rfind(',');
+        if(comma == string_view::npos) {
+            return false;
+        }
+        string_view token = line.substr(comma + 1);
+        // Files written by Windows editors end their lines with \r
+        if(!token.empty() && token.back() == '\r') {
+            token.remove_suffix(1);
+        }
+        auto result = from_chars(token.data(), token.data() + token.size(), *field);
+        if(result.ec != errc() || result.ptr != token.data() + token.size()) {
+            return false;
+        }
+        line = line.substr(0, comma);
+    }
+    if(line.empty()) {
+        return false;
+    }
+    name = line;
+    return true;
+}
+
+ProfileStore::~ProfileStore() {
+    close();
+}
+
+void ProfileStore::close() {
+    if(mapping != nullptr) {
+        ::munmap((void*)mapping, mappingSize);
+    }
+    if(fd >= 0) {
+        ::close(fd);
+    }
+    fd = -1;
+    mapping = nullptr;
+    mappingSize = 0;
+    records = nullptr;
+    count = 0;
+    names = nullptr;
+    namesSize = 0;
+}
+
+bool ProfileStore::open(const string& path) {
+    int file = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if(file < 0) {
+        return false;
+    }
+    struct stat status;
+    if(::fstat(file, &status) != 0 || (size_t)status.st_size < sizeof(ProfileStoreHeader)) {
+        ::close(file);
+        return false;
+    }
+    size_t size = status.st_size;
+    void* data = ::mmap(nullptr, size, PROT_READ, MAP_SHARED, file, 0);
+    if(data == MAP_FAILED) {
+        ::close(file);
+        return false;
+    }
+    // Only the header is checked, the names are checked when they are read
+    ProfileStoreHeader header;
+    memcpy(&header, data, sizeof(header));
+    bool valid = memcmp(header.magic, PROFILE_STORE_MAGIC, sizeof(header.magic)) == 0
+        && header.version == PROFILE_STORE_VERSION
+        && header.byteOrder == PROFILE_STORE_BYTE_ORDER
+        && header.recordsOffset % alignof(ProfileStoreRecord) == 0
+        && header.recordsOffset <= size
+        && header.count <= (size - header.recordsOffset) / sizeof(ProfileStoreRecord)
+        && header.namesOffset <= size
+        && header.namesSize <= size - header.namesOffset;
+    if(!valid) {
+        ::munmap(data, size);
+        ::close(file);
+        return false;
+    }
+    // Lookups jump around the file, reading ahead would only waste memory
+    ::madvise(data, size, MADV_RANDOM);
+    close();
+    fd = file;
+    mapping = (const char*)data;
+    mappingSize = size;
+    records = (const ProfileStoreRecord*)(mapping + header.recordsOffset);
+    count = header.count;
+    names = mapping + header.namesOffset;
+    namesSize = header.namesSize;
+    return true;
+}
+
+size_t ProfileStore::size() const {
+    return count;
+}
+
+string_view ProfileStore::nameAt(size_t i) const {
+    const ProfileStoreRecord& record = records[i];
+    if(record.nameOffset > namesSize || record.nameLength > namesSize - record.nameOffset) {
+        return string_view();
+    }
+    return string_view(names + record.nameOffset, record.nameLength);
+}
+
+UserProfile ProfileStore::profileAt(size_t i) const {
+    return records[i].profile;
+}
+
+bool ProfileStore::find(string_view name, UserProfile& profile) const {
+    size_t low = 0, high = count;
+    while(low < high) {
+        size_t middle = low + (high - low) / 2;
+        int order = nameAt(middle).compare(name);
+        if(order == 0) {
+            profile = records[middle].profile;
+            return true;
+        }
+        if(order < 0) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+    return false;
+}
+
+// Buffers the writes of a section of the file, which is written at increasing offsets
+class SectionWriter {
+private:
+    int fd;
+    uint64_t offset;
+    string buffer;
+    bool failed = false;
+public:
+    SectionWriter(int fd, uint64_t offset) : fd(fd), offset(offset) {
+        buffer.reserve(1 << 16);
+    }
+
+    void append(const void* data, size_t size) {
+        buffer.append((const char*)data, size);
+        if(buffer.size() >= (1 << 16)) {
+            flush();
+        }
+    }
+
+    bool flush() {
+        const char* data = buffer.data();
+        size_t size = buffer.size();
+        while(!failed && size > 0) {
+            ssize_t written = ::pwrite(fd, data, size, offset);
+            if(written < 0 && errno == EINTR) {
+                continue;
+            }
+            if(written < 0) {
+                failed = true;
+                break;
+            }
+            data += written;
+            size -= written;
+            offset += written;
+        }
+        buffer.clear();
+        return !failed;
+    }
+};
+
+bool ProfileStore::write(int fd, const ProfileSource& source) {
+    uint64_t profileCount = 0, nameBytes = 0;
+    source([&](string_view name, const UserProfile&) {
+        profileCount++;
+        nameBytes += name.size();
+    });
+
+    ProfileStoreHeader header = {};
+    memcpy(header.magic, PROFILE_STORE_MAGIC, sizeof(header.magic));
+    header.version = PROFILE_STORE_VERSION;
+    header.byteOrder = PROFILE_STORE_BYTE_ORDER;
+    header.count = profileCount;
+    header.recordsOffset = sizeof(ProfileStoreHeader);
+    header.namesOffset = header.recordsOffset + profileCount * sizeof(ProfileStoreRecord);
+    header.namesSize = nameBytes;
+
+    SectionWriter recordsSection(fd, header.recordsOffset);
+    SectionWriter namesSection(fd, header.namesOffset);
+    SectionWriter headerSection(fd, 0);
+    uint64_t nameOffset = 0, written = 0;
+    source([&](string_view name, const UserProfile& profile) {
+        // The source must give the same profiles on both passes
+        if(++written > profileCount || nameOffset + name.size() > nameBytes) {
+            return;
+        }
+        ProfileStoreRecord record = {
+            .nameOffset = nameOffset,
+            .nameLength = (uint32_t)name.size(),
+            .reserved = 0,
+            .profile = profile
+        };
+        recordsSection.append(&record, sizeof(record));
+        namesSection.append(name.data(), name.size());
+        nameOffset += name.size();
+    });
+    headerSection.append(&header, sizeof(header));
+    return written == profileCount && recordsSection.flush() && namesSection.flush() && headerSection.flush();
+}
+
+long long ProfileStore::convertCsv(const string& csvPath, int fd) {
+    vector<pair<string, UserProfile>> profiles;
+    ifstream csvFile(csvPath);
+    string line, name;
+    UserProfile profile;
+    while(getline(csvFile, line)) {
+        if(line.empty()) {
+            continue;
+        }
+        if(parseProfileRecord(line, name, profile)) {
+            profiles.push_back({ name, profile });
+        } else {
+            cout << "Profiles file seems to be corrupted.\n";
+        }
+    }
+    csvFile.close();
+    // The last line of a name wins, as it did when the lines were inserted in the map
+    stable_sort(profiles.begin(), profiles.end(), [](const auto& a, const auto& b) { return a.first < b.first; });
+    auto source = [&](const ProfileCallback& emit) {
+        for(size_t i = 0; i < profiles.size(); i++) {
+            if(i + 1 == profiles.size() || profiles[i + 1].first != profiles[i].first) {
+                emit(profiles[i].first, profiles[i].second);
+            }
+        }
+    };
+
+    if(!write(fd, source)) {
+        return -1;
+    }
+    long long converted = 0;
+    source([&](string_view, const UserProfile&) { converted++; });
+    return converted;
+}
@@ -0,0 +1,96 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <string_view>
+using namespace std;
+
+#define PROFILE_STORE_VERSION 1
+
+typedef struct UserProfile {
+    double weight; // 20 - 120 kg
+    double preferredBathTemperature;
+    double preferredShowerTemperature;
+} UserProfile;
+
+// Layout of a profile store file. Numbers are in the byte order of the host that wrote the file:
+//   header | records, sorted by name | names
+typedef struct ProfileStoreHeader {
+    // "SBPROFS" followed by a 0
+    char magic[8];
+    uint32_t version;
+    // 0x01020304, to reject a file written with another byte order
+    uint32_t byteOrder;
+    uint64_t count;
+    uint64_t recordsOffset;
+    uint64_t namesOffset;
+    uint64_t namesSize;
+} ProfileStoreHeader;
+
+typedef struct ProfileStoreRecord {
+    // Position of the name in the names section
+    uint64_t nameOffset;
+    uint32_t nameLength;
+    uint32_t reserved;
+    UserProfile profile;
+} ProfileStoreRecord;
+
+// Appends "name,weight,bathTemperature,showerTemperature", the line of a profile in the CSV files
+void appendProfileRecord(string& out, string_view name, UserProfile profile);
+/**
+ * Parses a line written by appendProfileRecord.
+ * The numbers are taken from the end, so that a name containing commas is read back whole.
+ * @returns false if the line is malformed.
+*/
+bool parseProfileRecord(string_view line, string& name, UserProfile& profile);
+
+/**
+ * Read-only profiles file, memory mapped.
+ * Opening it only validates the header, and a lookup is a binary search on the mapped records,
+ * so neither depends on loading the profiles. Only the pages touched by the lookups are read from the disk.
+*/
+class ProfileStore {
+private:
+    int fd = -1;
+    const char* mapping = nullptr;
+    size_t mappingSize = 0;
+    const ProfileStoreRecord* records = nullptr;
+    size_t count = 0;
+    const char* names = nullptr;
+    size_t namesSize = 0;
+public:
+    // Calls emit with each profile, in increasing name order
+    typedef function<void(string_view name, const UserProfile& profile)> ProfileCallback;
+    typedef function<void(const ProfileCallback& emit)> ProfileSource;
+
+    ProfileStore() = default;
+    ProfileStore(const ProfileStore&) = delete;
+    ProfileStore& operator=(const ProfileStore&) = delete;
+    ~ProfileStore();
+
+    /**
+     * Maps the file, replacing the current one.
+     * @returns false if the file does not exist or is not a valid store, leaving the current one mapped.
+    */
+    bool open(const string& path);
+    void close();
+
+    size_t size() const;
+    // Name and profile of the i-th profile in name order. A corrupted name is returned empty.
+    string_view nameAt(size_t i) const;
+    UserProfile profileAt(size_t i) const;
+    bool find(string_view name, UserProfile& profile) const;
+
+    /**
+     * Writes a store with the profiles of source into fd, which must be empty.
+     * The source is called twice: once to size the sections, once to write them.
+    */
+    static bool write(int fd, const ProfileSource& source);
+
+    /**
+     * Converts a profiles CSV file (the format of appendProfileRecord) into a store written into fd.
+     * @returns the number of profiles, or -1 if the store can't be written. Malformed lines are skipped.
+    */
+    static long long convertCsv(const string& csvPath, int fd);
+};
@@ -0,0 +1,50 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+using namespace std;
+
+// Holds a value that one writer at a time updates and any number of readers copy without locking.
+// The sequence is odd while a write is in progress, so a reader retries if it changed during its copy.
+// The value is stored as atomic words, so that a torn read is retried instead of being a data race.
+// Writers must be serialized by the caller.
+template<typename T>
+class Seqlock {
+private:
+    static_assert(is_trivially_copyable<T>::value, "Seqlock values are copied word by word");
+    static const size_t WORDS = (sizeof(T) + sizeof(uint64_t) - 1) / sizeof(uint64_t);
+
+    alignas(64) atomic<uint64_t> sequence { 0 };
+    atomic<uint64_t> words[WORDS] = {};
+public:
+    void store(const T& value) {
+        uint64_t buffer[WORDS] = {};
+        memcpy(buffer, &value, sizeof(T));
+        uint64_t seq = sequence.load(memory_order_relaxed);
+        sequence.store(seq + 1, memory_order_relaxed);
+        // The odd sequence must be visible before any of the words
+        atomic_thread_fence(memory_order_release);
+        for(size_t i = 0; i < WORDS; i++) {
+            words[i].store(buffer[i], memory_order_relaxed);
+        }
+        sequence.store(seq + 2, memory_order_release);
+    }
+
+    // Copies the last stored value. Returns its version, the number of stores before it.
+    uint64_t load(T& value) const {
+        uint64_t buffer[WORDS];
+        uint64_t before, after;
+        do {
+            before = sequence.load(memory_order_acquire);
+            for(size_t i = 0; i < WORDS; i++) {
+                buffer[i] = words[i].load(memory_order_relaxed);
+            }
+            // The words must be read before the sequence is checked again
+            atomic_thread_fence(memory_order_acquire);
+            after = sequence.load(memory_order_relaxed);
+        } while(before != after || (before & 1));
+        memcpy(&value, buffer, sizeof(T));
+        return before / 2;
+    }
+};
@@ -1,495 +1,1006 @@
 #include "SmartBath.hpp"
+#include "MqttPublisher.cpp"
+#include "Telemetry.cpp"
+#include "EventStream.cpp"
+#include "History.cpp"
+#include "WaterAnalytics.cpp"
+#include "Journal.cpp"
+#include "Archive.cpp"
+#include "BathPhysics.cpp"
+#include "ProfileStore.cpp"
 #include "util.cpp"
-#include <fstream>
 using namespace std;
 
 
-SmartBath* SmartBath::instance = nullptr;
-
-SmartBath::SmartBath() {
+SmartBath::SmartBath(DeviceTraits traits, string id, MqttPublisher *publisher, JournalWriter *journalWriter,
+    ArchiveWriter *archiveWriter, TickScheduler *scheduler) : id(id), traits(traits), volumeTime(chrono::steady_clock::now()), scheduler(scheduler), publisher(publisher),
+    archive(archiveWriter, "archive-" + id) {
     // Initialize states
     showerState = { .isOn = false, .temperature = 0, .debit = 0, };
     bathState = { .isOn = false, .temperature = 0, .debit = 0, };
-    // Load user profiles
-    loadProfiles();
-    // Start the thread running intervalCheck and move its reference to the class member
-    // intervalCheck function will be given the address of the instance pointer
-    checkThread = std::move(std::thread(intervalCheck, &instance));
-    mqttThread = std::move(std::thread(listenForDevices, &instance));
+    telemetry.addMetric("currentVolume", "display", VOLUME_DEADBAND);
+    publishSnapshot();
+    // Load user profiles: the store is only mapped, the journal holds the changes made since its last compaction
+    openProfileStore();
+    profileJournal = make_unique<Journal>(journalWriter, "profiles-" + id + ".bin", "profiles-" + id + ".journal",
+        [this](string_view record) { loadProfile(record); });
 }
 
 SmartBath::~SmartBath() {
-    // Dump the user profiles into the .csv file
-    dumpProfiles();
-    // Wait for the thread to join
-    checkThread.join();
-    mqttThread.join();
+    // Every profile change is already in the journal, only the last ones are waited for.
+    // It is done first, since a pending compaction locks blockingMutex when it completes.
+    profileJournal.reset();
+    if(shutoffTask != 0) {
+        scheduler->cancel(shutoffTask);
+    }
 }
 
-int SmartBath::intervalCheck(SmartBath** instance_ptr) {
-    // Sleep one second
-    sleep(1);
-    SmartBath* bath = *instance_ptr;
-    // Check if lifecycle did end, and if so return
-    if(bath == nullptr) {
-        return 0;
-    }
+const string& SmartBath::getId() {
+    return id;
+}
+
+const DeviceTraits& SmartBath::getModel() {
+    return traits;
+}
+
+template<typename Model>
+BasicBath<Model>::BasicBath(string id, MqttPublisher *publisher, JournalWriter *journalWriter,
+    ArchiveWriter *archiveWriter, TickScheduler *scheduler)
+    : SmartBath(deviceTraits<Model>(), id, publisher, journalWriter, archiveWriter, scheduler) {}
+
+template<typename Model>
+void BasicBath<Model>::intervalCheck() {
+    TraceSpan span("bath", "intervalCheck", id);
     // Lock the mutex
-    bath->blockingMutex.lock();
-    // Get the current water debit from each pipe
-    double currentDebit = bath->showerState.debit + bath->bathState.debit;
-
-    double volume = bath->bathtubCurrentVolume + currentDebit;
-    // If the stopper is not plugged, then substract the water that has drained
-    if(!bath->isOnWaterStopper) {
-        volume -= DRAIN_SPEED;
-        if(volume < 0) {
-            volume = 0;
+    blockingMutex.lock();
+    double previousVolume = bathtubCurrentVolume;
+    if(fillMode == FillMode::Polling) {
+        // A second of fixed steps. The pipes are turned off after the step where the volume
+        // reached the capacity or the fill target, and the rest of the second drains and cools the water.
+        double limit = isFillTargetSet ? min(fillTarget, Model::capacity) : Model::capacity;
+        double remaining = 1;
+        if(advanceWater(remaining, limit)) {
+            if(bathtubCurrentVolume >= Model::capacity) {
+                shutOffAtCapacity();
+            }
+            if(isFillTargetSet && fillTarget <= bathtubCurrentVolume) {
+                shutOffAtFillTarget();
+            }
+            advanceWater(remaining, INFINITY);
         }
+    } else {
+        // The timer of the plan shuts the pipes off, the checks below only catch a timer that is late
+        advanceVolume();
     }
+    double volume = bathtubCurrentVolume;
 
     // Turn off salt pump is volume went lower than 25% or there is no more salt.
-    if(volume / bath->bathtubValume <= 0.25 || bath->remainingSaltQuantity == 0) {
-        bath->isSaltPumpOn = false;
+    if(volume / Model::capacity <= 0.25 || remainingSaltQuantity == 0) {
+        isSaltPumpOn = false;
     }
 
     // If the bathtub is filling up turn off the pipes
-    if(volume >= bath->bathtubValume && (bath->bathState.isOn || bath->showerState.isOn)) {
-        bath->bathtubCurrentVolume = bath->bathtubValume;
-        // Turn off pipes
-        PipeState state = { .isOn = false, .temperature = 0, .debit = 0 };
-        bath->_setShowerState(state);
-        bath->_setBathState(state);
-    } else {
-        // else set the new volume
-        bath->bathtubCurrentVolume = volume;
+    if(volume >= Model::capacity && (bathState.isOn || showerState.isOn)) {
+        shutOffAtCapacity();
+    }
+    _finishIntervalCheck(previousVolume);
+
+    // Unlock the mutex, then answer the clients of the events of the check
+    unlockBath();
+    // Answers the long-poll requests that waited too long, outside of the lock too
+    events.expireWaiters();
+}
+
+template<typename Model>
+void BasicBath<Model>::validatePipeState(PipeState state, double maxDebit) {
+    if(state.isOn) { // State on
+        // Exceeded debit
+        if(state.debit > maxDebit) {
+            throw std::runtime_error("MAXIMUM_DEBIT_EXCEEDED");
+        }
+        // Temerature NOT in interval
+        if(!(Model::minWaterTemperature <= state.temperature && state.temperature <= Model::maxWaterTemperature)) {
+            throw std::runtime_error("TEMPERATURE_NOT_IN_RANGE");
+        }
+    } else { // State off
+        if(state.temperature != 0 || state.debit != 0) {
+            throw std::runtime_error("INVALID_DATA");
+        }
     }
+}
 
-    // Inform volume value over MQTT
-    bath->sendMessage("display", "currentVolume/" + to_string(bath->bathtubCurrentVolume));
+template<typename Model>
+void BasicBath<Model>::validateBathState(PipeState state) const {
+    validatePipeState(state, Model::maxBathDebit);
+}
 
-    if(bath->isSetWaterQuality && !SmartBath::checkWaterQuality(bath->waterQuality) &&
-        (bath->bathState.isOn || bath->showerState.isOn)) {
+template<typename Model>
+void BasicBath<Model>::validateShowerState(PipeState state) const {
+    validatePipeState(state, Model::maxShowerDebit);
+}
+
+void SmartBath::_finishIntervalCheck(double previousVolume) {
+    publishSnapshot();
+    int64_t now = historyTime();
+    history.add(HistoryMetric::Volume, now, bathtubCurrentVolume);
+    history.add(HistoryMetric::BathDebit, now, bathState.debit);
+    history.add(HistoryMetric::ShowerDebit, now, showerState.debit);
+    // The water quality is archived as NaN until the sensor sent it
+    double row[(int)ArchiveColumn::Count] = { bathtubCurrentVolume, NAN, NAN, NAN, NAN, NAN };
+    if(isSetWaterQuality) {
+        row[(int)ArchiveColumn::PH] = waterQuality.pH;
+        row[(int)ArchiveColumn::Chlorides] = waterQuality.chlorides;
+        row[(int)ArchiveColumn::Iron] = waterQuality.iron;
+        row[(int)ArchiveColumn::Calcium] = waterQuality.calcium;
+        row[(int)ArchiveColumn::Color] = waterQuality.color;
+    }
+    archive.append(chrono::duration_cast<chrono::milliseconds>(chrono::system_clock::now().time_since_epoch()).count(), row);
+    if(bathtubCurrentVolume != previousVolume) {
+        string data;
+        JsonWriter json(data);
+        json.beginObject().field("currentVolume", bathtubCurrentVolume).endObject();
+        emitEvent("volume", std::move(data));
+    }
+
+    // Inform volume value over MQTT, if it changed enough. The setters report the volume too,
+    // only the last report since the previous check is published.
+    telemetry.flush([this](const string& topic, const string& payload) {
+        sendMessage(topic, payload);
+    });
+
+    if(waterAnalytics.isUnsafe() && (bathState.isOn || showerState.isOn)) {
+        traceInstant("bath", "shutOffUnsafeWater", id);
         PipeState state = { .isOn = false, .temperature = 0, .debit = 0 };
-        bath->_setShowerState(state);
-        bath->_setBathState(state);
+        _applyShowerState(state, false);
+        _applyBathState(state, false);
     }
 
     // If target is reached turn off pipes
-    if(bath->isFillTargetSet && bath->fillTarget <= bath->bathtubCurrentVolume) {
-        PipeState state = { .isOn = false, .temperature = 0, .debit = 0 };
-        bath->_setShowerState(state);
-        bath->_setBathState(state);
-        bath->isFillTargetSet = false;
-        // Notify with MQTT
-        auto msg = mqtt::make_message("display", "targetReached");
-        bath->mqtt_client->publish(msg);
+    if(isFillTargetSet && fillTarget <= bathtubCurrentVolume) {
+        shutOffAtFillTarget();
     }
+}
 
-    // Unlock the mutex
-    bath->blockingMutex.unlock();
+void SmartBath::shutOffAtCapacity() {
+    traceInstant("bath", "shutOffAtCapacity", id);
+    recordOvershoot(bathtubCurrentVolume - traits.capacity);
+    bathtubCurrentVolume = traits.capacity;
+    telemetry.report("currentVolume", bathtubCurrentVolume);
+    // Turn off pipes
+    PipeState state = { .isOn = false, .temperature = 0, .debit = 0 };
+    _applyShowerState(state, false);
+    _applyBathState(state, false);
+}
+
+void SmartBath::shutOffAtFillTarget() {
+    traceInstant("bath", "shutOffAtFillTarget", id);
+    recordOvershoot(bathtubCurrentVolume - fillTarget);
+    // Cleared first, so that turning off the bath does not report the preparation as cancelled
+    isFillTargetSet = false;
+    PipeState state = { .isOn = false, .temperature = 0, .debit = 0 };
+    _applyShowerState(state, false);
+    _applyBathState(state, false);
+    // Notify with MQTT
+    sendMessage("display", "targetReached");
+    emitFillTargetEvent("reached");
+}
 
-    // Call the function again
-    return intervalCheck(instance_ptr);
+void SmartBath::recordOvershoot(double overshoot) {
+    // The deadline timer can run a rounding error early
+    overshoot = max(overshoot, 0.0);
+    FillStats& stats = fillStats[(int)fillMode];
+    stats.shutoffs++;
+    stats.lastOvershoot = overshoot;
+    stats.maxOvershoot = max(stats.maxOvershoot, overshoot);
+    stats.totalOvershoot += overshoot;
 }
 
-SmartBath* SmartBath::getInstance() {
-    if(instance == nullptr) {
-        instance = new SmartBath();
+void SmartBath::advanceVolume() {
+    auto now = chrono::steady_clock::now();
+    if(fillMode == FillMode::Deadline) {
+        double elapsed = chrono::duration<double>(now - volumeTime).count();
+        advanceWater(elapsed, INFINITY);
     }
-    return instance;
+    volumeTime = now;
 }
 
-void SmartBath::destroyInstance() {
-    if(instance) {
-        // Copy of the instance pointer. We need to set the instance pointer to null before calling the destructor,
-        // so that intervalCheck will stop its execution and we can join.
-        SmartBath* instanceAddress = instance;
-        instance = nullptr;
-        sendStopCommand(instanceAddress);
-        delete instanceAddress; // Calls the destructor
+void SmartBath::updateFlow() {
+    double inflow = bathState.debit + showerState.debit;
+    double heat = bathState.debit * bathState.temperature + showerState.debit * showerState.temperature;
+    physics.setFlow({
+        .inflow = inflow,
+        .inflowTemperature = inflow > 0 ? heat / inflow : 0,
+        .drain = isOnWaterStopper ? 0 : traits.drainSpeed
+    });
+}
+
+bool SmartBath::advanceWater(double& seconds, double limit) {
+    WaterState water = { .volume = bathtubCurrentVolume, .temperature = bathtubTemperature };
+    bool reached = physics.advance(water, seconds, limit);
+    bathtubCurrentVolume = water.volume;
+    bathtubTemperature = water.temperature;
+    telemetry.report("currentVolume", bathtubCurrentVolume);
+    return reached;
+}
+
+void SmartBath::planShutoff() {
+    bool flowing = false;
+    chrono::steady_clock::time_point deadline;
+    if(fillMode == FillMode::Deadline) {
+        flowRate = physics.getFlow().inflow - physics.getFlow().drain;
+        flowing = (bathState.isOn || showerState.isOn) && flowRate > 0;
+        // The pipes are shut off at the first limit that the volume crosses
+        double limit = isFillTargetSet ? min(fillTarget, traits.capacity) : traits.capacity;
+        double seconds = flowing ? max((limit - bathtubCurrentVolume) / flowRate, 0.0) : 0;
+        deadline = volumeTime + chrono::duration_cast<chrono::steady_clock::duration>(chrono::duration<double>(seconds));
+    }
+    // The snapshot of each interval check keeps the flow, and so the deadline up to rounding errors
+    if(shutoffTask != 0 && flowing && abs(deadline - shutoffDeadline) < chrono::milliseconds(1)) {
+        return;
+    }
+    if(shutoffTask != 0) {
+        scheduler->cancel(shutoffTask);
+        shutoffTask = 0;
+    }
+    weak_ptr<SmartBath> weakBath = weak_from_this();
+    if(!flowing || scheduler == nullptr || weakBath.expired()) {
+        return;
+    }
+    // The timer only keeps a weak reference, like the interval check
+    uint64_t plan = ++shutoffPlan;
+    shutoffDeadline = deadline;
+    shutoffTask = scheduler->scheduleAt([weakBath, plan] {
+        auto bath = weakBath.lock();
+        if(bath) {
+            bath->onShutoffDeadline(plan);
+        }
+    }, deadline);
+}
+
+void SmartBath::onShutoffDeadline(uint64_t plan) {
+    TraceSpan span("bath", "onShutoffDeadline", id);
+    blockingMutex.lock();
+    // A change of the state planned another shut-off since
+    if(plan != shutoffPlan || fillMode != FillMode::Deadline) {
+        unlockBath();
+        return;
+    }
+    shutoffTask = 0;
+    FillStats& stats = fillStats[(int)FillMode::Deadline];
+    stats.lastLateness = chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now() - shutoffDeadline).count();
+    stats.maxLateness = max(stats.maxLateness, stats.lastLateness);
+    advanceVolume();
+    // The volume can be a rounding error short of the limit
+    const double epsilon = 1e-9;
+    if(bathtubCurrentVolume >= traits.capacity - epsilon && (bathState.isOn || showerState.isOn)) {
+        shutOffAtCapacity();
+    }
+    if(isFillTargetSet && fillTarget <= bathtubCurrentVolume + epsilon) {
+        shutOffAtFillTarget();
+    }
+    // Plans again if the limit was not reached
+    publishSnapshot();
+    unlockBath();
+}
+
+FillMode SmartBath::getFillMode() {
+    blockingMutex.lock();
+    FillMode mode = fillMode;
+    unlockBath();
+    return mode;
+}
+
+FillStats SmartBath::getFillStats(FillMode mode) {
+    blockingMutex.lock();
+    FillStats stats = fillStats[(int)mode];
+    unlockBath();
+    return stats;
+}
+
+void SmartBath::setFillMode(FillMode mode) {
+    blockingMutex.lock();
+    // The flow so far is added with the previous mode
+    advanceVolume();
+    fillMode = mode;
+    publishSnapshot();
+    unlockBath();
+}
+
+PhysicsStats SmartBath::getPhysicsStats() {
+    blockingMutex.lock();
+    advanceVolume();
+    PhysicsStats stats = {
+        .step = physics.getStep(),
+        .water = { .volume = bathtubCurrentVolume, .temperature = bathtubTemperature },
+        .flow = physics.getFlow()
+    };
+    unlockBath();
+    return stats;
+}
+
+void SmartBath::setPhysicsStep(int64_t stepMs) {
+    blockingMutex.lock();
+    try {
+        // The water is integrated up to now with the previous step
+        advanceVolume();
+        physics.setStep(stepMs);
+    } catch(...) {
+        unlockBath();
+        throw;
     }
+    unlockBath();
+}
+
+vector<pair<string, TelemetryCounters>> SmartBath::getTelemetryCounters() {
+    blockingMutex.lock();
+    auto counters = telemetry.getCounters();
+    unlockBath();
+    return counters;
+}
+
+void SmartBath::setTelemetryDeadband(string name, Deadband deadband) {
+    blockingMutex.lock();
+    try {
+        telemetry.setDeadband(name, deadband);
+    } catch(...) {
+        unlockBath();
+        throw;
+    }
+    unlockBath();
+}
+
+int64_t SmartBath::historyTime() {
+    return chrono::duration_cast<chrono::seconds>(chrono::system_clock::now().time_since_epoch()).count();
+}
+
+void SmartBath::getHistory(HistoryMetric metric, int64_t from, int64_t to, int64_t step, HistoryQuery& result) {
+    blockingMutex.lock();
+    try {
+        history.query(metric, from, to, step, result);
+    } catch(...) {
+        unlockBath();
+        throw;
+    }
+    unlockBath();
+}
+
+void SmartBath::scanArchive(ArchiveColumn column, int64_t from, int64_t to, const Archive::ScanCallback& visit) {
+    archive.scan(column, from, to, visit);
+}
+
+size_t SmartBath::memoryUsage() {
+    blockingMutex.lock();
+    // Each changed profile is a heap node holding the key, the value and the next pointer.
+    // The profile store is mapped from its file, so its pages are not counted.
+    size_t profileNodeSize = sizeof(pair<const string, ProfileChange>) + sizeof(void*);
+    size_t bytes = sizeof(SmartBath) + id.capacity()
+        + telemetry.memoryUsage()
+        + history.memoryUsage()
+        + archive.memoryUsage()
+        + profileChanges.bucket_count() * sizeof(void*)
+        + profileChanges.size() * profileNodeSize;
+    for(auto itr = profileChanges.begin(); itr != profileChanges.end(); ++itr) {
+        bytes += itr->first.capacity();
+    }
+    unlockBath();
+    return bytes;
+}
+
+WaterQualityStats SmartBath::getWaterQualityStats() {
+    blockingMutex.lock();
+    WaterQualityStats stats = waterAnalytics.getStats();
+    unlockBath();
+    return stats;
+}
+
+void SmartBath::setWaterDebounce(WaterDebounce debounce) {
+    blockingMutex.lock();
+    try {
+        waterAnalytics.setDebounce(debounce);
+    } catch(...) {
+        unlockBath();
+        throw;
+    }
+    unlockBath();
 }
 
 bool SmartBath::setWaterQuality(WaterQuality waterQuality) {
     blockingMutex.lock();
     this->waterQuality = waterQuality;
     this->isSetWaterQuality = true;
+    int64_t now = historyTime();
+    history.add(HistoryMetric::PH, now, waterQuality.pH);
+    history.add(HistoryMetric::Chlorides, now, waterQuality.chlorides);
+    history.add(HistoryMetric::Iron, now, waterQuality.iron);
+    history.add(HistoryMetric::Calcium, now, waterQuality.calcium);
+    history.add(HistoryMetric::Color, now, waterQuality.color);
+    // The pipes are shut off by the interval check once the debounced state is unsafe
+    double values[WATER_PARAMETERS] = {
+        waterQuality.pH, waterQuality.chlorides, waterQuality.iron, waterQuality.calcium, waterQuality.color
+    };
+    waterAnalytics.add(values);
     // Send water quality to display
-    string msg = "waterQuality/";
-    msg += to_string(checkWaterQuality(waterQuality));
-    sendMessage("display", msg);
-    blockingMutex.unlock();
+    bool good = !waterAnalytics.isUnsafe();
+    sendMessage("display", good ? "waterQuality/1" : "waterQuality/0");
+    string data;
+    JsonWriter json(data);
+    json.beginObject()
+        .field("pH", waterQuality.pH)
+        .field("chlorides", waterQuality.chlorides)
+        .field("iron", waterQuality.iron)
+        .field("calcium", waterQuality.calcium)
+        .field("color", waterQuality.color)
+        .field("good", good)
+        .endObject();
+    emitEvent("waterQuality", std::move(data));
+    unlockBath();
     return true;
 }
 
+void SmartBath::publishSnapshot() {
+    // A batch publishes its state once, when it is committed
+    if(inBatch) {
+        return;
+    }
+    // Every change of the pipes, the stopper or the fill target publishes a snapshot, so it is planned for here
+    advanceVolume();
+    updateFlow();
+    planShutoff();
+    snapshot.store({ .bathState = bathState, .showerState = showerState,
+                     .currentVolume = bathtubCurrentVolume, .isOnWaterStopper = isOnWaterStopper });
+}
+
+uint64_t SmartBath::getSnapshot(BathSnapshot& state) {
+    return snapshot.load(state);
+}
+
 PipeState SmartBath::getBathState() {
-    return bathState;
+    BathSnapshot state;
+    snapshot.load(state);
+    return state.bathState;
 }
 
 PipeState SmartBath::getShowerState() {
-    return showerState;
+    BathSnapshot state;
+    snapshot.load(state);
+    return state.showerState;
 }
 
 void SmartBath::_setBathState(PipeState state, bool lockMutex) {
-    string msg = "pipe/bath/";
     // Data validation
-    if(state.isOn) { // State on
-        // Exceeded debit
-        if(state.debit > MAX_BATH_DEBIT) {
-            throw std::runtime_error("MAXIMUM_DEBIT_EXCEEDED");
-        }
-        // Temerature NOT in interval
-        if(!(MIN_WATER_TEMPERATURE <= state.temperature && state.temperature <= MAX_WATER_TEMPERATURE)) {
-            throw std::runtime_error("TEMPERATURE_NOT_IN_RANGE");
-        }
-        msg += "on/" + to_string(state.debit) + "/" + to_string(state.temperature);
-    } else { // State off
-        if(state.temperature != 0 || state.debit != 0) {
-            throw std::runtime_error("INVALID_DATA");
-        }
-        isFillTargetSet = false; // Cancel filling target
-        msg += "off";
-    }
-    
+    validateBathState(state);
+    _applyBathState(state, lockMutex);
+}
+
+void SmartBath::_applyBathState(PipeState state, bool lockMutex) {
     if(lockMutex) {
         blockingMutex.lock();
     }
     // Change value if validation is successful
     bathState = state;
+    traceInstant("bath", state.isOn ? "bath on" : "bath off", id);
+    if(!state.isOn && isFillTargetSet) {
+        isFillTargetSet = false; // Cancel filling target
+        emitFillTargetEvent("cancelled");
+    }
+    publishSnapshot();
+    // Sent under the lock, so that the messages and events of concurrent changes are in the order of the changes
+    sendMessage("display", pipeMessage("bath", state));
+    emitPipeEvent("bath", state);
     if(lockMutex) {
-        blockingMutex.unlock();
+        unlockBath();
     }
-    sendMessage("display", msg);
 }
 
 void SmartBath::setBathState(PipeState state) {
+    TraceSpan span("bath", "setBathState", id);
     _setBathState(state, true);
 }
 
 void SmartBath::_setShowerState(PipeState state, bool lockMutex) {
-    string msg = "pipe/shower/";
     // Data validation
-    if(state.isOn) { // State on
-        // Exceeded debit
-        if(state.debit > MAX_SHOWER_DEBIT) {
-            throw std::runtime_error("MAXIMUM_DEBIT_EXCEEDED");
-        }
-        // Temerature NOT in interval
-        if(!(MIN_WATER_TEMPERATURE <= state.temperature && state.temperature <= MAX_WATER_TEMPERATURE)) {
-            throw std::runtime_error("TEMPERATURE_NOT_IN_RANGE");
-        }
-        msg += "on/" + to_string(state.debit) + "/" + to_string(state.temperature);
-    } else { // State off
-        if(state.temperature != 0 || state.debit != 0) {
-            throw std::runtime_error("INVALID_DATA");
-        }
-        msg += "off";
-    }
+    validateShowerState(state);
+    _applyShowerState(state, lockMutex);
+}
 
+void SmartBath::_applyShowerState(PipeState state, bool lockMutex) {
     if(lockMutex) {
         blockingMutex.lock();
     }
     showerState = state;
+    traceInstant("bath", state.isOn ? "shower on" : "shower off", id);
+    publishSnapshot();
+    sendMessage("display", pipeMessage("shower", state));
+    emitPipeEvent("shower", state);
     if(lockMutex) {
-        blockingMutex.unlock();
+        unlockBath();
     }
-    sendMessage("display", msg);
 }
 
 void SmartBath::setShowerState(PipeState state) {
+    TraceSpan span("bath", "setShowerState", id);
     _setShowerState(state, true);
 }
 
-void SmartBath::sendMessage(string topic, string message) {
-    auto msg = mqtt::make_message(topic, message);
-    mqtt_client->publish(msg);
-    cout << "[Sent] " << topic << ": " << message << endl;
+void SmartBath::unlockBath() {
+    bool deliver = eventsPending;
+    eventsPending = false;
+    blockingMutex.unlock();
+    if(deliver) {
+        events.deliver();
+    }
+}
+
+void SmartBath::emitEvent(const char* type, string data) {
+    // A batch publishes its events only when it is committed
+    if(inBatch) {
+        batchEvents.push_back({ .version = 0, .type = type, .data = std::move(data) });
+        return;
+    }
+    // Appending is cheap, the waiting clients are answered after the lock is released
+    events.publish(type, std::move(data));
+    eventsPending = true;
+}
+
+void SmartBath::emitPipeEvent(const char* name, PipeState state) {
+    string data;
+    JsonWriter json(data);
+    json.beginObject().field("pipe", name);
+    json.field("isOn", state.isOn).field("temperature", state.temperature).field("debit", state.debit);
+    json.endObject();
+    emitEvent("pipe", std::move(data));
+}
+
+void SmartBath::emitFillTargetEvent(const char* state) {
+    string data;
+    JsonWriter json(data);
+    json.beginObject().field("state", state);
+    if(isFillTargetSet) {
+        json.field("fillTarget", fillTarget);
+    }
+    json.endObject();
+    emitEvent("fillTarget", std::move(data));
+}
+
+void SmartBath::pollEvents(uint64_t since, chrono::milliseconds timeout, EventStream::Responder respond) {
+    events.poll(since, timeout, std::move(respond));
+}
+
+EventStreamStats SmartBath::getEventStats() {
+    return events.getStats();
+}
+
+string& SmartBath::pipeMessage(string_view name, PipeState state) {
+    string& msg = threadBuffer();
+    msg += "pipe/";
+    msg += name;
+    if(state.isOn) {
+        msg += "/on/";
+        appendNumber(msg, state.debit);
+        msg += '/';
+        appendNumber(msg, state.temperature);
+    } else {
+        msg += "/off";
+    }
+    return msg;
+}
+
+void SmartBath::sendMessage(string_view topic, string_view message) {
+    // Topics are namespaced by the device ID.
+    // The strings are moved into the queue, so these are the only allocations of a message.
+    string fullTopic;
+    fullTopic.reserve(id.size() + 1 + topic.size());
+    fullTopic += id;
+    fullTopic += '/';
+    fullTopic += topic;
+    if(inBatch) {
+        // publish stamps the queuing time when the batch is committed
+        batchMessages.push_back({ .topic = std::move(fullTopic), .payload = string(message), .queuedAt = 0 });
+        return;
+    }
+    publisher->publish(std::move(fullTopic), string(message));
 }
 
 void SmartBath::setDefaultTemperature(double temperature) {
-    if(temperature < MIN_WATER_TEMPERATURE) {
-        temperature = MIN_WATER_TEMPERATURE;
-    } else if(temperature > MAX_WATER_TEMPERATURE) {
-        temperature = MAX_WATER_TEMPERATURE;
+    if(temperature < traits.minWaterTemperature) {
+        temperature = traits.minWaterTemperature;
+    } else if(temperature > traits.maxWaterTemperature) {
+        temperature = traits.maxWaterTemperature;
     }
     blockingMutex.lock();
     defaultTemperature = temperature;
-    blockingMutex.unlock();
+    history.add(HistoryMetric::Temperature, historyTime(), temperature);
+    unlockBath();
 }
 
 double SmartBath::getDefaultTemperature() {
-    return defaultTemperature;
+    blockingMutex.lock();
+    double temperature = defaultTemperature;
+    unlockBath();
+    return temperature;
 }
 
 double SmartBath::getBathtubCurrentVolume() {
-    return bathtubCurrentVolume;
+    BathSnapshot state;
+    snapshot.load(state);
+    return state.currentVolume;
 }
 
 void SmartBath::toggleStopper(bool on) {
     blockingMutex.lock();
     isOnWaterStopper = on;
-    blockingMutex.unlock();
+    publishSnapshot();
+    unlockBath();
 }
 
-int SmartBath::listenForDevices(SmartBath** instance_ptr) {
-    const vector<string> TOPICS { "temperature", "waterQuality", "salt", "display", "command" };
-    const vector<int> QOS { 0, 0, 0, 0, 1 };
-
-    SmartBath* bath = *instance_ptr;
-
-    mqtt::client cli(SERVER_ADDRESS, CLIENT_ID);
-    bath->mqtt_client = &cli;
-
-	auto connOpts = mqtt::connect_options_builder()
-		.clean_session(false)
-		.finalize();
-
-	try {
-		cout << "Connecting to the MQTT server... " << flush;
-		mqtt::connect_response rsp = cli.connect(connOpts);
-		cout << "OK\n";
-
-		if (!rsp.is_session_present()) {
-			std::cout << "Subscribing to topics... " << std::flush;
-			cli.subscribe(TOPICS, QOS);
-			std::cout << "OK\n";
-		}
-
-
-		while (true) {
-            bool messageRecognized = true;
-            auto msg = cli.consume_message();
-            if(!msg) break;
-            if(msg->get_topic() == string("temperature")) {
-                bath->setDefaultTemperature(stod(msg->to_string()));
-            } else if(msg->get_topic() == string("waterQuality")) {
-                try {
-                    string qualityString = msg->to_string();
-                    string delimiter(",");
-                    auto splitted = splitString(qualityString, delimiter);
-                    auto result = convertStringVector(splitted);
-                    WaterQuality waterQuality = {
-                        .pH = result[0],
-                        .chlorides = result[1],
-                        .iron = result[2],
-                        .calcium = result[3],
-                        .color = result[4]
-                    };
-                    bath->setWaterQuality(waterQuality);
-                } catch(...) { }
-            } else if(msg->get_topic() == "salt") {
-                try {
-                    double saltQuantity = stod(msg->to_string());
-                    bath->setRemainingSaltQuantity(saltQuantity);
-                } catch(...) { }
-            } else if(msg->get_topic() == string("display")) {
-                try {
-                    string qualityString = msg->to_string();
-                    string delimiter("/");
-                    auto splitted = splitString(qualityString, delimiter);
-                    if(splitted[0] == string("setPipe")) {
-                        PipeState state;
-                        if(splitted[2] == string("on")) {
-                            double debit = stod(splitted[3]);
-                            double temperature = bath->defaultTemperature;
-                            if(splitted.size() > 4) {
-                                temperature = stod(splitted[4]);
-                            }
-                            state = { .isOn = true, .temperature = temperature, .debit = debit };
-                        } else if(splitted[2] == string("off")) {
-                            state = { .isOn = false, .temperature = 0, .debit = 0 };
-                        } else {
-                            throw;
-                        }
-                        if(splitted[1] == string("bath")) {
-                            bath->setBathState(state);
-                        } else if(splitted[1] == string("shower")) {
-                            bath->setShowerState(state);
-                        }
-                    } else {
-                        messageRecognized = false;
-                    }
-                } catch(...) { }
-            } else if(msg->get_topic() == string("command")) {
-                if(msg->to_string() == string("stop")) {
-                    break;
-                }
-            } else {
-                messageRecognized = false;
-            }
-            if(messageRecognized) {
-                cout << "[Received] " << msg->get_topic() << ": " << msg->to_string() << endl;
-            }
-		}
+bool SmartBath::handleTemperature(string_view payload) {
+    double temperature;
+    if(parseNumber(payload, temperature)) {
+        setDefaultTemperature(temperature);
+    } else {
+        static Counter& malformed = malformedPayloads("temperature");
+        malformed.add();
+    }
+    return true;
+}
 
-		if (cli.is_connected()) {
-			cli.disconnect();
-		}
-        return 0;
-	} catch (const mqtt::exception& exc) {
-		cerr << "\n  " << exc << endl;
-		return 1;
-	}
+bool SmartBath::handleWaterQuality(string_view payload) {
+    WaterQuality waterQuality;
+    if(parseWaterQuality(payload, waterQuality)) {
+        setWaterQuality(waterQuality);
+    } else {
+        static Counter& malformed = malformedPayloads("waterQuality");
+        malformed.add();
+    }
+    return true;
 }
 
-void SmartBath::sendStopCommand(SmartBath* bath) {
-    auto msg = mqtt::make_message("command", "stop");
-    bath->mqtt_client->publish(msg);
+bool SmartBath::handleSalt(string_view payload) {
+    double saltQuantity;
+    if(parseNumber(payload, saltQuantity)) {
+        try {
+            setRemainingSaltQuantity(saltQuantity);
+        } catch(...) {
+            static Counter& rejected = swallowedErrors("salt");
+            rejected.add();
+        }
+    } else {
+        static Counter& malformed = malformedPayloads("salt");
+        malformed.add();
+    }
+    return true;
 }
 
-bool SmartBath::checkWaterQuality(WaterQuality waterQuality) {
-    return (6.5 <= waterQuality.pH && waterQuality.pH <= 8.5)
-        && (250.0 <= waterQuality.chlorides && waterQuality.chlorides <= 400.0)
-        && (0.1 <= waterQuality.iron && waterQuality.iron <= 0.3)
-        && (100.0 <= waterQuality.calcium && waterQuality.calcium <= 180.0)
-        && (15.0 <= waterQuality.color && waterQuality.color <= 30.0);
+bool SmartBath::handleTemperatureBinary(string_view payload) {
+    double temperature;
+    if(decodeSensorValues(payload, &temperature, 1)) {
+        setDefaultTemperature(temperature);
+    } else {
+        static Counter& malformed = malformedPayloads("temperature/bin");
+        malformed.add();
+    }
+    return true;
 }
 
-int SmartBath::prepareBath(double weight, double temperature) {
+bool SmartBath::handleWaterQualityBinary(string_view payload) {
+    WaterQuality waterQuality;
+    if(decodeWaterQuality(payload, waterQuality)) {
+        setWaterQuality(waterQuality);
+    } else {
+        static Counter& malformed = malformedPayloads("waterQuality/bin");
+        malformed.add();
+    }
+    return true;
+}
+
+bool SmartBath::handleSaltBinary(string_view payload) {
+    double saltQuantity;
+    if(decodeSensorValues(payload, &saltQuantity, 1)) {
+        try {
+            setRemainingSaltQuantity(saltQuantity);
+        } catch(...) {
+            static Counter& rejected = swallowedErrors("salt");
+            rejected.add();
+        }
+    } else {
+        static Counter& malformed = malformedPayloads("salt/bin");
+        malformed.add();
+    }
+    return true;
+}
+
+bool SmartBath::handleDisplay(string_view payload) {
+    // The bath publishes its own messages on display too, only setPipe commands are handled
+    if(!isPipeCommand(payload)) {
+        return false;
+    }
+    PipeCommand command;
+    if(!parsePipeCommand(payload, command)) {
+        static Counter& malformed = malformedPayloads("display");
+        malformed.add();
+        return true;
+    }
+    if(command.state.isOn && !command.hasTemperature) {
+        command.state.temperature = defaultTemperature;
+    }
+    try {
+        if(command.pipe == Pipe::Bath) {
+            setBathState(command.state);
+        } else if(command.pipe == Pipe::Shower) {
+            setShowerState(command.state);
+        }
+    } catch(...) {
+        static Counter& rejected = swallowedErrors("display");
+        rejected.add();
+    }
+    return true;
+}
+
+int SmartBath::_prepareBath(double weight, double temperature) {
     if(isFillTargetSet) {
         throw std::runtime_error("BATH_ALREADY_IN_PREPARATION");
     }
-    double _fillTarget = bathtubValume - weight * (1 / HUMAN_BODY_DENSITY);
+    double _fillTarget = traits.capacity - weight * (1 / HUMAN_BODY_DENSITY);
     if(_fillTarget < 0) {
         throw std::runtime_error("You're too fat man...");
     }
     if(_fillTarget <= bathtubCurrentVolume) {
         throw std::runtime_error("Already filled.");
     }
-    blockingMutex.lock();
+    // The bath state is validated first, so that nothing is changed if the temperature is out of range
+    PipeState state = { .isOn = true, .temperature = temperature, .debit = traits.maxBathDebit };
+    _setBathState(state);
     isFillTargetSet = true;
     fillTarget = _fillTarget;
-    PipeState state = { .isOn = true, .temperature = temperature, .debit = MAX_BATH_DEBIT };
-    _setBathState(state);
     isOnWaterStopper = true;
-    blockingMutex.unlock();
-    return (_fillTarget - bathtubCurrentVolume) / MAX_BATH_DEBIT;
+    publishSnapshot();
+    emitFillTargetEvent("set");
+    return (_fillTarget - bathtubCurrentVolume) / traits.maxBathDebit;
+}
+
+int SmartBath::prepareBath(double weight, double temperature) {
+    blockingMutex.lock();
+    int seconds;
+    try {
+        seconds = _prepareBath(weight, temperature);
+    } catch(...) {
+        unlockBath();
+        throw;
+    }
+    unlockBath();
+    return seconds;
 }
 
 int SmartBath::prepareBath(double weight) {
-    return prepareBath(weight, defaultTemperature);
+    return prepareBath(weight, getDefaultTemperature());
 }
 
 int SmartBath::prepareBath() {
+    blockingMutex.lock();
     if(profileSet == nullptr) {
-        blockingMutex.unlock();
+        unlockBath();
         throw std::runtime_error("No profile set.");
     }
-    return prepareBath(profileSet->weight, profileSet->preferredBathTemperature);
+    int seconds;
+    try {
+        seconds = _prepareBath(profileSet->weight, profileSet->preferredBathTemperature);
+    } catch(...) {
+        unlockBath();
+        throw;
+    }
+    unlockBath();
+    return seconds;
 }
 
-void SmartBath::cancelBathPreparation() {
-    blockingMutex.lock();
+void SmartBath::_cancelBathPreparation() {
     if(!isFillTargetSet) {
-        blockingMutex.unlock();
         throw std::runtime_error("No preparation was ongoing.");
     }
-    isFillTargetSet = false;
+    // Reported by _setBathState, that clears isFillTargetSet
     PipeState state = { .isOn = false, .temperature = 0, .debit = 0 };
     _setBathState(state);
     _setShowerState(state);
     isOnWaterStopper = false;
-    blockingMutex.unlock();
+    publishSnapshot();
 }
 
-void SmartBath::loadProfiles() {
-    ifstream profileFile("profiles.csv");
-    string line;
-    string delimiter = ",";
-    while(getline(profileFile, line)) {
-        try {
-            auto splitted = splitString(line, delimiter);
-            if(splitted.size() != 4) throw "";
-            string name = splitted[0];
-            double weight = stod(splitted[1]);
-            double preferredBathTemperature = stod(splitted[2]);
-            double preferredShowerTemperature = stod(splitted[3]);
-            UserProfile profile = {
-                .weight = weight,
-                .preferredBathTemperature = preferredBathTemperature,
-                .preferredShowerTemperature = preferredShowerTemperature
-            };
-            profiles.insert({ name, profile });
-        } catch(...) {
-            cout << "Profiles file seems to be corrupted.\n";
-        }
+void SmartBath::cancelBathPreparation() {
+    blockingMutex.lock();
+    try {
+        _cancelBathPreparation();
+    } catch(...) {
+        unlockBath();
+        throw;
+    }
+    unlockBath();
+}
+
+void SmartBath::openProfileStore() {
+    string storePath = "profiles-" + id + ".bin";
+    if(profileStore.open(storePath)) {
+        return;
+    }
+    string csvPath = "profiles-" + id + ".csv";
+    if(::access(csvPath.c_str(), F_OK) != 0) {
+        return;
+    }
+    long long converted = -1;
+    if(replaceFile(storePath, [&](int fd) { converted = ProfileStore::convertCsv(csvPath, fd); return converted >= 0; })
+        && profileStore.open(storePath)) {
+        cout << "Converted " << converted << " profiles from " << csvPath << " to " << storePath << ".\n";
+    } else {
+        cout << "Profiles file " << csvPath << " can't be converted.\n";
     }
-    profileFile.close();
 }
 
-void SmartBath::dumpProfiles() {
-    ofstream profileFile("profiles.csv");
-    for(auto itr = profiles.begin(); itr != profiles.end(); ++itr) {
-        profileFile << itr->first << "," 
-                    << itr->second.weight << ","
-                    << itr->second.preferredBathTemperature << ","
-                    << itr->second.preferredShowerTemperature
-                    << endl;
+void SmartBath::loadProfile(string_view record) {
+    string name;
+    UserProfile profile;
+    if(record.compare(0, 4, "put,") == 0 && parseProfileRecord(record.substr(4), name, profile)) {
+        profileChanges[name] = { .profile = profile, .removed = false, .sequence = 0 };
+    } else if(record.compare(0, 7, "remove,") == 0) {
+        profileChanges[string(record.substr(7))] = { .profile = {}, .removed = true, .sequence = 0 };
+    } else {
+        cout << "Profiles journal seems to be corrupted.\n";
     }
-    profileFile.close();
 }
 
-void SmartBath::_insertProfile(string name, UserProfile profile) {
-    if(!(MIN_WATER_TEMPERATURE <= profile.preferredBathTemperature && profile.preferredBathTemperature <= MAX_WATER_TEMPERATURE)) {
+bool SmartBath::_findProfile(const string& name, UserProfile& profile) {
+    auto it = profileChanges.find(name);
+    if(it != profileChanges.end()) {
+        profile = it->second.profile;
+        return !it->second.removed;
+    }
+    return profileStore.find(name, profile);
+}
+
+uint64_t SmartBath::_changeProfile(const string& name, const UserProfile* profile) {
+    string& record = threadBuffer();
+    if(profile != nullptr) {
+        record += "put,";
+        appendProfileRecord(record, name, *profile);
+    } else {
+        record += "remove,";
+        record += name;
+    }
+    uint64_t sequence = profileJournal->append(record);
+    profileChanges[name] = { .profile = profile ? *profile : UserProfile {}, .removed = profile == nullptr, .sequence = sequence };
+    if(profileJournal->needsCompaction()) {
+        _compactProfiles();
+    }
+    return sequence;
+}
+
+void SmartBath::_compactProfiles() {
+    // The changes are copied in name order, so that they can be merged with the store without holding the mutex.
+    // The store itself is only replaced by the writer thread, once the merge is done.
+    auto changes = make_shared<vector<pair<string, ProfileChange>>>(profileChanges.begin(), profileChanges.end());
+    sort(changes->begin(), changes->end(), [](const auto& a, const auto& b) { return a.first < b.first; });
+    auto merge = [this, changes](const ProfileStore::ProfileCallback& emit) {
+        size_t i = 0, j = 0;
+        while(i < profileStore.size() || j < changes->size()) {
+            int order = i == profileStore.size() ? 1
+                : j == changes->size() ? -1
+                : profileStore.nameAt(i).compare((*changes)[j].first);
+            if(order < 0) {
+                emit(profileStore.nameAt(i), profileStore.profileAt(i));
+                i++;
+                continue;
+            }
+            if(!(*changes)[j].second.removed) {
+                emit((*changes)[j].first, (*changes)[j].second.profile);
+            }
+            // A change replaces the profile of the store with the same name
+            i += order == 0;
+            j++;
+        }
+    };
+    compactionSequence = profileJournal->compact(
+        [merge](int fd) { return ProfileStore::write(fd, merge); },
+        [this](bool compacted) {
+            blockingMutex.lock();
+            if(compacted && profileStore.open("profiles-" + id + ".bin")) {
+                // The changes made after the compaction was queued are not in the new store
+                for(auto it = profileChanges.begin(); it != profileChanges.end();) {
+                    if(it->second.sequence <= compactionSequence) {
+                        it = profileChanges.erase(it);
+                    } else {
+                        ++it;
+                    }
+                }
+            }
+            unlockBath();
+        });
+}
+
+void SmartBath::_insertProfile(string name, UserProfile profile, bool replace) {
+    if(!(traits.minWaterTemperature <= profile.preferredBathTemperature && profile.preferredBathTemperature <= traits.maxWaterTemperature)) {
         throw std::runtime_error("TEMPERATURE_NOT_IN_RANGE");
     }
-    if(!(MIN_WATER_TEMPERATURE <= profile.preferredShowerTemperature && profile.preferredShowerTemperature <= MAX_WATER_TEMPERATURE)) {
+    if(!(traits.minWaterTemperature <= profile.preferredShowerTemperature && profile.preferredShowerTemperature <= traits.maxWaterTemperature)) {
         throw std::runtime_error("TEMPERATURE_NOT_IN_RANGE");
     }
     if(!(20 <= profile.weight && profile.weight <= 120)) {
         throw std::runtime_error("WEIGHT_NOT_IN_RANGE");
     }
+    // A journal record is one line
+    if(name.empty() || name.find_first_of("\r\n") != string::npos) {
+        throw std::runtime_error("INVALID_PROFILE_NAME");
+    }
     blockingMutex.lock();
-    profiles.insert({ name, profile });
-    blockingMutex.unlock();
+    uint64_t sequence;
+    try {
+        UserProfile existing;
+        bool exists = _findProfile(name, existing);
+        if(exists && !replace) {
+            throw std::runtime_error("PROFILE_ALREADY_EXISTS");
+        }
+        if(!exists && replace) {
+            throw std::runtime_error("PROFILE_NOT_FOUND");
+        }
+        sequence = _changeProfile(name, &profile);
+        if(profileSet != nullptr && profileSetName == name) {
+            profileSetValue = profile;
+        }
+    } catch(...) {
+        unlockBath();
+        throw;
+    }
+    unlockBath();
+    // The change is acknowledged once it is on disk
+    profileJournal->waitDurable(sequence);
 }
 
 void SmartBath::addProfile(string name, UserProfile profile) {
-    if(profiles.find(name) != profiles.end()) {
-        throw std::runtime_error("PROFILE_ALREADY_EXISTS");
-    }
-    _insertProfile(name, profile);
+    _insertProfile(name, profile, false);
 }
 
 void SmartBath::editProfile(string name, UserProfile profile) {
-    if(profiles.find(name) == profiles.end()) {
-        throw std::runtime_error("PROFILE_NOT_FOUND");
-    }
-    _insertProfile(name, profile);
+    _insertProfile(name, profile, true);
 }
 
 void SmartBath::removeProfile(string name) {
     blockingMutex.lock();
-    auto it = profiles.find(name);
-    if(it == profiles.end()) {
-        blockingMutex.unlock();
-        throw std::runtime_error("PROFILE_NOT_FOUND");
+    uint64_t sequence;
+    try {
+        UserProfile existing;
+        if(!_findProfile(name, existing)) {
+            throw std::runtime_error("PROFILE_NOT_FOUND");
+        }
+        sequence = _changeProfile(name, nullptr);
+        if(profileSet != nullptr && profileSetName == name) {
+            profileSet = nullptr;
+        }
+    } catch(...) {
+        unlockBath();
+        throw;
     }
-    profiles.erase(it);
-    blockingMutex.unlock();
+    unlockBath();
+    profileJournal->waitDurable(sequence);
 }
 
 void SmartBath::setProfile(string name) {
     blockingMutex.lock();
-    auto it = profiles.find(name);
-    if(it == profiles.end()) {
-        blockingMutex.unlock();
+    UserProfile profile;
+    if(!_findProfile(name, profile)) {
+        unlockBath();
         throw std::runtime_error("PROFILE_NOT_FOUND");
     }
-    profileSet = &(it->second);
-    blockingMutex.unlock();
+    profileSetName = name;
+    profileSetValue = profile;
+    profileSet = &profileSetValue;
+    unlockBath();
 }
 
 UserProfile SmartBath::getProfile(string name) {
     blockingMutex.lock();
-    auto it = profiles.find(name);
-    if(it == profiles.end()) {
-        blockingMutex.unlock();
+    UserProfile profile;
+    if(!_findProfile(name, profile)) {
+        unlockBath();
         throw std::runtime_error("PROFILE_NOT_FOUND");
     }
-    blockingMutex.unlock();
-    return it->second;
+    unlockBath();
+    return profile;
 }
 
 UserProfile* SmartBath::getProfileSet() {
@@ -502,21 +1013,137 @@ void SmartBath::setRemainingSaltQuantity(double quantity) {
     }
     blockingMutex.lock();
     remainingSaltQuantity = quantity;
-    blockingMutex.unlock();
+    history.add(HistoryMetric::Salt, historyTime(), quantity);
+    unlockBath();
 }
 
-void SmartBath::toggleSaltPump(bool on) {
+void SmartBath::_toggleSaltPump(bool on) {
     if(on) {
         if(remainingSaltQuantity == 0) {
             throw runtime_error("There is no more salt.");
         }
-        if(bathtubCurrentVolume / bathtubValume < 0.25) {
+        if(bathtubCurrentVolume / traits.capacity < 0.25) {
             throw runtime_error("Bathtub volume too low.");
         }
     }
-    blockingMutex.lock();
     isSaltPumpOn = on;
-    blockingMutex.unlock();
+}
+
+void SmartBath::toggleSaltPump(bool on) {
+    blockingMutex.lock();
+    try {
+        _toggleSaltPump(on);
+    } catch(...) {
+        unlockBath();
+        throw;
+    }
+    unlockBath();
+}
+
+void SmartBath::_applyOperation(const BatchOperation& operation, BatchResult& result) {
+    switch(operation.action) {
+        case BatchAction::PipeOn:
+        case BatchAction::PipeOff: {
+            PipeState state = { .isOn = false, .temperature = 0, .debit = 0 };
+            if(operation.action == BatchAction::PipeOn) {
+                state.isOn = true;
+                state.debit = operation.hasDebit ? operation.debit : 0.2;
+                state.temperature = operation.hasTemperature ? operation.temperature : defaultTemperature;
+            }
+            if(operation.pipe == Pipe::Bath) {
+                _setBathState(state);
+            } else if(operation.pipe == Pipe::Shower) {
+                _setShowerState(state);
+            } else {
+                throw std::runtime_error("UNKNOWN_PIPE");
+            }
+            break;
+        }
+        case BatchAction::Stopper:
+            isOnWaterStopper = operation.on;
+            break;
+        case BatchAction::SaltPump:
+            _toggleSaltPump(operation.on);
+            break;
+        case BatchAction::Prepare:
+            result.readyAfter = _prepareBath(operation.weight,
+                operation.hasTemperature ? operation.temperature : defaultTemperature);
+            break;
+        case BatchAction::PrepareProfile:
+            if(profileSet == nullptr) {
+                throw std::runtime_error("No profile set.");
+            }
+            result.readyAfter = _prepareBath(profileSet->weight, profileSet->preferredBathTemperature);
+            break;
+        case BatchAction::CancelPrepare:
+            _cancelBathPreparation();
+            break;
+    }
+}
+
+bool SmartBath::applyBatch(const vector<BatchOperation>& operations, vector<BatchResult>& results) {
+    TraceSpan span("bath", "applyBatch", id);
+    results.assign(operations.size(), { .error = "", .readyAfter = -1 });
+    blockingMutex.lock();
+    // State changed by the operations, restored if one of them fails
+    PipeState savedBathState = bathState, savedShowerState = showerState;
+    bool savedStopper = isOnWaterStopper, savedSaltPump = isSaltPumpOn, savedFillTargetSet = isFillTargetSet;
+    double savedFillTarget = fillTarget;
+    auto rollBack = [&] {
+        bathState = savedBathState;
+        showerState = savedShowerState;
+        isOnWaterStopper = savedStopper;
+        isSaltPumpOn = savedSaltPump;
+        isFillTargetSet = savedFillTargetSet;
+        fillTarget = savedFillTarget;
+    };
+
+    inBatch = true;
+    batchMessages.clear();
+    batchEvents.clear();
+    size_t failed = operations.size();
+    for(size_t i = 0; i < operations.size(); i++) {
+        try {
+            _applyOperation(operations[i], results[i]);
+        } catch(const exception& exc) {
+            results[i].error = exc.what();
+            failed = i;
+            break;
+        } catch(...) {
+            rollBack();
+            inBatch = false;
+            batchMessages.clear();
+            batchEvents.clear();
+            unlockBath();
+            throw;
+        }
+    }
+    inBatch = false;
+
+    bool committed = failed == operations.size();
+    if(committed) {
+        publishSnapshot();
+        for(auto& message : batchMessages) {
+            publisher->publish(std::move(message.topic), std::move(message.payload));
+        }
+        for(auto& event : batchEvents) {
+            events.publish(std::move(event.type), std::move(event.data));
+        }
+        eventsPending = eventsPending || !batchEvents.empty();
+    } else {
+        rollBack();
+        for(size_t i = 0; i < operations.size(); i++) {
+            if(i < failed) {
+                results[i] = { .error = "ROLLED_BACK", .readyAfter = -1 };
+            } else if(i > failed) {
+                results[i].error = "NOT_APPLIED";
+            }
+        }
+    }
+    batchMessages.clear();
+    batchEvents.clear();
+    unlockBath();
+    return committed;
 }
 
 double SmartBath::getRemainingSaltQuantity() {
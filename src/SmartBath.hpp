@@ -1,21 +1,34 @@
 #pragma once
+#include <memory>
+#include <string_view>
 #include <thread>
-#include "mqtt/client.h"
+#include "EventStream.hpp"
+#include "Archive.hpp"
+#include "BathPhysics.hpp"
+#include "History.hpp"
+#include "WaterAnalytics.hpp"
+#include "Journal.hpp"
+#include "ProfileStore.hpp"
+#include "MqttPublisher.hpp"
+#include "Metrics.hpp"
+#include "Seqlock.hpp"
+#include "Telemetry.hpp"
+#include "DeviceModel.hpp"
+#include "TickScheduler.hpp"
 #include "env.hpp"
 using namespace std;
 
-// Maximum bath water debit measured in liters/secomd
-#define MAX_BATH_DEBIT .25
-// Maximum shower water debit measured in liters/secomd
-#define MAX_SHOWER_DEBIT .2
-// Drain speed of the water when the stopper is lifted, measured in liters/secomd
-#define DRAIN_SPEED .2
-// Minimum tempature of the water flowing through the pipe
-#define MIN_WATER_TEMPERATURE 5
-// Maximum tempature of the water flowing through the pipe
-#define MAX_WATER_TEMPERATURE 50
 // kg/l
 #define HUMAN_BODY_DENSITY 1.01
+// The current volume is published when it changes by more than 0.1 liters, or at least every 10 seconds
+#ifndef VOLUME_DEADBAND
+#define VOLUME_DEADBAND { .absolute = 0.1, .relative = 0, .heartbeat = 10 }
+#endif
+// How the pipes of a new bath are shut off at the fill target and at the capacity, see FillMode.
+// Each bath can switch to the other mode at runtime.
+#ifndef FILL_MODE_DEFAULT
+#define FILL_MODE_DEFAULT FillMode::Polling
+#endif
 
 const string SERVER_ADDRESS	{ MQTT_SERVER_ADDRESS };
 const string CLIENT_ID		{ MQTT_CLIENT_ID };
@@ -31,6 +44,75 @@ typedef struct PipeState {
     double debit;
 } PipeState;
 
+enum class Pipe { Bath, Shower, Unknown };
+
+// setPipe command received on the display topic
+typedef struct PipeCommand {
+    Pipe pipe;
+    PipeState state;
+    // If false, the default temperature is used when the pipe is turned on
+    bool hasTemperature;
+} PipeCommand;
+
+enum class BatchAction { PipeOn, PipeOff, Stopper, SaltPump, Prepare, PrepareProfile, CancelPrepare };
+
+// Operation of a batch, parsed from the path of the equivalent route (e.g. "bath/on/0.2/38")
+typedef struct BatchOperation {
+    BatchAction action;
+    // PipeOn, PipeOff
+    Pipe pipe;
+    // Stopper, SaltPump
+    bool on;
+    // PipeOn. The debit defaults to 0.2 and the temperature to the default temperature.
+    bool hasDebit;
+    double debit;
+    // PipeOn, Prepare. Defaults to the default temperature.
+    bool hasTemperature;
+    double temperature;
+    // Prepare
+    double weight;
+} BatchOperation;
+
+typedef struct BatchResult {
+    // Error of the operation, empty if it succeeded
+    string error;
+    // Seconds until the bath is ready, for the prepare operations
+    int readyAfter;
+} BatchResult;
+
+// Consistent view of the state read by the GET routes.
+// It is published by the interval check and the setters, and read without locking the bath.
+typedef struct BathSnapshot {
+    PipeState bathState;
+    PipeState showerState;
+    double currentVolume;
+    bool isOnWaterStopper;
+} BathSnapshot;
+
+// Polling: the interval check adds a second of flow to the volume, and shuts the pipes off once it is past the limit.
+// Deadline: the volume follows the flow continuously, and a timer shuts the pipes off when it crosses the limit.
+enum class FillMode { Polling, Deadline };
+
+// Water that went past the fill target or the capacity when the pipes were shut off
+typedef struct FillStats {
+    uint64_t shutoffs;
+    // In liters
+    double lastOvershoot;
+    double maxOvershoot;
+    double totalOvershoot;
+    // Deadline mode: how late the timer ran, in microseconds
+    int64_t lastLateness;
+    int64_t maxLateness;
+} FillStats;
+
+// Water in the bathtub and the flow integrated by the physics
+typedef struct PhysicsStats {
+    // Length of a step in milliseconds
+    int64_t step;
+    WaterState water;
+    WaterFlow flow;
+} PhysicsStats;
+
 // Water quality details that are received from the sensor and stored inside the class.
 typedef struct WaterQuality
 {
@@ -41,26 +123,37 @@ typedef struct WaterQuality
     double color; //15 - 30
 } WaterQuality;
 
-typedef struct UserProfile {
-    double weight; // 20 - 120 kg
-    double preferredBathTemperature;
-    double preferredShowerTemperature;
-} UserProfile;
-
-// Singleton class 
-class SmartBath {
-private:
+// Change of a profile made since the last compaction of the profile store
+typedef struct ProfileChange {
+    UserProfile profile;
+    bool removed;
+    // Sequence number of its journal record, 0 if it was replayed
+    uint64_t sequence;
+} ProfileChange;
+
+// Model of a single bathtub, shared by all the device models. Instances are BasicBath<Model>,
+// owned and driven by the BathRegistry.
+class SmartBath : public enable_shared_from_this<SmartBath> {
+protected:
+    // Device ID of the bathtub. It is used as prefix for the MQTT topics (<id>/display)
+    const string id;
     // Water quality information
     WaterQuality waterQuality;
     bool isSetWaterQuality = false;
+    // Rolling statistics of the water quality samples, and the debounced state that shuts the pipes off
+    WaterAnalytics waterAnalytics;
     // Struct variable storing the actual state of the shower
     PipeState showerState;
     // Struct variable storing the actual state of the bath
     PipeState bathState;
-    // Volume of bathtub in liters
-    const double bathtubValume = 300;
+    // Limits of the model, for the code that is not specialized by BasicBath
+    const DeviceTraits traits;
     // Current Volume of the bathtub in liters. It is calculated by the intervalCheck function
     double bathtubCurrentVolume = 0;
+    // Temperature of the water in the bathtub
+    double bathtubTemperature = PHYSICS_ROOM_TEMPERATURE;
+    // Integrates the volume and the temperature in fixed steps
+    BathPhysics physics;
     // Bool variable representing the state of the bathtub stopper.
     // If it is unplugged (false), the water will drain. 
     bool isOnWaterStopper = true;
@@ -76,60 +169,195 @@ private:
     double remainingSaltQuantity = 0;
 
 
-    // Map from User name to User Profile
-    unordered_map<string, UserProfile> profiles;
-    // The profile that was set.
+    // Profiles at the last compaction, mapped from profiles-<id>.bin
+    ProfileStore profileStore;
+    // Profiles changed since then, keyed by user name. They are logged in profiles-<id>.journal
+    // and take precedence over the store.
+    unordered_map<string, ProfileChange> profileChanges;
+    unique_ptr<Journal> profileJournal;
+    // Sequence number of the queued compaction
+    uint64_t compactionSequence = 0;
+    // The profile that was set. It is a copy, since the store is read-only.
+    string profileSetName;
+    UserProfile profileSetValue;
     UserProfile* profileSet = nullptr;
 
     // Specifies the target volume to fill the bathtub (in liters)
     double fillTarget;
 
-    mqtt::client *mqtt_client = nullptr;
-    
-    // Varible to store the thread that is running the intervalCheck function
-    // It is needed by the destructor to join at lifecycle end.
-    std::thread checkThread;
-    // Stores the thread that runs the listenForDevices function
-    std::thread mqttThread;
-    // Mutex to avoid concurrent reading/writing
-    std::mutex blockingMutex;
-
-    // Singleton instance
-    static SmartBath* instance;
-    // Private constructor
-    SmartBath();
-
-    // Destructor of the SmartBath class
-    ~SmartBath();
-
-    // Threaded function that checks every second if the water quality is good and the bathtub didn't fill up.
-    static int intervalCheck(SmartBath** instance_ptr);
-    static int listenForDevices(SmartBath** instance_ptr);
-    static void sendStopCommand(SmartBath* bath);
-    static bool checkWaterQuality(WaterQuality waterQuality);
+    FillMode fillMode = FILL_MODE_DEFAULT;
+    // Deadline mode: net flow in liters/second since volumeTime, when bathtubCurrentVolume was computed
+    double flowRate = 0;
+    chrono::steady_clock::time_point volumeTime;
+    // Runs the shut-off timers
+    TickScheduler* scheduler = nullptr;
+    // Task of the planned shut-off, 0 if none. A timer of an older plan does nothing.
+    uint64_t shutoffTask = 0;
+    uint64_t shutoffPlan = 0;
+    chrono::steady_clock::time_point shutoffDeadline;
+    // Indexed by FillMode
+    FillStats fillStats[2] = {};
+
+    // Publisher shared by all the baths of the registry
+    MqttPublisher *publisher = nullptr;
+    // Publishes the metrics sent every interval check only when they change
+    Telemetry telemetry;
+    // Rollups of the volume, the debits and the sensor values, for GET /history
+    History history;
+    // Unix time in seconds of the samples added to the history
+    static int64_t historyTime();
+    // Volume and water quality of every interval check, kept on disk in archive-<id>/
+    Archive archive;
+
+    // Mutex to avoid concurrent reading/writing. Its wait and hold times are in GET /metrics.
+    MeteredMutex blockingMutex { "blockingMutex" };
+    // Last published state. Stores are serialized by blockingMutex.
+    Seqlock<BathSnapshot> snapshot;
+
+    // Publishes the current state to the readers, and plans the shut-off for it. blockingMutex must be held.
+    void publishSnapshot();
+
+    // Deadline mode: adds the flow since the last call to the volume. blockingMutex must be held.
+    void advanceVolume();
+    // Sets the flow of the physics from the pipes and the stopper. blockingMutex must be held.
+    void updateFlow();
+    // Integrates the volume and the temperature, see BathPhysics::advance. blockingMutex must be held.
+    bool advanceWater(double& seconds, double limit);
+    // Deadline mode: schedules the shut-off at the time the volume will cross the fill target or the capacity
+    // with the current flow, or cancels it. blockingMutex must be held.
+    void planShutoff();
+    // Called by the timer of the plan
+    void onShutoffDeadline(uint64_t plan);
+    // Turn the pipes off once the volume crossed the capacity or the fill target, and record the overshoot.
+    // blockingMutex must be held.
+    void shutOffAtCapacity();
+    void shutOffAtFillTarget();
+    void recordOvershoot(double overshoot);
+
+    // Set while a batch is applied: the messages and the snapshot are held back until it is committed
+    bool inBatch = false;
+    vector<OutboundMessage> batchMessages;
+    vector<StreamEvent> batchEvents;
+
+    // State changes pushed to the clients of GET /events
+    EventStream events;
+    // Set when an event was published under blockingMutex, its waiting clients are answered by unlockBath
+    bool eventsPending = false;
+    // Releases blockingMutex, then answers the clients waiting for the events published while it was held.
+    // Every lock of blockingMutex is released with it, so that the responses never delay the setters and the tick.
+    void unlockBath();
+    // Publishes an event on the stream. blockingMutex must be held.
+    void emitEvent(const char* type, string data);
+    void emitPipeEvent(const char* name, PipeState state);
+    // state is set, reached or cancelled
+    void emitFillTargetEvent(const char* state);
 
     // Internal private function that can set bath state without locking the mutex
     void _setBathState(PipeState state, bool lockMutex = false);
     // Internal private function that can set shower state without locking the mutex
     void _setShowerState(PipeState state, bool lockMutex = false);
+    // Same as above, without the validation. Used to turn the pipes off.
+    void _applyBathState(PipeState state, bool lockMutex);
+    void _applyShowerState(PipeState state, bool lockMutex);
+    // Check the state against the limits of the model. They throw runtime_error if it is invalid.
+    virtual void validateBathState(PipeState state) const = 0;
+    virtual void validateShowerState(PipeState state) const = 0;
+    // Rest of the interval check once the model updated the volume: history, archive, events, telemetry,
+    // water quality and fill target. blockingMutex must be held.
+    void _finishIntervalCheck(double previousVolume);
     
-    void sendMessage(string topic, string message);
-
-    void loadProfiles();
-    void dumpProfiles();
-    // Internal private function to check profile properties and insert into the map
-    void _insertProfile(string name, UserProfile profile);
+    // Queues the message on the publisher, it does not wait for the broker
+    void sendMessage(string_view topic, string_view message);
+    // Writes "pipe/<name>/on/<debit>/<temperature>" or "pipe/<name>/off" into the thread buffer
+    static string& pipeMessage(string_view name, PipeState state);
+
+    // Opens profiles-<id>.bin, converting the profiles-<id>.csv of the previous versions if there is no store yet
+    void openProfileStore();
+    // Applies a "put,<profile>" or "remove,<name>" record of the journal
+    void loadProfile(string_view record);
+    // Looks the profile up in the changes, then in the store. blockingMutex must be held.
+    bool _findProfile(const string& name, UserProfile& profile);
+    // Logs the change (profile is nullptr for a removal) and compacts the journal when it has grown enough.
+    // blockingMutex must be held. Returns the sequence number to wait for, after releasing the mutex.
+    uint64_t _changeProfile(const string& name, const UserProfile* profile);
+    // Merges the store and the changes into a new store, on the journal writer thread. blockingMutex must be held.
+    void _compactProfiles();
+    // Internal private function to check profile properties and insert or replace the profile
+    void _insertProfile(string name, UserProfile profile, bool replace);
 
     void setRemainingSaltQuantity(double quantity);
+
+    // Internal functions of the public setters, called with blockingMutex held.
+    // They throw runtime_error before changing the state.
+    int _prepareBath(double weight, double temperature);
+    void _cancelBathPreparation();
+    void _toggleSaltPump(bool on);
+    void _applyOperation(const BatchOperation& operation, BatchResult& result);
+
+    // The profiles are loaded from the journal written by journalWriter. The archive is written by archiveWriter.
+    // The shut-off timers run on scheduler. They are only used when the bath is owned by a shared_ptr.
+    SmartBath(DeviceTraits traits, string id, MqttPublisher *publisher, JournalWriter *journalWriter,
+        ArchiveWriter *archiveWriter, TickScheduler *scheduler);
 public:
-    // Static method for getting the singleton instance.
-    static SmartBath* getInstance();
-    // Static method to destroy the instance.
-    static void destroyInstance();
+    // Destructor of the SmartBath class
+    virtual ~SmartBath();
+
+    const string& getId();
+
+    // Limits of the model of the bathtub
+    const DeviceTraits& getModel();
+
+    // Checks if the water quality is good and the bathtub didn't fill up.
+    // It is called every second by the registry, on the BasicBath so that the call is not virtual.
+    virtual void intervalCheck() = 0;
+
+    // Handlers of the messages received on the bath topics (<id>/temperature, ...).
+    // Malformed payloads are ignored. They return false if the message was not recognized.
+    bool handleTemperature(string_view payload);
+    bool handleWaterQuality(string_view payload);
+    bool handleSalt(string_view payload);
+    bool handleDisplay(string_view payload);
+    // Same as above, for the binary payloads of the <id>/<topic>/bin topics
+    bool handleTemperatureBinary(string_view payload);
+    bool handleWaterQualityBinary(string_view payload);
+    bool handleSaltBinary(string_view payload);
+
+    /**
+     * Approximate number of bytes used by this bath, including its profiles.
+    */
+    size_t memoryUsage();
+
+    // Sent and suppressed counters of the metrics published by the interval check
+    vector<pair<string, TelemetryCounters>> getTelemetryCounters();
+
+    // Throws runtime_error if the metric does not exist
+    void setTelemetryDeadband(string name, Deadband deadband);
+
+    // Overshoot of the shut-offs in each mode
+    FillMode getFillMode();
+    FillStats getFillStats(FillMode mode);
+    void setFillMode(FillMode mode);
+
+    PhysicsStats getPhysicsStats();
+    // Throws runtime_error if the step is invalid, see BathPhysics::setStep
+    void setPhysicsStep(int64_t stepMs);
+
+    // Rolling statistics and anomalies of the water quality parameters, and the debounced state
+    WaterQualityStats getWaterQualityStats();
+
+    // Throws runtime_error if the debounce is invalid
+    void setWaterDebounce(WaterDebounce debounce);
 
     // Method to set water quality. Returns true if set was successful, false otherwise.
     bool setWaterQuality(WaterQuality waterQuality);
 
+    /**
+     * Copies the last published state without locking the bath.
+     * @returns The version of the state, incremented by every change.
+    */
+    uint64_t getSnapshot(BathSnapshot& state);
+
+    // Read from the last published state, without locking the bath
     PipeState getBathState();
 
     PipeState getShowerState();
@@ -154,7 +382,7 @@ public:
     double getDefaultTemperature();
 
     /** 
-     * Get the current volume of the bathtub.
+     * Get the current volume of the bathtub, from the last published state.
     */
     double getBathtubCurrentVolume();
 
@@ -196,4 +424,44 @@ public:
     void toggleSaltPump(bool on);
 
     double getRemainingSaltQuantity();
-};
\ No newline at end of file
+
+    /**
+     * Applies the operations in order as a single state transition: the state is published and the
+     * display messages are sent only if all of them succeed. Otherwise the state is restored.
+     * results receives one entry per operation. The operations after a failed one are not applied.
+     * @returns true if the batch was committed.
+    */
+    bool applyBatch(const vector<BatchOperation>& operations, vector<BatchResult>& results);
+
+    /**
+     * Long-polls the events of the bath published after the since version (pipe, volume, waterQuality, fillTarget).
+     * respond is called once, now or when an event is published or the timeout expires.
+    */
+    void pollEvents(uint64_t since, chrono::milliseconds timeout, EventStream::Responder respond);
+
+    EventStreamStats getEventStats();
+
+    /**
+     * Min/max/avg of the metric over [from, to) (unix seconds), in steps of step seconds.
+     * Throws runtime_error if the range is invalid or has too many steps.
+    */
+    void getHistory(HistoryMetric metric, int64_t from, int64_t to, int64_t step, HistoryQuery& result);
+
+    // Values of the column archived in [from, to) (unix milliseconds), in time order. It does not lock the bath.
+    void scanArchive(ArchiveColumn column, int64_t from, int64_t to, const Archive::ScanCallback& visit);
+};
+
+// Bath of a given device model. The tick arithmetic and the validation of the pipe states use the
+// constants of Model, everything else is shared by SmartBath.
+template<typename Model>
+class BasicBath final : public SmartBath {
+private:
+    void validateBathState(PipeState state) const override;
+    void validateShowerState(PipeState state) const override;
+    static void validatePipeState(PipeState state, double maxDebit);
+public:
+    BasicBath(string id, MqttPublisher *publisher, JournalWriter *journalWriter, ArchiveWriter *archiveWriter,
+        TickScheduler *scheduler);
+
+    void intervalCheck() override;
+};
@@ -0,0 +1,102 @@
+#include "Telemetry.hpp"
+#include "JsonWriter.hpp"
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+using namespace std;
+
+
+Telemetry::Channel* Telemetry::find(const string& name) {
+    for(auto& channel : channels) {
+        if(channel.name == name) {
+            return &channel;
+        }
+    }
+    return nullptr;
+}
+
+void Telemetry::addMetric(string name, string topic, Deadband deadband) {
+    Channel channel;
+    channel.name = name;
+    channel.topic = topic;
+    channel.deadband = deadband;
+    channel.hasSent = false;
+    channel.lastSent = 0;
+    channel.pending = false;
+    channel.pendingValue = 0;
+    channel.counters = { .sent = 0, .suppressed = 0, .coalesced = 0 };
+    channels.push_back(channel);
+}
+
+void Telemetry::setDeadband(const string& name, Deadband deadband) {
+    Channel* channel = find(name);
+    if(channel == nullptr) {
+        throw std::runtime_error("METRIC_NOT_FOUND");
+    }
+    channel->deadband = deadband;
+}
+
+void Telemetry::report(const string& name, double value) {
+    Channel* channel = find(name);
+    if(channel == nullptr) {
+        throw std::runtime_error("METRIC_NOT_FOUND");
+    }
+    if(channel->pending) {
+        channel->counters.coalesced++;
+    }
+    channel->pending = true;
+    channel->pendingValue = value;
+}
+
+void Telemetry::flushChannel(Channel& channel, Clock::time_point now, const function<void(const string&, const string&)>& send) {
+    if(!channel.pending) {
+        return;
+    }
+    channel.pending = false;
+
+    bool publish = !channel.hasSent;
+    if(!publish) {
+        double change = fabs(channel.pendingValue - channel.lastSent);
+        double threshold = max(channel.deadband.absolute, channel.deadband.relative * fabs(channel.lastSent));
+        double elapsed = chrono::duration<double>(now - channel.lastSentTime).count();
+        publish = change > threshold || elapsed >= channel.deadband.heartbeat;
+        // A change to or from 0 is always published, so that an empty bathtub is not missed
+        publish = publish || (change > 0 && (channel.pendingValue == 0 || channel.lastSent == 0));
+    }
+    if(!publish) {
+        channel.counters.suppressed++;
+        return;
+    }
+    string& payload = threadBuffer();
+    payload += channel.name;
+    payload += '/';
+    appendNumber(payload, channel.pendingValue);
+    send(channel.topic, payload);
+    channel.hasSent = true;
+    channel.lastSent = channel.pendingValue;
+    channel.lastSentTime = now;
+    channel.counters.sent++;
+}
+
+void Telemetry::flush(const function<void(const string& topic, const string& payload)>& send) {
+    auto now = Clock::now();
+    for(auto& channel : channels) {
+        flushChannel(channel, now, send);
+    }
+}
+
+vector<pair<string, TelemetryCounters>> Telemetry::getCounters() {
+    vector<pair<string, TelemetryCounters>> result;
+    for(auto& channel : channels) {
+        result.push_back({ channel.name, channel.counters });
+    }
+    return result;
+}
+
+size_t Telemetry::memoryUsage() {
+    size_t bytes = channels.capacity() * sizeof(Channel);
+    for(auto& channel : channels) {
+        bytes += channel.name.capacity() + channel.topic.capacity();
+    }
+    return bytes;
+}
@@ -0,0 +1,69 @@
+#pragma once
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+using namespace std;
+
+// When a new value of a metric is worth publishing.
+// A value is published if it moved from the last published one by more than the larger of the two bands.
+typedef struct Deadband {
+    // Change from the last published value
+    double absolute;
+    // Change relative to the last published value (0.01 = 1%)
+    double relative;
+    // Maximum number of seconds between two publishes, even if the value did not change
+    double heartbeat;
+} Deadband;
+
+typedef struct TelemetryCounters {
+    uint64_t sent;
+    // Values not published because they were inside the deadband
+    uint64_t suppressed;
+    // Values replaced by a newer one before they were flushed
+    uint64_t coalesced;
+} TelemetryCounters;
+
+// Publishes metrics only when they change. Values are reported as <name>/<value> on a topic.
+// Reports are kept pending until flush, so only the latest value of each metric is compared to the last published one.
+// Not thread safe, the owner must synchronize the calls.
+class Telemetry {
+private:
+    typedef chrono::steady_clock Clock;
+
+    struct Channel {
+        string name;
+        string topic;
+        Deadband deadband;
+        bool hasSent;
+        double lastSent;
+        Clock::time_point lastSentTime;
+        bool pending;
+        double pendingValue;
+        TelemetryCounters counters;
+    };
+
+    // A few metrics per bath, so a vector is smaller and faster than a map
+    vector<Channel> channels;
+
+    Channel* find(const string& name);
+    void flushChannel(Channel& channel, Clock::time_point now, const function<void(const string&, const string&)>& send);
+public:
+    // Registers a metric published on the given topic
+    void addMetric(string name, string topic, Deadband deadband);
+
+    // Throws runtime_error if the metric does not exist
+    void setDeadband(const string& name, Deadband deadband);
+
+    // Records the latest value of the metric. Throws runtime_error if the metric does not exist.
+    void report(const string& name, double value);
+
+    // Publishes the pending values that are outside their deadband or whose heartbeat expired.
+    void flush(const function<void(const string& topic, const string& payload)>& send);
+
+    vector<pair<string, TelemetryCounters>> getCounters();
+
+    // Heap memory used by the metrics
+    size_t memoryUsage();
+};
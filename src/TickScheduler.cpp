@@ -0,0 +1,213 @@
+#include "TickScheduler.hpp"
+#include <stdexcept>
+#include "Metrics.cpp"
+using namespace std;
+
+
+TickScheduler::TickScheduler(size_t workerCount, chrono::milliseconds resolution, size_t slotCount)
+    : resolution(resolution), wheel(slotCount), startTime(Clock::now()) {
+    timerThread = std::thread(advanceWheel, this);
+    for(size_t i = 0; i < workerCount; i++) {
+        workers.push_back(std::thread(runTasks, this));
+    }
+}
+
+TickScheduler::~TickScheduler() {
+    stop();
+}
+
+void TickScheduler::stop() {
+    if(!running.exchange(false)) {
+        return;
+    }
+    readyCondition.notify_all();
+    timerThread.join();
+    for(auto& worker : workers) {
+        worker.join();
+    }
+}
+
+void TickScheduler::insert(shared_ptr<Task> task) {
+    // Ticks are rounded up, so a task never runs before its deadline
+    auto sinceStart = task->deadline - startTime;
+    uint64_t tick = (sinceStart.count() + resolution.count() - 1) / resolution.count();
+    // The slot of the current tick was already expired
+    if(tick <= currentTick) {
+        tick = currentTick + 1;
+    }
+    task->targetTick = tick;
+    wheel[tick % wheel.size()].push_back(task);
+}
+
+void TickScheduler::advanceWheel(TickScheduler* scheduler) {
+    while(scheduler->running) {
+        this_thread::sleep_until(scheduler->startTime + (scheduler->currentTick + 1) * scheduler->resolution);
+        uint64_t nowTick = (Clock::now() - scheduler->startTime) / scheduler->resolution;
+
+        vector<shared_ptr<Task>> expired;
+        scheduler->wheelMutex.lock();
+        // Expire every slot up to now, in case the thread woke up late
+        while(scheduler->currentTick < nowTick) {
+            scheduler->currentTick++;
+            auto& slot = scheduler->wheel[scheduler->currentTick % scheduler->wheel.size()];
+            // Tasks of later rounds stay in the slot
+            size_t kept = 0;
+            for(size_t i = 0; i < slot.size(); i++) {
+                if(slot[i]->cancelled) {
+                    continue;
+                }
+                if(slot[i]->targetTick <= scheduler->currentTick) {
+                    expired.push_back(std::move(slot[i]));
+                } else {
+                    slot[kept++] = std::move(slot[i]);
+                }
+            }
+            slot.resize(kept);
+        }
+        scheduler->wheelMutex.unlock();
+
+        if(!expired.empty()) {
+            scheduler->readyMutex.lock();
+            for(auto& task : expired) {
+                scheduler->readyTasks.push_back(std::move(task));
+            }
+            scheduler->readyMutex.unlock();
+            scheduler->readyCondition.notify_all();
+        }
+    }
+}
+
+void TickScheduler::runTasks(TickScheduler* scheduler) {
+    Histogram& duration = MetricsRegistry::global().histogram("smartbath_tick_duration_seconds",
+        "Run time of the scheduled tasks (interval checks and shut-off timers)");
+    Histogram& jitter = MetricsRegistry::global().histogram("smartbath_tick_lateness_seconds",
+        "Delay between the deadline of a scheduled task and its run");
+    Counter& failures = swallowedErrors("tick_task");
+    // The lateness is measured in microseconds
+    const double ticksPerMicrosecond = 1e-6 / metricsTickSeconds();
+    setTraceThreadName("tick");
+    while(true) {
+        shared_ptr<Task> task;
+        {
+            unique_lock<mutex> lock(scheduler->readyMutex);
+            scheduler->readyCondition.wait(lock, [scheduler] {
+                return !scheduler->running || !scheduler->readyTasks.empty();
+            });
+            if(!scheduler->running) {
+                return;
+            }
+            task = std::move(scheduler->readyTasks.front());
+            scheduler->readyTasks.pop_front();
+        }
+        if(task->cancelled) {
+            continue;
+        }
+
+        int64_t lateness = chrono::duration_cast<chrono::microseconds>(Clock::now() - task->deadline).count();
+        task->lastLateness = lateness;
+        task->totalLateness += lateness;
+        if(lateness > task->maxLateness) {
+            task->maxLateness = lateness;
+        }
+        task->runs++;
+        jitter.record(lateness > 0 ? lateness * ticksPerMicrosecond : 0);
+
+        try {
+            ScopedTimer timer(duration);
+            task->run();
+        } catch(...) {
+            failures.add();
+        }
+
+        // The next deadline is computed from the previous one, so the period does not drift
+        scheduler->wheelMutex.lock();
+        if(!task->cancelled && task->period == Clock::duration::zero()) {
+            // A one-shot task is done
+            scheduler->tasks.erase(task->id);
+        } else if(!task->cancelled) {
+            task->deadline += task->period;
+            scheduler->insert(task);
+        }
+        scheduler->wheelMutex.unlock();
+    }
+}
+
+uint64_t TickScheduler::schedule(function<void()> run, chrono::milliseconds period) {
+    auto task = make_shared<Task>();
+    task->run = std::move(run);
+    task->period = period;
+    task->deadline = Clock::now() + period;
+    wheelMutex.lock();
+    task->id = nextTaskId++;
+    tasks.insert({ task->id, task });
+    insert(task);
+    wheelMutex.unlock();
+    return task->id;
+}
+
+uint64_t TickScheduler::scheduleAt(function<void()> run, chrono::steady_clock::time_point deadline) {
+    auto task = make_shared<Task>();
+    task->run = std::move(run);
+    task->period = Clock::duration::zero();
+    task->deadline = deadline;
+    wheelMutex.lock();
+    task->id = nextTaskId++;
+    tasks.insert({ task->id, task });
+    insert(task);
+    wheelMutex.unlock();
+    return task->id;
+}
+
+void TickScheduler::cancel(uint64_t id) {
+    wheelMutex.lock();
+    auto it = tasks.find(id);
+    if(it != tasks.end()) {
+        // The wheel drops the task the next time its slot is expired
+        it->second->cancelled = true;
+        tasks.erase(it);
+    }
+    wheelMutex.unlock();
+}
+
+TickStats TickScheduler::getStats(uint64_t id) {
+    wheelMutex.lock();
+    auto it = tasks.find(id);
+    if(it == tasks.end()) {
+        wheelMutex.unlock();
+        throw std::runtime_error("TASK_NOT_FOUND");
+    }
+    auto task = it->second;
+    wheelMutex.unlock();
+
+    TickStats stats;
+    stats.runs = task->runs;
+    stats.lastLateness = task->lastLateness;
+    stats.maxLateness = task->maxLateness;
+    stats.avgLateness = stats.runs ? (double)task->totalLateness / stats.runs : 0;
+    return stats;
+}
+
+TickStats TickScheduler::getStats() {
+    // lastLateness is the worst of the last runs of the tasks
+    TickStats stats = { .runs = 0, .lastLateness = 0, .maxLateness = 0, .avgLateness = 0 };
+    int64_t totalLateness = 0;
+    wheelMutex.lock();
+    for(auto itr = tasks.begin(); itr != tasks.end(); ++itr) {
+        auto& task = itr->second;
+        stats.runs += task->runs;
+        totalLateness += task->totalLateness;
+        if(task->maxLateness > stats.maxLateness) {
+            stats.maxLateness = task->maxLateness;
+        }
+        if(task->lastLateness > stats.lastLateness) {
+            stats.lastLateness = task->lastLateness;
+        }
+    }
+    wheelMutex.unlock();
+    stats.avgLateness = stats.runs ? (double)totalLateness / stats.runs : 0;
+    return stats;
+}
+
+size_t TickScheduler::getThreadCount() {
+    return workers.size() + 1;
+}
@@ -0,0 +1,98 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+using namespace std;
+
+// How late the runs of a periodic task started, in microseconds
+typedef struct TickStats {
+    uint64_t runs;
+    int64_t lastLateness;
+    int64_t maxLateness;
+    double avgLateness;
+} TickStats;
+
+// Runs periodic and one-shot tasks on a fixed pool of worker threads.
+// Deadlines are kept in a hashed timer wheel: each slot covers one resolution step and holds
+// the tasks whose deadline falls in it, whatever the round, so inserting and expiring a task is O(1).
+class TickScheduler {
+private:
+    typedef chrono::steady_clock Clock;
+
+    struct Task {
+        uint64_t id;
+        function<void()> run;
+        // Zero for a one-shot task
+        Clock::duration period;
+        // Time at which the next run should start
+        Clock::time_point deadline;
+        // Wheel tick in which the deadline falls
+        uint64_t targetTick;
+        atomic<bool> cancelled { false };
+        atomic<uint64_t> runs { 0 };
+        atomic<int64_t> lastLateness { 0 };
+        atomic<int64_t> maxLateness { 0 };
+        atomic<int64_t> totalLateness { 0 };
+    };
+
+    const Clock::duration resolution;
+    vector<vector<shared_ptr<Task>>> wheel;
+    // Time of tick 0 of the wheel
+    Clock::time_point startTime;
+    // Last tick whose slot was expired
+    uint64_t currentTick = 0;
+    unordered_map<uint64_t, shared_ptr<Task>> tasks;
+    uint64_t nextTaskId = 1;
+    // Protects the wheel, currentTick and the tasks map
+    mutex wheelMutex;
+
+    // Tasks whose deadline passed, waiting for a worker
+    deque<shared_ptr<Task>> readyTasks;
+    mutex readyMutex;
+    condition_variable readyCondition;
+
+    std::thread timerThread;
+    vector<std::thread> workers;
+    atomic<bool> running { true };
+
+    static void advanceWheel(TickScheduler* scheduler);
+    static void runTasks(TickScheduler* scheduler);
+    // Puts the task in the slot of its deadline. wheelMutex must be held.
+    void insert(shared_ptr<Task> task);
+public:
+    TickScheduler(size_t workerCount, chrono::milliseconds resolution = chrono::milliseconds(10), size_t slotCount = 512);
+    ~TickScheduler();
+
+    /**
+     * Runs the task every period, starting one period from now.
+     * @returns The ID used to cancel the task or to get its statistics.
+    */
+    uint64_t schedule(function<void()> task, chrono::milliseconds period);
+
+    /**
+     * Runs the task once, at the first tick after the deadline.
+     * @returns The ID used to cancel the task.
+    */
+    uint64_t scheduleAt(function<void()> task, chrono::steady_clock::time_point deadline);
+
+    // The task won't be started again. A run that is in progress is not interrupted.
+    void cancel(uint64_t id);
+
+    // Throws runtime_error if the task does not exist.
+    TickStats getStats(uint64_t id);
+
+    // Statistics of all the scheduled tasks
+    TickStats getStats();
+
+    size_t getThreadCount();
+
+    // Stops the timer and the workers. Called by the destructor.
+    void stop();
+};
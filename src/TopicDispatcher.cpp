@@ -0,0 +1,121 @@
+#include "TopicDispatcher.hpp"
+#include <chrono>
+#include <stdexcept>
+using namespace std;
+
+
+TopicDispatcher::Entry* TopicDispatcher::find(uint64_t hash, bool perDevice, string_view topic) {
+    // Linear probing. The table is never full, so an empty slot ends the search.
+    for(size_t i = 0; i < TABLE_SIZE; i++) {
+        Entry* entry = table[(hash + i) & (TABLE_SIZE - 1)].get();
+        if(entry == nullptr) {
+            return nullptr;
+        }
+        if(entry->hash == hash && entry->perDevice == perDevice) {
+            string_view name = entry->topic;
+            if(perDevice) {
+                name.remove_prefix(2);
+            }
+            if(name == topic) {
+                return entry;
+            }
+        }
+    }
+    return nullptr;
+}
+
+void TopicDispatcher::addHandler(string topic, int qos, Handler handler) {
+    bool perDevice = topic.rfind("+/", 0) == 0;
+    string_view name = topic;
+    if(perDevice) {
+        name.remove_prefix(2);
+    }
+    uint64_t hash = topicHash(name);
+    if(find(hash, perDevice, name) != nullptr) {
+        throw std::runtime_error("TOPIC_ALREADY_REGISTERED");
+    }
+    // One slot is always left empty, so that lookups of unknown topics end
+    if(entries.size() + 1 >= TABLE_SIZE) {
+        throw std::runtime_error("TOO_MANY_TOPICS");
+    }
+    size_t slot = hash & (TABLE_SIZE - 1);
+    while(table[slot]) {
+        slot = (slot + 1) & (TABLE_SIZE - 1);
+    }
+    table[slot].reset(new Entry());
+    Entry* entry = table[slot].get();
+    entry->topic = topic;
+    entry->hash = hash;
+    entry->perDevice = perDevice;
+    entry->qos = qos;
+    entry->handler = std::move(handler);
+    entries.push_back(entry);
+}
+
+bool TopicDispatcher::dispatch(string_view topic, string_view payload) {
+    string_view device;
+    // Exact topics are tried first, then the topic without its device level
+    Entry* entry = find(topicHash(topic), false, topic);
+    if(entry == nullptr) {
+        size_t pos = topic.find('/');
+        if(pos != string_view::npos) {
+            device = topic.substr(0, pos);
+            string_view name = topic.substr(pos + 1);
+            entry = find(topicHash(name), true, name);
+        }
+    }
+    if(entry == nullptr) {
+        unmatched++;
+        return false;
+    }
+
+    auto start = chrono::steady_clock::now();
+    bool recognized = entry->handler(device, payload);
+    uint64_t latency = chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - start).count();
+
+    entry->messages++;
+    if(!recognized) {
+        entry->ignored++;
+    }
+    entry->totalLatency += latency;
+    // Only the dispatching thread writes the maximum
+    if(latency > entry->maxLatency) {
+        entry->maxLatency = latency;
+    }
+    return recognized;
+}
+
+vector<string> TopicDispatcher::getTopics() {
+    vector<string> topics;
+    for(auto entry : entries) {
+        topics.push_back(entry->topic);
+    }
+    return topics;
+}
+
+vector<int> TopicDispatcher::getQos() {
+    vector<int> qos;
+    for(auto entry : entries) {
+        qos.push_back(entry->qos);
+    }
+    return qos;
+}
+
+vector<TopicStats> TopicDispatcher::getStats() {
+    vector<TopicStats> stats;
+    for(auto entry : entries) {
+        uint64_t messages = entry->messages;
+        stats.push_back({
+            .topic = entry->topic,
+            .messages = messages,
+            .ignored = entry->ignored,
+            .avgLatency = messages ? (double)entry->totalLatency / messages : 0,
+            .maxLatency = entry->maxLatency
+        });
+    }
+    return stats;
+}
+
+uint64_t TopicDispatcher::getUnmatched() {
+    return unmatched;
+}
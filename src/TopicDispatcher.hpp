@@ -0,0 +1,78 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+using namespace std;
+
+// FNV-1a hash of a topic, usable at compile time for the known topics
+constexpr uint64_t topicHash(string_view topic) {
+    uint64_t hash = 14695981039346656037ULL;
+    for(char c : topic) {
+        hash ^= (unsigned char)c;
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+typedef struct TopicStats {
+    string topic;
+    uint64_t messages;
+    // Messages the handler did not recognize
+    uint64_t ignored;
+    // Time spent in the handler, in nanoseconds
+    double avgLatency;
+    uint64_t maxLatency;
+} TopicStats;
+
+// Routes MQTT messages to handlers in O(1) through an open addressing table of topic hashes.
+// A handler is registered either for an exact topic ("command") or for a topic of any device ("+/salt"),
+// in which case the first level of the topic is given to the handler as the device ID.
+// Handlers must be added before messages are dispatched.
+class TopicDispatcher {
+public:
+    // Returns false if the message was not recognized
+    typedef function<bool(string_view device, string_view payload)> Handler;
+private:
+    struct Entry {
+        // Subscription pattern, e.g. "+/salt"
+        string topic;
+        // Hash of the topic without the device level
+        uint64_t hash;
+        bool perDevice;
+        int qos;
+        Handler handler;
+        atomic<uint64_t> messages { 0 };
+        atomic<uint64_t> ignored { 0 };
+        atomic<uint64_t> totalLatency { 0 };
+        atomic<uint64_t> maxLatency { 0 };
+    };
+
+    // Power of two, so that the slot of a hash is a mask away
+    static const size_t TABLE_SIZE = 64;
+    unique_ptr<Entry> table[TABLE_SIZE];
+    vector<Entry*> entries;
+    atomic<uint64_t> unmatched { 0 };
+
+    Entry* find(uint64_t hash, bool perDevice, string_view topic);
+public:
+    /**
+     * Registers the handler of a topic. "+/<topic>" matches <topic> for every device.
+     * Throws runtime_error if the topic is already registered or the table is full.
+    */
+    void addHandler(string topic, int qos, Handler handler);
+
+    // Calls the handler of the topic. Returns false if there is none or the message was not recognized.
+    bool dispatch(string_view topic, string_view payload);
+
+    // Topics and QoS to subscribe to
+    vector<string> getTopics();
+    vector<int> getQos();
+
+    vector<TopicStats> getStats();
+    // Messages with no handler
+    uint64_t getUnmatched();
+};
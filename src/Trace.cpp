@@ -0,0 +1,167 @@
+#pragma once
+#include "Trace.hpp"
+#include <cstring>
+#include <deque>
+#include <mutex>
+#include <vector>
+#include <unistd.h>
+#include "Metrics.hpp"
+#include "JsonWriter.cpp"
+using namespace std;
+
+atomic<bool> tracingEnabled { false };
+
+// Origin of the timestamps of the trace
+static const uint64_t traceOriginTicks = metricsNow();
+
+/**
+ * Events of one thread. Only the thread writes, any thread can copy the events without locking it.
+ * Like a Seqlock, the writer claims the slot before writing its words and publishes it after, so a reader
+ * leaves out the slots that were claimed again while it copied them.
+*/
+struct TraceRing {
+    static const size_t WORDS = sizeof(TraceEvent) / sizeof(uint64_t);
+
+    // Events begun by the writer, an event is claimed before its words are written
+    alignas(64) atomic<uint64_t> claimed { 0 };
+    // Events completely written
+    atomic<uint64_t> head { 0 };
+    atomic<uint64_t> words[TRACE_RING_EVENTS][WORDS];
+    uint64_t tid = 0;
+    atomic<const char*> name { nullptr };
+
+    void write(const TraceEvent& event) {
+        uint64_t buffer[WORDS];
+        memcpy(buffer, &event, sizeof(TraceEvent));
+        uint64_t index = head.load(memory_order_relaxed);
+        claimed.store(index + 1, memory_order_relaxed);
+        // The claim must be visible before any of the words
+        atomic_thread_fence(memory_order_release);
+        auto& slot = words[index % TRACE_RING_EVENTS];
+        for(size_t i = 0; i < WORDS; i++) {
+            slot[i].store(buffer[i], memory_order_relaxed);
+        }
+        head.store(index + 1, memory_order_release);
+    }
+
+    // Appends the events that were not overwritten during the copy, oldest first
+    void read(vector<TraceEvent>& events) const {
+        uint64_t end = head.load(memory_order_acquire);
+        uint64_t begin = end > TRACE_RING_EVENTS ? end - TRACE_RING_EVENTS : 0;
+        vector<TraceEvent> copied(end - begin);
+        for(uint64_t index = begin; index < end; index++) {
+            uint64_t buffer[WORDS];
+            auto& slot = words[index % TRACE_RING_EVENTS];
+            for(size_t i = 0; i < WORDS; i++) {
+                buffer[i] = slot[i].load(memory_order_relaxed);
+            }
+            memcpy(&copied[index - begin], buffer, sizeof(TraceEvent));
+        }
+        // The words must be read before the claims are checked
+        atomic_thread_fence(memory_order_acquire);
+        uint64_t lastClaimed = claimed.load(memory_order_relaxed);
+        uint64_t valid = lastClaimed > TRACE_RING_EVENTS ? lastClaimed - TRACE_RING_EVENTS : 0;
+        for(uint64_t index = max(begin, valid); index < end; index++) {
+            events.push_back(copied[index - begin]);
+        }
+    }
+};
+
+static_assert(sizeof(TraceEvent) == 64, "A trace event is one cache line");
+
+// Rings of every thread that recorded. They are kept after the thread exits, so that its events are still written.
+struct TraceRings {
+    mutex ringsMutex;
+    deque<unique_ptr<TraceRing>> rings;
+
+    static TraceRings& global() {
+        static TraceRings traceRings;
+        return traceRings;
+    }
+};
+
+static thread_local TraceRing* threadRing = nullptr;
+static thread_local const char* threadName = nullptr;
+
+static TraceRing& getThreadRing() {
+    if(!threadRing) {
+        TraceRings& global = TraceRings::global();
+        lock_guard<mutex> lock(global.ringsMutex);
+        global.rings.push_back(make_unique<TraceRing>());
+        threadRing = global.rings.back().get();
+        threadRing->tid = global.rings.size();
+        threadRing->name.store(threadName, memory_order_relaxed);
+    }
+    return *threadRing;
+}
+
+void setTracing(bool enabled) {
+    tracingEnabled.store(enabled, memory_order_relaxed);
+}
+
+void traceRecord(char phase, const char* category, const char* name, string_view detail) {
+    TraceEvent event;
+    event.ticks = metricsNow();
+    event.name = name;
+    event.category = category;
+    event.phase = phase;
+    size_t length = min(detail.size(), (size_t)TRACE_DETAIL_SIZE - 1);
+    memcpy(event.detail, detail.data(), length);
+    memset(event.detail + length, 0, TRACE_DETAIL_SIZE - length);
+    getThreadRing().write(event);
+}
+
+void setTraceThreadName(const char* name) {
+    threadName = name;
+    if(threadRing) {
+        threadRing->name.store(name, memory_order_relaxed);
+    }
+}
+
+void writeChromeTrace(string& out) {
+    const double microsecondsPerTick = metricsTickSeconds() * 1e6;
+    const uint64_t pid = getpid();
+    vector<TraceEvent> events;
+    JsonWriter json(out);
+    json.beginObject().key("traceEvents").beginArray();
+    TraceRings& global = TraceRings::global();
+    lock_guard<mutex> lock(global.ringsMutex);
+    for(auto& ring : global.rings) {
+        if(const char* name = ring->name.load(memory_order_relaxed)) {
+            json.beginObject()
+                .field("name", "thread_name").field("ph", "M").field("pid", pid).field("tid", ring->tid)
+                .key("args").beginObject().field("name", name).endObject()
+                .endObject();
+        }
+        events.clear();
+        ring->read(events);
+        // The begin of the first spans may have been overwritten, their ends are left out
+        uint64_t depth = 0;
+        for(auto& event : events) {
+            if(event.phase == 'B') {
+                depth++;
+            } else if(event.phase == 'E') {
+                if(depth == 0) {
+                    continue;
+                }
+                depth--;
+            }
+            json.beginObject()
+                .field("name", event.name)
+                .field("cat", event.category)
+                .field("ph", string_view(&event.phase, 1))
+                .field("ts", (int64_t)(event.ticks - traceOriginTicks) * microsecondsPerTick)
+                .field("pid", pid)
+                .field("tid", ring->tid);
+            if(event.phase == 'i') {
+                // Instant events are drawn on the track of their thread
+                json.field("s", "t");
+            }
+            if(event.detail[0] != '\0') {
+                json.key("args").beginObject().field("detail", string_view(event.detail)).endObject();
+            }
+            json.endObject();
+        }
+    }
+    json.endArray().endObject();
+}
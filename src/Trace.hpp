@@ -0,0 +1,73 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <string_view>
+using namespace std;
+
+// Events kept per thread. A thread that records more overwrites its oldest events.
+#ifndef TRACE_RING_EVENTS
+#define TRACE_RING_EVENTS 8192
+#endif
+// Bytes of the detail of an event (the bath, the topic or the route), with its terminating zero. Longer details are cut.
+#define TRACE_DETAIL_SIZE 39
+
+// An event of the trace, 64 bytes. The name and the category are string literals, only their pointers are kept.
+typedef struct TraceEvent {
+    uint64_t ticks;
+    const char* name;
+    const char* category;
+    // 'B' begins a span, 'E' ends it, 'i' is an instant event
+    char phase;
+    char detail[TRACE_DETAIL_SIZE];
+} TraceEvent;
+
+extern atomic<bool> tracingEnabled;
+
+// Whether the events are recorded. When tracing is off, this relaxed load is all a trace point costs.
+inline bool tracing() {
+    return tracingEnabled.load(memory_order_relaxed);
+}
+
+void setTracing(bool enabled);
+
+// Records an event in the ring of the calling thread, allocated on its first event.
+// The name and the category must be string literals, the detail is copied.
+void traceRecord(char phase, const char* category, const char* name, string_view detail = {});
+
+inline void traceInstant(const char* category, const char* name, string_view detail = {}) {
+    if(tracing()) {
+        traceRecord('i', category, name, detail);
+    }
+}
+
+// Name of the calling thread in the trace. The name must be a string literal.
+void setTraceThreadName(const char* name);
+
+// Writes the events of every thread in the Chrome trace_event format, which chrome://tracing and Perfetto open.
+// The threads keep recording meanwhile, the events they overwrite during the copy are left out.
+void writeChromeTrace(string& out);
+
+// Span from its construction to its destruction. The end is recorded if the begin was, even if tracing was turned off since.
+class TraceSpan {
+private:
+    const char* category;
+    const char* name;
+    bool recorded;
+public:
+    TraceSpan(const char* category, const char* name, string_view detail = {})
+        : category(category), name(name), recorded(tracing()) {
+        if(recorded) {
+            traceRecord('B', category, name, detail);
+        }
+    }
+
+    ~TraceSpan() {
+        if(recorded) {
+            traceRecord('E', category, name);
+        }
+    }
+
+    TraceSpan(const TraceSpan&) = delete;
+    TraceSpan& operator=(const TraceSpan&) = delete;
+};
@@ -0,0 +1,114 @@
+#include "WaterAnalytics.hpp"
+#include <cmath>
+#include <stdexcept>
+using namespace std;
+
+// Acceptable range of each parameter
+static const double PARAMETER_LIMITS[WATER_PARAMETERS][2] = {
+    { 6.5, 8.5 },
+    { 250.0, 400.0 },
+    { 0.1, 0.3 },
+    { 100.0, 180.0 },
+    { 15.0, 30.0 }
+};
+
+
+bool WaterAnalytics::inRange(const double (&values)[WATER_PARAMETERS], double margin) {
+    for(int i = 0; i < WATER_PARAMETERS; i++) {
+        double low = PARAMETER_LIMITS[i][0], high = PARAMETER_LIMITS[i][1];
+        double band = (high - low) * margin;
+        if(!(low + band <= values[i] && values[i] <= high - band)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool WaterAnalytics::add(const double (&values)[WATER_PARAMETERS]) {
+    for(int i = 0; i < WATER_PARAMETERS; i++) {
+        Parameter& parameter = parameters[i];
+        double value = values[i];
+        if(!isfinite(value)) {
+            continue;
+        }
+        parameter.value = value;
+        // Scored against the previous samples, so that an outlier does not hide itself
+        double stddev = parameter.samples > 1 ? sqrt(parameter.squaredDistances / (parameter.samples - 1)) : 0;
+        parameter.zScore = stddev > 0 ? (value - parameter.mean) / stddev : 0;
+        if(parameter.samples >= WATER_ANOMALY_MIN_SAMPLES && fabs(parameter.zScore) > WATER_ANOMALY_Z) {
+            parameter.anomalies++;
+        }
+
+        parameter.samples++;
+        double distance = value - parameter.mean;
+        parameter.mean += distance / parameter.samples;
+        parameter.squaredDistances += distance * (value - parameter.mean);
+
+        if(parameter.samples == 1) {
+            parameter.ewma = value;
+            parameter.ewmaVariance = 0;
+        } else {
+            double ewmaDistance = value - parameter.ewma;
+            double increment = WATER_EWMA_ALPHA * ewmaDistance;
+            parameter.ewma += increment;
+            parameter.ewmaVariance = (1 - WATER_EWMA_ALPHA) * (parameter.ewmaVariance + ewmaDistance * increment);
+        }
+    }
+
+    // A single bad sample is not enough to shut the pipes off, and values hovering
+    // around a limit do not turn them back on and off
+    bool wasUnsafe = unsafe;
+    if(!unsafe) {
+        badSamples = inRange(values, 0) ? 0 : badSamples + 1;
+        goodSamples = 0;
+        if(badSamples >= debounce.shutoffSamples) {
+            unsafe = true;
+            shutoffs++;
+        }
+    } else {
+        goodSamples = inRange(values, debounce.hysteresis) ? goodSamples + 1 : 0;
+        badSamples = 0;
+        if(goodSamples >= debounce.resumeSamples) {
+            unsafe = false;
+        }
+    }
+    return unsafe != wasUnsafe;
+}
+
+bool WaterAnalytics::isUnsafe() const {
+    return unsafe;
+}
+
+void WaterAnalytics::setDebounce(WaterDebounce debounce) {
+    if(debounce.shutoffSamples == 0 || debounce.resumeSamples == 0
+        || !(0 <= debounce.hysteresis && debounce.hysteresis < 0.5)) {
+        throw std::runtime_error("INVALID_DEBOUNCE");
+    }
+    this->debounce = debounce;
+}
+
+WaterQualityStats WaterAnalytics::getStats() const {
+    WaterQualityStats stats;
+    for(int i = 0; i < WATER_PARAMETERS; i++) {
+        const Parameter& parameter = parameters[i];
+        double low = PARAMETER_LIMITS[i][0], high = PARAMETER_LIMITS[i][1];
+        double band = (high - low) * WATER_DRIFT_MARGIN;
+        stats.parameters[i] = {
+            .value = parameter.value,
+            .ewma = parameter.ewma,
+            .ewmaStddev = sqrt(parameter.ewmaVariance),
+            .mean = parameter.mean,
+            .stddev = parameter.samples > 1 ? sqrt(parameter.squaredDistances / (parameter.samples - 1)) : 0,
+            .zScore = parameter.zScore,
+            .samples = parameter.samples,
+            .anomalies = parameter.anomalies,
+            .drifting = parameter.samples > 0 && !(low + band <= parameter.ewma && parameter.ewma <= high - band)
+        };
+    }
+    stats.unsafe = unsafe;
+    stats.badSamples = badSamples;
+    stats.goodSamples = goodSamples;
+    stats.shutoffs = shutoffs;
+    stats.debounce = debounce;
+    return stats;
+}
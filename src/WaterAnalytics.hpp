@@ -0,0 +1,125 @@
+#pragma once
+#include <cstdint>
+using namespace std;
+
+// Number of water quality parameters: pH, chlorides, iron, calcium, color
+#define WATER_PARAMETERS 5
+
+// Weight of a new sample in the moving averages
+#ifndef WATER_EWMA_ALPHA
+#define WATER_EWMA_ALPHA 0.1
+#endif
+// A sample further than this many standard deviations from the mean is an anomaly...
+#ifndef WATER_ANOMALY_Z
+#define WATER_ANOMALY_Z 4.0
+#endif
+// ...once the mean has this many samples
+#ifndef WATER_ANOMALY_MIN_SAMPLES
+#define WATER_ANOMALY_MIN_SAMPLES 30
+#endif
+// A parameter drifts when its moving average is within this fraction of the range width from a limit
+#ifndef WATER_DRIFT_MARGIN
+#define WATER_DRIFT_MARGIN 0.1
+#endif
+// Default debounce of the shut-off, see WaterDebounce
+#ifndef WATER_SHUTOFF_SAMPLES
+#define WATER_SHUTOFF_SAMPLES 3
+#endif
+#ifndef WATER_RESUME_SAMPLES
+#define WATER_RESUME_SAMPLES 5
+#endif
+#ifndef WATER_HYSTERESIS
+#define WATER_HYSTERESIS 0.05
+#endif
+
+// When bad water quality shuts the pipes off, and when it is good again
+typedef struct WaterDebounce {
+    // Consecutive samples out of range before the water is unsafe
+    uint32_t shutoffSamples;
+    // Consecutive samples back in range before it is safe again
+    uint32_t resumeSamples;
+    // To be back in range, the values must be inside their range shrunk by this fraction of its width on each side
+    double hysteresis;
+} WaterDebounce;
+
+typedef struct WaterParameterStats {
+    // Latest sample
+    double value;
+    // Exponentially weighted moving average and standard deviation
+    double ewma;
+    double ewmaStddev;
+    // Mean and standard deviation of all the samples (Welford)
+    double mean;
+    double stddev;
+    // Distance of the latest sample from the mean of the previous ones, in standard deviations
+    double zScore;
+    uint64_t samples;
+    // Samples whose z-score was above WATER_ANOMALY_Z
+    uint64_t anomalies;
+    // The moving average is close to a limit of the range, or past it
+    bool drifting;
+} WaterParameterStats;
+
+typedef struct WaterQualityStats {
+    WaterParameterStats parameters[WATER_PARAMETERS];
+    // Debounced state, which shuts the pipes off
+    bool unsafe;
+    // Consecutive samples out of range, and back in range
+    uint32_t badSamples;
+    uint32_t goodSamples;
+    // Times the water became unsafe
+    uint64_t shutoffs;
+    WaterDebounce debounce;
+} WaterQualityStats;
+
+/**
+ * Rolling statistics of the water quality samples, and the debounced safe/unsafe state.
+ * Each sample is processed in O(1) time and memory, so it can run on every message of the sensor.
+ * Not thread safe, the owner must synchronize the calls.
+*/
+class WaterAnalytics {
+private:
+    struct Parameter {
+        double value;
+        double ewma;
+        double ewmaVariance;
+        // Welford accumulators
+        uint64_t samples;
+        double mean;
+        double squaredDistances;
+        double zScore;
+        uint64_t anomalies;
+    };
+
+    Parameter parameters[WATER_PARAMETERS] = {};
+    WaterDebounce debounce = { WATER_SHUTOFF_SAMPLES, WATER_RESUME_SAMPLES, WATER_HYSTERESIS };
+    bool unsafe = false;
+    uint32_t badSamples = 0;
+    uint32_t goodSamples = 0;
+    uint64_t shutoffs = 0;
+
+    // True if every value is in its range, shrunk by margin times its width on each side
+    static bool inRange(const double (&values)[WATER_PARAMETERS], double margin);
+public:
+    /**
+     * Adds a sample, in the order of WaterQuality. A value that is not finite (NaN or infinite) counts as out of range,
+     * but is left out of the statistics of its parameter, which would otherwise stay NaN.
+     * @returns true if the debounced state changed.
+    */
+    bool add(const double (&values)[WATER_PARAMETERS]);
+
+    // True once enough consecutive samples were out of range, until enough are back in range
+    bool isUnsafe() const;
+
+    // Throws runtime_error if a sample count is 0 or the hysteresis is not in [0, 0.5)
+    void setDebounce(WaterDebounce debounce);
+
+    WaterQualityStats getStats() const;
+
+    // Name used by the API (pH, chlorides, iron, calcium, color).
+    // Inline, so that the JSON helpers of util.cpp do not need this file linked in.
+    static const char* parameterName(int parameter) {
+        static const char* const NAMES[WATER_PARAMETERS] = { "pH", "chlorides", "iron", "calcium", "color" };
+        return NAMES[parameter];
+    }
+};
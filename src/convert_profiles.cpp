@@ -0,0 +1,23 @@
+// Converts a profiles CSV file of the previous versions into a profile store.
+// The server converts profiles-<id>.csv by itself when profiles-<id>.bin does not exist yet,
+// this tool is for converting the files ahead of time or outside of the server.
+// Usage: convert_profiles <profiles.csv> <profiles.bin>
+#include <iostream>
+#include "Journal.cpp"
+#include "JsonWriter.cpp"
+#include "ProfileStore.cpp"
+using namespace std;
+
+int main(int argc, char** argv) {
+    if(argc != 3) {
+        cout << "Usage: " << argv[0] << " <profiles.csv> <profiles.bin>\n";
+        return 2;
+    }
+    long long converted = -1;
+    if(!replaceFile(argv[2], [&](int fd) { converted = ProfileStore::convertCsv(argv[1], fd); return converted >= 0; })) {
+        cout << "The store can't be written.\n";
+        return 1;
+    }
+    cout << "Converted " << converted << " profiles.\n";
+    return 0;
+}
@@ -4,3 +4,5 @@
 #define MQTT_SERVER_ADDRESS "tcp://localhost:1883"
 #define MQTT_CLIENT_ID "smartbath"
 #define HTTP_ENDPOINT_PORT 9080
+// Device ID of the bath served by the routes without the /baths/:id prefix
+#define DEFAULT_BATH_ID "smartbath"
@@ -0,0 +1,272 @@
+// Simulates a fleet of sensors and displays against the registry, through a broker, and reports
+// the latency from the publish of a message to the state change of the bath and to the echo on its display topic,
+// then the saturation throughput of the consume loop.
+// The payloads carry a sequence number in their value (the temperature), which maps to the time they were published:
+// - temperature sensor: "<temperature>", observed through the default temperature of the bath
+// - display: "setPipe/bath/on/0.1/<temperature>", observed through the bath state and the "pipe/bath/on/..." echo
+// The water quality and salt sensors only add load. The state is read like the GET routes do: the snapshot without locking,
+// the default temperature under the lock of the bath, every OBSERVER_PAUSE_US, which bounds the resolution of the latencies.
+// Usage: load_generator [baths] [sensor rate] [display rate] [seconds] [broker]
+//   rates are messages/second per bath and per sensor, broker defaults to "loopback" (the broker inside the process)
+#include <algorithm>
+#include <iostream>
+#include <queue>
+#include "BathRegistry.cpp"
+#include "env.hpp"
+using namespace std;
+
+typedef chrono::steady_clock Clock;
+
+// Values published with a sequence number: base + (sequence % SEQUENCE_WINDOW) * SEQUENCE_STEP
+#define SEQUENCE_WINDOW (1 << 22)
+#define SEQUENCE_STEP 1e-6
+#define SENSOR_BASE 20.0
+#define DISPLAY_BASE 30.0
+// Generator threads, each with its own connection to the broker
+#define GENERATOR_THREADS 4
+// Pause of the observer between two reads of the baths, so that it does not take a core from the consume loop
+#define OBSERVER_PAUSE_US 100
+
+enum class Kind { Temperature, WaterQuality, Salt, Display };
+
+// Messages of one bath and one kind, published every period seconds
+typedef struct Stream {
+    // Time of the next message, in seconds since the start
+    double next;
+    double period;
+    size_t bath;
+    Kind kind;
+} Stream;
+
+// Publish times of the messages with a sequence number, and the latencies observed for them
+class LatencyRecorder {
+private:
+    const double base;
+    unique_ptr<atomic<int64_t>[]> sent;
+    atomic<uint64_t> sequence { 0 };
+    mutex latenciesMutex;
+    vector<int64_t> latencies[2];
+public:
+    explicit LatencyRecorder(double base) : base(base), sent(new atomic<int64_t>[SEQUENCE_WINDOW]) {}
+
+    static int64_t now() {
+        return chrono::duration_cast<chrono::nanoseconds>(Clock::now().time_since_epoch()).count();
+    }
+
+    // Value to publish for the next sequence number, recording the publish time
+    double next() {
+        uint64_t slot = sequence++ % SEQUENCE_WINDOW;
+        sent[slot].store(now(), memory_order_relaxed);
+        return base + slot * SEQUENCE_STEP;
+    }
+
+    // Records the latency of the message that carried value. Index 0: state change, 1: display echo.
+    void observe(int index, double value, int64_t time) {
+        double slot = round((value - base) / SEQUENCE_STEP);
+        if(!(0 <= slot && slot < SEQUENCE_WINDOW)) {
+            return;
+        }
+        int64_t latency = time - sent[(size_t)slot].load(memory_order_relaxed);
+        lock_guard<mutex> lock(latenciesMutex);
+        latencies[index].push_back(latency);
+    }
+
+    void report(const char* name, int index) {
+        auto& values = latencies[index];
+        sort(values.begin(), values.end());
+        cerr << name << ": " << values.size() << "/" << sequence << " observed";
+        if(!values.empty()) {
+            auto percentile = [&values](double p) {
+                return values[min((size_t)(values.size() * p), values.size() - 1)] / 1000.0;
+            };
+            cerr << ", p50 " << percentile(0.5) << " us, p99 " << percentile(0.99) << " us, p999 " << percentile(0.999)
+                 << " us, max " << values.back() / 1000.0 << " us";
+        }
+        cerr << "\n";
+    }
+};
+
+// Streams of the baths of a generator thread. A rate below 1 message/second is published every 1/rate seconds.
+vector<Stream> makeStreams(size_t firstBath, size_t bathCount, size_t threads, double sensorRate, double displayRate) {
+    vector<Stream> streams;
+    for(size_t bath = firstBath; bath < bathCount; bath += threads) {
+        // The streams of the baths are shifted, so that they don't all publish at once
+        double shift = (double)bath / bathCount;
+        for(Kind kind : { Kind::Temperature, Kind::WaterQuality, Kind::Salt, Kind::Display }) {
+            double rate = kind == Kind::Display ? displayRate : sensorRate;
+            if(rate > 0) {
+                streams.push_back({ .next = shift / rate, .period = 1 / rate, .bath = bath, .kind = kind });
+            }
+        }
+    }
+    return streams;
+}
+
+string formatValue(double value) {
+    char text[32];
+    snprintf(text, sizeof(text), "%.6f", value);
+    return text;
+}
+
+int main(int argc, char** argv) {
+    size_t bathCount = argc > 1 ? stoul(argv[1]) : 100;
+    double sensorRate = argc > 2 ? stod(argv[2]) : 10;
+    double displayRate = argc > 3 ? stod(argv[3]) : 1;
+    int seconds = argc > 4 ? stoi(argv[4]) : 10;
+    string broker = argc > 5 ? argv[5] : LOOPBACK_ADDRESS;
+
+    // The registry prints every message it receives
+    cout.setstate(ios::failbit);
+    BathRegistry registry(makeTransport(broker, "loadgen-registry", false),
+        makeTransport(broker, "loadgen-registry-publisher", false));
+    vector<shared_ptr<SmartBath>> baths;
+    vector<string> ids;
+    for(size_t i = 0; i < bathCount; i++) {
+        ids.push_back("load" + to_string(i));
+        baths.push_back(registry.addBath(ids.back()));
+        // The pipe is turned on by the displays, the bathtub must not fill up
+        baths.back()->toggleStopper(false);
+    }
+
+    LatencyRecorder temperatures(SENSOR_BASE), commands(DISPLAY_BASE);
+    atomic<bool> running { true };
+
+    // Display echoes
+    auto displays = makeTransport(broker, "loadgen-displays", false);
+    displays->connect();
+    displays->subscribe({ "+/display" }, { 0 });
+    std::thread echoThread([&] {
+        string topic, payload;
+        const string prefix = "pipe/bath/on/0.1/";
+        while(displays->consume(topic, payload)) {
+            if(payload.compare(0, prefix.size(), prefix) == 0) {
+                commands.observe(1, strtod(payload.c_str() + prefix.size(), nullptr), LatencyRecorder::now());
+            }
+        }
+    });
+    // State changes, read from the baths like the GET routes do
+    std::thread observerThread([&] {
+        // Initial values, which weren't published by the generator
+        vector<double> lastTemperature, lastPipe;
+        BathSnapshot snapshot;
+        for(auto& bath : baths) {
+            lastTemperature.push_back(bath->getDefaultTemperature());
+            bath->getSnapshot(snapshot);
+            lastPipe.push_back(snapshot.bathState.temperature);
+        }
+        while(running) {
+            this_thread::sleep_for(chrono::microseconds(OBSERVER_PAUSE_US));
+            for(size_t i = 0; i < bathCount; i++) {
+                double temperature = baths[i]->getDefaultTemperature();
+                baths[i]->getSnapshot(snapshot);
+                int64_t now = LatencyRecorder::now();
+                if(temperature != lastTemperature[i]) {
+                    lastTemperature[i] = temperature;
+                    temperatures.observe(0, temperature, now);
+                }
+                if(snapshot.bathState.temperature != lastPipe[i]) {
+                    lastPipe[i] = snapshot.bathState.temperature;
+                    commands.observe(0, snapshot.bathState.temperature, now);
+                }
+            }
+        }
+    });
+    this_thread::sleep_for(chrono::milliseconds(200));
+
+    // Paced load
+    auto topicCount = [&registry] {
+        uint64_t messages = 0;
+        for(auto& topic : registry.getTopicStats()) {
+            // The echoes the baths publish on their display topic come back to the registry and are ignored
+            messages += topic.messages - topic.ignored;
+        }
+        return messages;
+    };
+    uint64_t receivedBefore = topicCount();
+    atomic<uint64_t> offered { 0 };
+    size_t threadCount = min((size_t)GENERATOR_THREADS, bathCount);
+    vector<std::thread> generators;
+    auto start = Clock::now();
+    for(size_t t = 0; t < threadCount; t++) {
+        generators.emplace_back([&, t] {
+            auto transport = makeTransport(broker, "loadgen-" + to_string(t), false);
+            transport->connect();
+            // The stream whose next message is the earliest is on top
+            auto later = [](const Stream& a, const Stream& b) { return a.next > b.next; };
+            vector<Stream> streams = makeStreams(t, bathCount, threadCount, sensorRate, displayRate);
+            priority_queue<Stream, vector<Stream>, decltype(later)> schedule(later, std::move(streams));
+            while(!schedule.empty() && schedule.top().next < seconds) {
+                Stream message = schedule.top();
+                schedule.pop();
+                this_thread::sleep_until(start + chrono::duration_cast<Clock::duration>(
+                    chrono::duration<double>(message.next)));
+                const string& id = ids[message.bath];
+                switch(message.kind) {
+                case Kind::Temperature:
+                    transport->publish(id + "/temperature", formatValue(temperatures.next()), 0);
+                    break;
+                case Kind::WaterQuality:
+                    transport->publish(id + "/waterQuality", "7.2,310,0.18,140,22", 0);
+                    break;
+                case Kind::Salt:
+                    transport->publish(id + "/salt", "0.8", 0);
+                    break;
+                case Kind::Display:
+                    transport->publish(id + "/display", "setPipe/bath/on/0.1/" + formatValue(commands.next()), 0);
+                    break;
+                }
+                offered++;
+                message.next += message.period;
+                schedule.push(message);
+            }
+            transport->disconnect();
+        });
+    }
+    for(auto& thread : generators) {
+        thread.join();
+    }
+    double pacedTime = chrono::duration<double>(Clock::now() - start).count();
+    this_thread::sleep_for(chrono::milliseconds(500));
+    uint64_t handled = topicCount() - receivedBefore;
+    running = false;
+    observerThread.join();
+
+    // Saturation: the sensors publish as fast as the broker lets them, with QoS 1 so that nothing is dropped
+    generators.clear();
+    receivedBefore = topicCount();
+    start = Clock::now();
+    auto end = start + chrono::seconds(max(seconds / 2, 1));
+    for(size_t t = 0; t < threadCount; t++) {
+        generators.emplace_back([&, t] {
+            auto transport = makeTransport(broker, "loadgen-" + to_string(t), false);
+            transport->connect();
+            for(size_t i = t; Clock::now() < end; i += threadCount) {
+                const string& id = ids[i % bathCount];
+                if(i % 2 == 0) {
+                    transport->publish(id + "/temperature", "36.5", 1);
+                } else {
+                    transport->publish(id + "/waterQuality", "7.2,310,0.18,140,22", 1);
+                }
+            }
+            transport->flush(chrono::seconds(10));
+            transport->disconnect();
+        });
+    }
+    for(auto& thread : generators) {
+        thread.join();
+    }
+    double saturationTime = chrono::duration<double>(Clock::now() - start).count();
+    uint64_t saturated = topicCount() - receivedBefore;
+
+    cerr << bathCount << " baths, " << sensorRate << " messages/s per sensor, " << displayRate
+         << " commands/s per display, broker " << broker << "\n";
+    cerr << "offered " << offered / pacedTime << " messages/s, handled " << handled << "/" << offered << "\n";
+    temperatures.report("temperature -> state change", 0);
+    commands.report("setPipe -> state change    ", 0);
+    commands.report("setPipe -> display echo    ", 1);
+    cerr << "saturation: " << saturated / saturationTime << " messages/s consumed\n";
+
+    displays->disconnect();
+    echoThread.join();
+    return 0;
+}
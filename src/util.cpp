@@ -1,6 +1,13 @@
 #pragma once
+#include <cctype>
+#include <charconv>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
 #include <vector>
 #include <string>
+#include <string_view>
+#include "JsonWriter.cpp"
 using namespace std;
 
 vector<string> splitString(string s, string& delimiter) {
@@ -24,21 +31,528 @@ vector<double> convertStringVector(vector<string>& stringVector) {
     return result;
 }
 
-string pipeStateToJson(PipeState state) {
-    // Response to be sent
-    string stateResponse = "{\"isOn\": " + to_string(state.isOn);
+// Parses the digits of a hexadecimal double after its 0x prefix, stopping where strtod stops.
+// from_chars is only given the longest valid prefix, since it is more lenient with signs and exponents.
+static from_chars_result parseHexNumber(const char* first, const char* last, double& value) {
+    const char* end = first;
+    bool hasDigits = false, hasDot = false;
+    while(end < last && (isxdigit((unsigned char)*end) || (*end == '.' && !hasDot))) {
+        hasDigits = hasDigits || *end != '.';
+        hasDot = hasDot || *end == '.';
+        end++;
+    }
+    // strtod reads "0x" without digits as 0, stopping at the x
+    if(!hasDigits) {
+        value = 0;
+        return { first, errc() };
+    }
+    // The exponent is only part of the number if it has digits
+    if(end < last && (*end == 'p' || *end == 'P')) {
+        const char* exponent = end + 1;
+        if(exponent < last && (*exponent == '+' || *exponent == '-')) {
+            exponent++;
+        }
+        if(exponent < last && isdigit((unsigned char)*exponent)) {
+            end = exponent;
+            while(end < last && isdigit((unsigned char)*end)) {
+                end++;
+            }
+        }
+    }
+    return from_chars(first, end, value, chars_format::hex);
+}
+
+/**
+ * Parses a double the way stod does (leading spaces, '+' sign, hexadecimal, trailing characters ignored),
+ * without allocating or throwing.
+ * @returns false where stod would throw.
+*/
+bool parseNumber(string_view token, double& value) {
+    size_t pos = 0;
+    while(pos < token.size() && isspace((unsigned char)token[pos])) {
+        pos++;
+    }
+    bool negative = false;
+    if(pos < token.size() && (token[pos] == '+' || token[pos] == '-')) {
+        negative = token[pos] == '-';
+        pos++;
+        // from_chars does not accept a sign after the one we skipped
+        if(pos < token.size() && (token[pos] == '+' || token[pos] == '-')) {
+            return false;
+        }
+    }
+    const char* first = token.data() + pos;
+    const char* last = token.data() + token.size();
+    from_chars_result result;
+    if(last - first > 2 && first[0] == '0' && (first[1] == 'x' || first[1] == 'X')) {
+        result = parseHexNumber(first + 2, last, value);
+    } else {
+        result = from_chars(first, last, value);
+    }
+    if(result.ec != errc()) {
+        return false;
+    }
+    if(negative) {
+        value = -value;
+    }
+    return true;
+}
+
+/**
+ * Parses the "pH,chlorides,iron,calcium,color" payload of the waterQuality topic.
+ * Like the previous splitString/stod path, tokens after the fifth must be numbers too, but are ignored.
+ * @returns false if the payload is malformed.
+*/
+bool parseWaterQuality(string_view payload, WaterQuality& waterQuality) {
+    // Parsed into a copy, so that a malformed payload leaves waterQuality unchanged
+    WaterQuality parsed;
+    double* fields[] = { &parsed.pH, &parsed.chlorides, &parsed.iron, &parsed.calcium, &parsed.color };
+    size_t count = 0;
+    while(true) {
+        size_t pos = payload.find(',');
+        double value;
+        if(!parseNumber(payload.substr(0, pos), value)) {
+            return false;
+        }
+        if(count < 5) {
+            *fields[count] = value;
+        }
+        count++;
+        if(pos == string_view::npos) {
+            break;
+        }
+        payload.remove_prefix(pos + 1);
+    }
+    if(count < 5) {
+        return false;
+    }
+    waterQuality = parsed;
+    return true;
+}
+
+// Binary sensor payloads, published on <topic>/bin:
+// byte 0 is the version of the format, byte 1 the encoding of the values, then the values in little endian.
+const uint8_t SENSOR_WIRE_VERSION = 1;
+enum SensorEncoding : uint8_t {
+    // int32 in thousandths of the unit (0.001 precision, like the sensors)
+    FIXED_MILLI = 0,
+    // IEEE 754 double
+    FLOAT64 = 1
+};
+const size_t SENSOR_HEADER_SIZE = 2;
+
+/**
+ * Decodes the first count values of a binary sensor payload. Values after them are ignored,
+ * so that newer sensors can append fields.
+ * @returns false if the payload is malformed or of an unknown version.
+*/
+bool decodeSensorValues(string_view payload, double* values, size_t count) {
+    if(payload.size() < SENSOR_HEADER_SIZE || (uint8_t)payload[0] != SENSOR_WIRE_VERSION) {
+        return false;
+    }
+    uint8_t encoding = payload[1];
+    size_t width = encoding == FIXED_MILLI ? 4 : encoding == FLOAT64 ? 8 : 0;
+    size_t size = payload.size() - SENSOR_HEADER_SIZE;
+    if(width == 0 || size % width != 0 || size / width < count) {
+        return false;
+    }
+    const unsigned char* data = (const unsigned char*)payload.data() + SENSOR_HEADER_SIZE;
+    for(size_t i = 0; i < count; i++, data += width) {
+        // Assembled byte by byte, so that the host endianness and alignment don't matter
+        uint64_t bits = 0;
+        for(size_t b = 0; b < width; b++) {
+            bits |= (uint64_t)data[b] << (8 * b);
+        }
+        if(encoding == FIXED_MILLI) {
+            values[i] = (int32_t)(uint32_t)bits / 1000.0;
+        } else {
+            memcpy(&values[i], &bits, sizeof(double));
+        }
+    }
+    return true;
+}
+
+/**
+ * Encodes count values as a binary sensor payload into out, which must hold
+ * SENSOR_HEADER_SIZE + 8 * count bytes.
+ * @returns the size of the payload, or 0 if a value can't be represented in the encoding.
+*/
+size_t encodeSensorValues(const double* values, size_t count, SensorEncoding encoding, char* out) {
+    size_t width = encoding == FIXED_MILLI ? 4 : 8;
+    out[0] = SENSOR_WIRE_VERSION;
+    out[1] = encoding;
+    unsigned char* data = (unsigned char*)out + SENSOR_HEADER_SIZE;
+    for(size_t i = 0; i < count; i++, data += width) {
+        uint64_t bits;
+        if(encoding == FIXED_MILLI) {
+            double milli = round(values[i] * 1000);
+            // Also false for NaN
+            if(!(milli >= INT32_MIN && milli <= INT32_MAX)) {
+                return 0;
+            }
+            bits = (uint32_t)(int32_t)milli;
+        } else {
+            memcpy(&bits, &values[i], sizeof(double));
+        }
+        for(size_t b = 0; b < width; b++) {
+            data[b] = (bits >> (8 * b)) & 0xff;
+        }
+    }
+    return SENSOR_HEADER_SIZE + count * width;
+}
+
+// Decodes the binary payload of the waterQuality/bin topic, in the order of the text payload
+bool decodeWaterQuality(string_view payload, WaterQuality& waterQuality) {
+    double values[5];
+    if(!decodeSensorValues(payload, values, 5)) {
+        return false;
+    }
+    waterQuality = { .pH = values[0], .chlorides = values[1], .iron = values[2],
+                     .calcium = values[3], .color = values[4] };
+    return true;
+}
+
+// Returns true if the display payload is a setPipe command, well-formed or not
+bool isPipeCommand(string_view payload) {
+    return payload.substr(0, 7) == "setPipe" && (payload.size() == 7 || payload[7] == '/');
+}
+
+/**
+ * Parses the "setPipe/<bath|shower>/<on|off>/<debit>/<temperature>" payload of the display topic.
+ * The temperature is optional when the pipe is on, tokens after it are ignored.
+ * @returns false if the payload is malformed.
+*/
+bool parsePipeCommand(string_view payload, PipeCommand& command) {
+    string_view tokens[5];
+    size_t count = 0;
+    while(count < 5) {
+        size_t pos = payload.find('/');
+        tokens[count++] = payload.substr(0, pos);
+        if(pos == string_view::npos) {
+            break;
+        }
+        payload.remove_prefix(pos + 1);
+    }
+    if(count < 3 || tokens[0] != "setPipe") {
+        return false;
+    }
+    if(tokens[1] == "bath") {
+        command.pipe = Pipe::Bath;
+    } else if(tokens[1] == "shower") {
+        command.pipe = Pipe::Shower;
+    } else {
+        command.pipe = Pipe::Unknown;
+    }
+    command.hasTemperature = false;
+    if(tokens[2] == "on") {
+        command.state.isOn = true;
+        if(count < 4 || !parseNumber(tokens[3], command.state.debit)) {
+            return false;
+        }
+        command.state.temperature = 0;
+        if(count > 4) {
+            if(!parseNumber(tokens[4], command.state.temperature)) {
+                return false;
+            }
+            command.hasTemperature = true;
+        }
+    } else if(tokens[2] == "off") {
+        command.state = { .isOn = false, .temperature = 0, .debit = 0 };
+    } else {
+        return false;
+    }
+    return true;
+}
+
+/**
+ * Parses a JSON array of strings, e.g. ["stopper/on", "bath/on/0.2/38"].
+ * The items point into the body, so strings with escape sequences are rejected.
+ * @returns false if the body is not such an array.
+*/
+bool parseStringArray(string_view body, vector<string_view>& items) {
+    items.clear();
+    size_t pos = 0;
+    auto skipSpaces = [&]() {
+        while(pos < body.size() && isspace((unsigned char)body[pos])) {
+            pos++;
+        }
+    };
+    skipSpaces();
+    if(pos >= body.size() || body[pos++] != '[') {
+        return false;
+    }
+    skipSpaces();
+    if(pos < body.size() && body[pos] == ']') {
+        pos++;
+    } else {
+        while(true) {
+            skipSpaces();
+            if(pos >= body.size() || body[pos++] != '"') {
+                return false;
+            }
+            size_t end = body.find_first_of("\"\\", pos);
+            if(end == string_view::npos || body[end] != '"') {
+                return false;
+            }
+            items.push_back(body.substr(pos, end - pos));
+            pos = end + 1;
+            skipSpaces();
+            if(pos >= body.size()) {
+                return false;
+            }
+            char c = body[pos++];
+            if(c == ']') {
+                break;
+            }
+            if(c != ',') {
+                return false;
+            }
+        }
+    }
+    skipSpaces();
+    return pos == body.size();
+}
+
+/**
+ * Parses an operation of POST /batch, written as the path of the equivalent route:
+ * <bath|shower>/on[/<debit>[/<temperature>]], <bath|shower>/off, stopper/<on|off>, salt/<on|off>,
+ * prepare[/<weight>[/<temperature>]] and cancel-prepare. A leading or trailing "/" is allowed.
+ * @returns false if the operation is malformed.
+*/
+bool parseBatchOperation(string_view path, BatchOperation& operation) {
+    if(!path.empty() && path.front() == '/') {
+        path.remove_prefix(1);
+    }
+    if(!path.empty() && path.back() == '/') {
+        path.remove_suffix(1);
+    }
+    string_view tokens[4];
+    size_t count = 0;
+    while(true) {
+        if(count == 4) {
+            return false;
+        }
+        size_t pos = path.find('/');
+        tokens[count++] = path.substr(0, pos);
+        if(pos == string_view::npos) {
+            break;
+        }
+        path.remove_prefix(pos + 1);
+    }
+    operation = {};
+    auto parseOn = [&](string_view token) {
+        if(token == "on") {
+            operation.on = true;
+        } else if(token == "off") {
+            operation.on = false;
+        } else {
+            return false;
+        }
+        return true;
+    };
+
+    if(tokens[0] == "bath" || tokens[0] == "shower") {
+        operation.pipe = tokens[0] == "bath" ? Pipe::Bath : Pipe::Shower;
+        if(count < 2 || !parseOn(tokens[1])) {
+            return false;
+        }
+        if(!operation.on) {
+            operation.action = BatchAction::PipeOff;
+            return count == 2;
+        }
+        operation.action = BatchAction::PipeOn;
+        if(count > 2) {
+            operation.hasDebit = parseNumber(tokens[2], operation.debit);
+            if(!operation.hasDebit) {
+                return false;
+            }
+        }
+        if(count > 3) {
+            operation.hasTemperature = parseNumber(tokens[3], operation.temperature);
+            if(!operation.hasTemperature) {
+                return false;
+            }
+        }
+        return true;
+    }
+    if(tokens[0] == "stopper" || tokens[0] == "salt") {
+        operation.action = tokens[0] == "stopper" ? BatchAction::Stopper : BatchAction::SaltPump;
+        return count == 2 && parseOn(tokens[1]);
+    }
+    if(tokens[0] == "prepare") {
+        if(count == 1) {
+            operation.action = BatchAction::PrepareProfile;
+            return true;
+        }
+        operation.action = BatchAction::Prepare;
+        if(count > 3 || !parseNumber(tokens[1], operation.weight)) {
+            return false;
+        }
+        if(count > 2) {
+            operation.hasTemperature = parseNumber(tokens[2], operation.temperature);
+            return operation.hasTemperature;
+        }
+        return true;
+    }
+    if(tokens[0] == "cancel-prepare") {
+        operation.action = BatchAction::CancelPrepare;
+        return count == 1;
+    }
+    return false;
+}
+
+// The JSON helpers write an object into the writer, so that they can be nested without intermediate strings
+
+void pipeStateToJson(JsonWriter& json, PipeState state) {
+    // isOn is kept as 0/1, as in the previous responses
+    json.beginObject().field("isOn", (int)state.isOn);
     if(state.isOn) {
-        stateResponse += ", \"temperature\": " + to_string(state.temperature);
-        stateResponse += ", \"debit\": " + to_string(state.debit);
+        json.field("temperature", state.temperature);
+        json.field("debit", state.debit);
+    }
+    json.endObject();
+}
+
+void profileToJson(JsonWriter& json, UserProfile profile) {
+    json.beginObject()
+        .field("weight", profile.weight)
+        .field("preferredBathTemperature", profile.preferredBathTemperature)
+        .field("preferredShowerTemperature", profile.preferredShowerTemperature)
+        .endObject();
+}
+
+void tickStatsToJson(JsonWriter& json, TickStats stats) {
+    // Lateness is measured in microseconds
+    json.beginObject()
+        .field("runs", stats.runs)
+        .field("lastLateness", stats.lastLateness)
+        .field("maxLateness", stats.maxLateness)
+        .field("avgLateness", stats.avgLateness)
+        .endObject();
+}
+
+void publisherStatsToJson(JsonWriter& json, PublisherStats stats) {
+    json.beginObject()
+        .field("queueDepth", (uint64_t)stats.queueDepth)
+        .field("queueCapacity", (uint64_t)stats.queueCapacity)
+        .field("enqueued", stats.enqueued)
+        .field("sent", stats.sent)
+        .field("dropped", stats.dropped)
+        .field("failed", stats.failed)
+        .field("batches", stats.batches)
+        .endObject();
+}
+
+void historyPointToJson(JsonWriter& json, const HistoryPoint& point) {
+    json.beginObject()
+        .field("time", point.time)
+        .field("min", point.min)
+        .field("max", point.max)
+        .field("avg", point.avg)
+        .field("count", point.count)
+        .endObject();
+}
+
+void journalStatsToJson(JsonWriter& json, JournalStats stats) {
+    json.beginObject()
+        .field("records", stats.records)
+        .field("recordBytes", stats.recordBytes)
+        .field("commits", stats.commits)
+        .field("syncs", stats.syncs)
+        .field("logBytes", stats.logBytes)
+        .field("snapshotBytes", stats.snapshotBytes)
+        .field("compactions", stats.compactions)
+        .field("failed", stats.failed)
+        .endObject();
+}
+
+void archiveStatsToJson(JsonWriter& json, ArchiveStats stats) {
+    json.beginObject()
+        .field("segments", stats.segments)
+        .field("rows", stats.rows)
+        .field("bytes", stats.bytes)
+        .field("bytesPerSample", stats.rows ? (double)stats.bytes / (stats.rows * (int)ArchiveColumn::Count) : 0.0)
+        .field("failed", stats.failed)
+        .endObject();
+}
+
+void waterQualityStatsToJson(JsonWriter& json, const WaterQualityStats& stats) {
+    json.beginObject()
+        .field("unsafe", stats.unsafe)
+        .field("badSamples", (uint64_t)stats.badSamples)
+        .field("goodSamples", (uint64_t)stats.goodSamples)
+        .field("shutoffs", stats.shutoffs);
+    json.key("debounce").beginObject()
+        .field("shutoffSamples", (uint64_t)stats.debounce.shutoffSamples)
+        .field("resumeSamples", (uint64_t)stats.debounce.resumeSamples)
+        .field("hysteresis", stats.debounce.hysteresis)
+        .endObject();
+    for(int i = 0; i < WATER_PARAMETERS; i++) {
+        const WaterParameterStats& parameter = stats.parameters[i];
+        json.key(WaterAnalytics::parameterName(i)).beginObject()
+            .field("value", parameter.value)
+            .field("ewma", parameter.ewma)
+            .field("ewmaStddev", parameter.ewmaStddev)
+            .field("mean", parameter.mean)
+            .field("stddev", parameter.stddev)
+            .field("zScore", parameter.zScore)
+            .field("samples", parameter.samples)
+            .field("anomalies", parameter.anomalies)
+            .field("drifting", parameter.drifting)
+            .endObject();
     }
-    stateResponse += "} ";
-    return stateResponse;
+    json.endObject();
 }
 
-string profileToJson(UserProfile profile) {
-    string stateResponse = "{\"weight\": " + to_string(profile.weight);
-    stateResponse += ", \"preferredBathTemperature\": " + to_string(profile.preferredBathTemperature);
-    stateResponse += ", \"preferredShowerTemperature\": " + to_string(profile.preferredShowerTemperature);
-    stateResponse += "} ";
-    return stateResponse;
-}
\ No newline at end of file
+void deviceTraitsToJson(JsonWriter& json, const DeviceTraits& traits) {
+    json.beginObject()
+        .field("name", traits.name)
+        .field("capacity", traits.capacity)
+        .field("maxBathDebit", traits.maxBathDebit)
+        .field("maxShowerDebit", traits.maxShowerDebit)
+        .field("drainSpeed", traits.drainSpeed)
+        .field("minWaterTemperature", traits.minWaterTemperature)
+        .field("maxWaterTemperature", traits.maxWaterTemperature)
+        .endObject();
+}
+
+void physicsStatsToJson(JsonWriter& json, PhysicsStats stats) {
+    json.beginObject()
+        .field("step", stats.step)
+        .field("volume", stats.water.volume)
+        .field("temperature", stats.water.temperature)
+        .field("inflow", stats.flow.inflow)
+        .field("inflowTemperature", stats.flow.inflowTemperature)
+        .field("drain", stats.flow.drain)
+        .endObject();
+}
+
+void fillStatsToJson(JsonWriter& json, FillStats stats) {
+    json.beginObject()
+        .field("shutoffs", stats.shutoffs)
+        .field("lastOvershoot", stats.lastOvershoot)
+        .field("maxOvershoot", stats.maxOvershoot)
+        .field("avgOvershoot", stats.shutoffs ? stats.totalOvershoot / stats.shutoffs : 0.0)
+        .field("lastLateness", stats.lastLateness)
+        .field("maxLateness", stats.maxLateness)
+        .endObject();
+}
+
+void telemetryCountersToJson(JsonWriter& json, TelemetryCounters counters) {
+    json.beginObject()
+        .field("sent", counters.sent)
+        .field("suppressed", counters.suppressed)
+        .field("coalesced", counters.coalesced)
+        .endObject();
+}
+
+void topicStatsToJson(JsonWriter& json, const TopicStats& stats) {
+    // Latency is measured in nanoseconds
+    json.beginObject()
+        .field("topic", string_view(stats.topic))
+        .field("messages", stats.messages)
+        .field("ignored", stats.ignored)
+        .field("avgLatency", stats.avgLatency)
+        .field("maxLatency", stats.maxLatency)
+        .endObject();
+}